@@ -0,0 +1,438 @@
+///////////////////////////////////////////////////////////////////////////////
+// Crank-angle event scheduler.
+//
+// On the Due, deadlines are handled by TC5 (channel 2 of TC1) in one-shot
+// compare mode. The capture timers use TC0, TC7 and TC8, the fixed-rate
+// control tick uses TC6, and the PWM outputs have their own peripheral, so
+// TC5 is free. DueTimer owns the TC interrupt handlers, so the interrupt is
+// routed through its callback for Timer5.
+///////////////////////////////////////////////////////////////////////////////
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "DueTimer.h"
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "AngleScheduler.h"
+#include "SelfTest.h"
+
+typedef unsigned (*SchedulerClock)();
+typedef void (*SchedulerAlarm)(unsigned delay);
+
+class AngleScheduler : public IAngleScheduler
+{
+private:
+	struct AngleEvent
+	{
+		float CamAngle;
+		AngleEventCallback Callback;
+		unsigned Deadline;
+		unsigned LastFired;
+		int Fired;
+		int Pending;
+	};
+
+	AngleEvent events[MaxEvents];
+	int eventCount;
+
+	unsigned referenceTime;
+	float referenceAngle;
+	unsigned ticksPerRevolution;
+
+	SchedulerClock clock;
+	SchedulerAlarm alarm;
+
+	// Set once TC5 is configured, so that its interrupt is only masked and
+	// unmasked after its callback is in place.
+	int alarmInterrupt;
+
+	///////////////////////////////////////////////////////////////////////////
+	// The reference is updated by the edge handlers, and read by OnAlarm in
+	// TC5. TC5 is masked while the reference changes, in case it is changed
+	// from a lower priority, and the edge handlers are held off while OnAlarm
+	// projects and arms, since they preempt TC5.
+	///////////////////////////////////////////////////////////////////////////
+	void MaskAlarm()
+	{
+#ifdef ARDUINO
+		if (alarmInterrupt)
+		{
+			NVIC_DisableIRQ(TC5_IRQn);
+		}
+#endif
+	}
+
+	void UnmaskAlarm()
+	{
+#ifdef ARDUINO
+		if (alarmInterrupt)
+		{
+			NVIC_EnableIRQ(TC5_IRQn);
+		}
+#endif
+	}
+
+	static void HoldEdges()
+	{
+#ifdef ARDUINO
+		noInterrupts();
+#endif
+	}
+
+	static void ReleaseEdges()
+	{
+#ifdef ARDUINO
+		interrupts();
+#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Compute the next deadline for an event, from the latest reference.
+	///////////////////////////////////////////////////////////////////////////
+	void Project(AngleEvent *event)
+	{
+		float degrees = event->CamAngle - referenceAngle;
+		if (degrees < 0)
+		{
+			degrees += 360.0f;
+		}
+
+		unsigned deadline = referenceTime + (unsigned)((degrees * ticksPerRevolution) / 360.0f);
+
+		// A new reference can project an event back onto the occurrence that
+		// just fired, so skip ahead to the next revolution in that case.
+		if (event->Fired && ((int)(deadline - event->LastFired) < (int)(ticksPerRevolution / 2)))
+		{
+			deadline += ticksPerRevolution;
+		}
+
+		event->Deadline = deadline;
+		event->Pending = 1;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Re-project all events and arm the timer for the earliest one.
+	///////////////////////////////////////////////////////////////////////////
+	void Reproject()
+	{
+		if (ticksPerRevolution == 0)
+		{
+			return;
+		}
+
+		for (int i = 0; i < eventCount; i++)
+		{
+			Project(&events[i]);
+		}
+
+		ArmNext(clock());
+	}
+
+	void ArmNext(unsigned now)
+	{
+		// If the engine has stopped, let the events lapse until the next
+		// crank mark provides a fresh reference.
+		if ((now - referenceTime) > ticksPerRevolution * 2)
+		{
+			return;
+		}
+
+		int earliest = -1;
+		int shortest = 0;
+		for (int i = 0; i < eventCount; i++)
+		{
+			if (!events[i].Pending)
+			{
+				continue;
+			}
+
+			int delay = (int)(events[i].Deadline - now);
+			if ((earliest == -1) || (delay < shortest))
+			{
+				earliest = i;
+				shortest = delay;
+			}
+		}
+
+		if (earliest != -1)
+		{
+			alarm(shortest > 0 ? shortest : 0);
+		}
+	}
+
+public:
+	AngleScheduler(SchedulerClock clock, SchedulerAlarm alarm)
+	{
+		this->clock = clock;
+		this->alarm = alarm;
+		eventCount = 0;
+		referenceTime = 0;
+		referenceAngle = 0;
+		ticksPerRevolution = 0;
+		alarmInterrupt = 0;
+	}
+
+	virtual void Initialize()
+	{
+#ifdef ARDUINO
+		if (alarm == ArmTimerCounter)
+		{
+			pmc_set_writeprotect(false);
+			pmc_enable_periph_clk(ID_TC5);
+			TC_Configure(TC1, 2, TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC | TC_CMR_CPCSTOP | TC_CMR_TCCLKS_TIMER_CLOCK1);
+			TC1->TC_CHANNEL[2].TC_IER = TC_IER_CPCS;
+			TC1->TC_CHANNEL[2].TC_IDR = ~TC_IER_CPCS;
+			Timer5.attachInterrupt(OnTimerCounter);
+			NVIC_EnableIRQ(TC5_IRQn);
+			alarmInterrupt = 1;
+		}
+#endif
+	}
+
+	virtual int AddEvent(float crankAngle, AngleEventCallback callback)
+	{
+		if (eventCount == MaxEvents)
+		{
+			return -1;
+		}
+
+		AngleEvent *event = &events[eventCount];
+		event->CamAngle = crankAngle / 2;
+		event->Callback = callback;
+		event->Deadline = 0;
+		event->LastFired = 0;
+		event->Fired = 0;
+		event->Pending = 0;
+		return eventCount++;
+	}
+
+	virtual void SetEventAngle(int event, float crankAngle)
+	{
+		events[event].CamAngle = crankAngle / 2;
+	}
+
+	virtual void SetReference(unsigned time, float camAngle, unsigned ticksPerCamRevolution)
+	{
+		MaskAlarm();
+		referenceTime = time;
+		referenceAngle = camAngle;
+		ticksPerRevolution = ticksPerCamRevolution;
+		Reproject();
+		UnmaskAlarm();
+	}
+
+	virtual void SetSpeed(unsigned ticksPerCamRevolution)
+	{
+		MaskAlarm();
+		ticksPerRevolution = ticksPerCamRevolution;
+		Reproject();
+		UnmaskAlarm();
+	}
+
+	virtual void OnAlarm()
+	{
+		unsigned now = clock();
+		unsigned lateThreshold = ticksPerRevolution / 720;
+
+		for (int i = 0; i < eventCount; i++)
+		{
+			AngleEvent *event = &events[i];
+			if (!event->Pending || ((int)(event->Deadline - now) > 0))
+			{
+				continue;
+			}
+
+			if ((now - event->Deadline) > lateThreshold)
+			{
+				LateAngleEvents++;
+			}
+
+			// Only the callback runs with the edge handlers enabled.
+			event->Callback();
+
+			HoldEdges();
+			event->Fired = 1;
+			event->LastFired = event->Deadline;
+			Project(event);
+			ReleaseEdges();
+		}
+
+		HoldEdges();
+		ArmNext(now);
+		ReleaseEdges();
+	}
+
+#ifdef ARDUINO
+	static unsigned GetClock()
+	{
+		return micros();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// TIMER_CLOCK1 is MCK/2, which is 42 counts per microsecond.
+	///////////////////////////////////////////////////////////////////////////
+	static void ArmTimerCounter(unsigned delay)
+	{
+		TC_SetRC(TC1, 2, (delay * 42) + 1);
+		TC_Start(TC1, 2);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// DueTimer's TC5 handler has already read (and cleared) the status.
+	///////////////////////////////////////////////////////////////////////////
+	static void OnTimerCounter()
+	{
+		IAngleScheduler::GetInstance()->OnAlarm();
+	}
+#endif
+};
+
+static IAngleScheduler *instance;
+
+///////////////////////////////////////////////////////////////////////////////
+// Factory method
+///////////////////////////////////////////////////////////////////////////////
+IAngleScheduler* IAngleScheduler::GetInstance()
+{
+	if (instance == NULL)
+	{
+#ifdef ARDUINO
+		instance = new AngleScheduler(AngleScheduler::GetClock, AngleScheduler::ArmTimerCounter);
+#endif
+	}
+
+	return instance;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+static unsigned testClock;
+static unsigned testDeadline;
+static unsigned testAlarmCount;
+static unsigned testCallbackCount;
+
+unsigned GetSchedulerTestClock()
+{
+	return testClock;
+}
+
+void SetSchedulerTestAlarm(unsigned delay)
+{
+	testDeadline = testClock + delay;
+	testAlarmCount++;
+}
+
+void CountSchedulerCallback()
+{
+	testCallbackCount++;
+}
+
+IAngleScheduler* GetAngleSchedulerForTesting()
+{
+	testClock = 1000;
+	testDeadline = 0;
+	testAlarmCount = 0;
+	testCallbackCount = 0;
+	LateAngleEvents = 0;
+
+	return new AngleScheduler(GetSchedulerTestClock, SetSchedulerTestAlarm);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A revolution of 3600 ticks is 10 ticks per cam degree, 5 per crank degree.
+///////////////////////////////////////////////////////////////////////////////
+bool TestAngleProjection()
+{
+	IAngleScheduler *scheduler = GetAngleSchedulerForTesting();
+	scheduler->AddEvent(180.0f, CountSchedulerCallback);
+
+	scheduler->SetReference(1000, 0.0f, 3600);
+	if (!CompareUnsigned(testDeadline, 1900, "Deadline"))
+	{
+		return false;
+	}
+
+	// A reference from a later mark moves the deadline into the next cycle.
+	testClock = 1200;
+	scheduler->SetReference(1200, 180.0f, 3600);
+	if (!CompareUnsigned(testDeadline, 1200 + 2700, "Wrapped"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A new speed estimate moves the pending deadline.
+///////////////////////////////////////////////////////////////////////////////
+bool TestAngleReproject()
+{
+	IAngleScheduler *scheduler = GetAngleSchedulerForTesting();
+	scheduler->AddEvent(180.0f, CountSchedulerCallback);
+	scheduler->SetReference(1000, 0.0f, 3600);
+
+	testClock = 1500;
+	scheduler->SetSpeed(7200);
+	if (!CompareUnsigned(testDeadline, 2800, "Deadline"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Run several revolutions with a crank mark at the start of each, and
+// verify that the event fires exactly once per revolution.
+///////////////////////////////////////////////////////////////////////////////
+bool TestAngleFiring()
+{
+	IAngleScheduler *scheduler = GetAngleSchedulerForTesting();
+	scheduler->AddEvent(180.0f, CountSchedulerCallback);
+
+	for (unsigned revolution = 0; revolution < 10; revolution++)
+	{
+		unsigned markTime = 1000 + (revolution * 3600);
+		testClock = markTime;
+		scheduler->SetReference(markTime, 0.0f, 3600);
+
+		// Advance the clock through the revolution, firing alarms as they come due.
+		for (testClock = markTime; testClock < markTime + 3600; testClock += 100)
+		{
+			if ((int)(testDeadline - testClock) <= 0)
+			{
+				scheduler->OnAlarm();
+			}
+		}
+	}
+
+	if (!CompareUnsigned(testCallbackCount, 10, "Callbacks"))
+	{
+		return false;
+	}
+
+	if (!CompareUnsigned(LateAngleEvents, 0, "Late"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestAngleScheduler()
+{
+	InvokeTest(AngleProjection);
+	InvokeTest(AngleReproject);
+	InvokeTest(AngleFiring);
+}
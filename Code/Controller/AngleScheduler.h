@@ -0,0 +1,41 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs callbacks at fixed crank angles.
+//
+// Each crank mark provides a reference time and angle. Event angles are
+// projected forward from the latest reference using the current speed
+// estimate, and a timer compare interrupt fires the callbacks. Pending
+// events are re-projected whenever a new reference or speed estimate arrives.
+//
+// Angles are crank degrees (0-720) after crank mark zero. Times are in the
+// same ticks as the interrupt handlers' timers (microseconds).
+///////////////////////////////////////////////////////////////////////////////
+
+typedef void (*AngleEventCallback)();
+
+class IAngleScheduler
+{
+public:
+	static const int MaxEvents = 4;
+
+	static IAngleScheduler* GetInstance();
+
+	virtual void Initialize() = 0;
+
+	// Returns the event index, or -1 if there are no free slots.
+	virtual int AddEvent(float crankAngle, AngleEventCallback callback) = 0;
+	virtual void SetEventAngle(int event, float crankAngle) = 0;
+
+	// To be invoked by the interrupt handlers. Cam degrees, like CrankState.
+	virtual void SetReference(unsigned time, float camAngle, unsigned ticksPerCamRevolution) = 0;
+	virtual void SetSpeed(unsigned ticksPerCamRevolution) = 0;
+
+	// To be invoked by the timer compare interrupt.
+	virtual void OnAlarm() = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestAngleScheduler();
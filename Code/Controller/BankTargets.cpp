@@ -0,0 +1,163 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "CurveTable.h"
+#include "BankTargets.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+BankTargets ExhaustTargets(CurveTable::CreateLeftExhaustTrimTable(), CurveTable::CreateRightExhaustTrimTable());
+BankTargets IntakeTargets(CurveTable::CreateLeftIntakeTrimTable(), CurveTable::CreateRightIntakeTrimTable());
+
+BankTargets::BankTargets(CurveTable *leftTrim, CurveTable *rightTrim)
+{
+	LeftTrim = leftTrim;
+	RightTrim = rightTrim;
+#ifdef UseCommonCamAngle
+	Common = true;
+#else
+	Common = false;
+#endif
+	DifferenceLimit = BANK_DIFFERENCE_LIMIT;
+	Left = 0;
+	Right = 0;
+	LeftLimited = 0;
+	RightLimited = 0;
+}
+
+void BankTargets::Update(unsigned rpm, float target, float leftAngle, float rightAngle)
+{
+	float leftTrim = Common ? 0 : LeftTrim->GetValue((float)rpm);
+	float rightTrim = Common ? 0 : RightTrim->GetValue((float)rpm);
+
+	Left = target + leftTrim;
+	Right = target + rightTrim;
+	LeftLimited = 0;
+	RightLimited = 0;
+
+	if (DifferenceLimit <= 0)
+	{
+		return;
+	}
+
+	// The banks are compared with their trims taken out.
+	float left = leftAngle - leftTrim;
+	float right = rightAngle - rightTrim;
+	Left = Limit(Left - leftTrim, left, right, &LeftLimited) + leftTrim;
+	Right = Limit(Right - rightTrim, right, left, &RightLimited) + rightTrim;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Keep the target within the limit of the other bank, or where this bank
+// already is if that is further away.
+///////////////////////////////////////////////////////////////////////////////
+float BankTargets::Limit(float target, float angle, float otherAngle, int *limited)
+{
+	float highest = otherAngle + DifferenceLimit;
+	if (angle > highest)
+	{
+		highest = angle;
+	}
+
+	float lowest = otherAngle - DifferenceLimit;
+	if (angle < lowest)
+	{
+		lowest = angle;
+	}
+
+	if (target > highest)
+	{
+		*limited = 1;
+		return highest;
+	}
+
+	if (target < lowest)
+	{
+		*limited = 1;
+		return lowest;
+	}
+
+	return target;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Trims apply to each bank, except in common angle mode.
+///////////////////////////////////////////////////////////////////////////////
+bool TestBankTrims()
+{
+	static float input[] = { 1000.0f, 5000.0f };
+	static float leftOutput[] = { 0.0f, 4.0f };
+	static float rightOutput[] = { 0.0f, -2.0f };
+	CurveTable leftTrim(2, input, leftOutput);
+	CurveTable rightTrim(2, input, rightOutput);
+
+	BankTargets test(&leftTrim, &rightTrim);
+	test.Common = false;
+	test.DifferenceLimit = 0;
+	test.Update(3000, 10.0f, 10.0f, 10.0f);
+	if (!WithinOnePercent(test.Left, 12.0f, "Left") ||
+		!WithinOnePercent(test.Right, 9.0f, "Right"))
+	{
+		return false;
+	}
+
+	test.Common = true;
+	test.Update(3000, 10.0f, 10.0f, 10.0f);
+	return
+		WithinOnePercent(test.Left, 10.0f, "Common Left") &&
+		WithinOnePercent(test.Right, 10.0f, "Common Right");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The faster bank waits for the slower one, and a bank that is already too
+// far ahead is held rather than pushed back.
+///////////////////////////////////////////////////////////////////////////////
+bool TestBankLimit()
+{
+	static float input[] = { 1000.0f, 5000.0f };
+	static float output[] = { 0.0f, 0.0f };
+	CurveTable trim(2, input, output);
+
+	BankTargets test(&trim, &trim);
+	test.Common = true;
+	test.DifferenceLimit = 3.0f;
+
+	// Each bank can lead the other by up to the limit.
+	test.Update(3000, 10.0f, 2.0f, 0.0f);
+	if (!WithinOnePercent(test.Left, 3.0f, "Waits") ||
+		!WithinOnePercent(test.Right, 5.0f, "Leads") ||
+		!CompareUnsigned(test.LeftLimited, 1, "Limited"))
+	{
+		return false;
+	}
+
+	test.Update(3000, 1.0f, 2.0f, 0.0f);
+	if (!WithinOnePercent(test.Left, 1.0f, "Free") ||
+		!CompareUnsigned(test.LeftLimited, 0, "Not Limited"))
+	{
+		return false;
+	}
+
+	test.Update(3000, 10.0f, 8.0f, 0.0f);
+	return WithinOnePercent(test.Left, 8.0f, "Held");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestBankTargets()
+{
+	InvokeTest(BankTrims);
+	InvokeTest(BankLimit);
+}
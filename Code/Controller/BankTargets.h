@@ -0,0 +1,47 @@
+#pragma once
+
+class CurveTable;
+
+///////////////////////////////////////////////////////////////////////////////
+// Splits a shared cam target into one target per bank.
+//
+// Each bank's target is the shared target plus that bank's trim, from a
+// trim table by RPM, so the banks can be tuned independently. In common
+// angle mode the trims are ignored and both banks are driven to the same
+// angle.
+//
+// Either way, if DifferenceLimit is non-zero a bank may not move further
+// than that from the other bank (trims aside), so the faster phaser waits
+// for the slower one. A bank that is already further away than the limit
+// is held where it is rather than pushed back.
+///////////////////////////////////////////////////////////////////////////////
+class BankTargets
+{
+public:
+	CurveTable *LeftTrim;
+	CurveTable *RightTrim;
+
+	bool Common;
+	float DifferenceLimit;
+
+	// Targets for each bank, and whether the difference limit changed them.
+	float Left;
+	float Right;
+	int LeftLimited;
+	int RightLimited;
+
+	BankTargets(CurveTable *leftTrim, CurveTable *rightTrim);
+
+	void Update(unsigned rpm, float target, float leftAngle, float rightAngle);
+
+private:
+	float Limit(float target, float angle, float otherAngle, int *limited);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestBankTargets();
+
+extern BankTargets ExhaustTargets;
+extern BankTargets IntakeTargets;
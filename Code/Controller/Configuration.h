@@ -11,6 +11,10 @@
 // information.
 #define MINIMUM_EXAVCS_RPM (IDLE_RPM + 500)
 
+// Once the solenoids are enabled, they stay enabled until RPM falls this far
+// below MINIMUM_EXAVCS_RPM.
+#define EXAVCS_RPM_HYSTERESIS 100
+
 // Opinions can differ about what the right threshold is for this.
 // Note that the stock system looks at water temp, not oil temp,
 // and oil temp lags behind water temp during warmp-up, so my chosen
@@ -23,6 +27,134 @@
 // car... I suspect it will work well enough. But two would probably
 // allow for higher PID gains. 
 // 
-// If a second mark is added, consider giving it a different width,
-// and extending the code to distinguish between the two of them.
-#define DEGREES_PER_CRANK_PULSE 360.0f
\ No newline at end of file
+// CrankState supports up to CrankState::MaxMarks marks. Mark zero is
+// the reference for the cam pulse sequence (and for cam baselines).
+// The others are identified by the width of their pulses, so the widths
+// need to be clearly different (2:1 or so). Angles and widths are in cam
+// degrees. Only the first CRANK_MARK_COUNT entries are used.
+#define CRANK_MARK_COUNT 1
+#define CRANK_MARK_ANGLES { 0.0f, 180.0f }
+#define CRANK_MARK_WIDTHS { 20.0f, 10.0f }
+
+// Crank angle (0-720 degrees after crank mark zero) at which a MAP sensor
+// sample is requested. The sample is taken by the main loop, which also owns
+// the other analog inputs.
+#define MAP_SAMPLE_ANGLE 90.0f
+
+// Solenoid PWM carrier frequency, by RPM (see CreatePwmFrequencyTable in
+// CurveTable.cpp). A low carrier lets the spool move further each period,
+// which helps when low RPM and oil pressure make it sticky. A high carrier
+// keeps the period short compared to a cam revolution at high RPM. Below
+// MINIMUM_TEMPERATURE_C the cold oil frequency is used instead.
+#define COLD_PWM_FREQUENCY_HZ 170
+
+// Square wave dither on the solenoid duty cycle, to keep the spool moving.
+// The amplitude is a fraction of the PWM period (zero disables dither), and
+// the half period is a number of PWM periods.
+#define DITHER_AMPLITUDE 0.02f
+#define DITHER_HALF_PERIOD 2
+
+// Cam degrees per second for each percent of solenoid duty beyond the dead
+// band. Characterised solenoids (see SolenoidMap.h) are scaled so that one
+// unit of feedback output moves the cam at this rate.
+#define SOLENOID_REFERENCE_SLOPE 20.0f
+
+// Cam angles to return to between solenoid characterisation measurements.
+// These should be mid-range, well away from the mechanical stops. The
+// intake angle is degrees of advance.
+#define CHARACTERIZE_EXHAUST_ANGLE 10.0f
+#define CHARACTERIZE_INTAKE_ANGLE 15.0f
+
+// Supply voltage is measured on analog input 10, through a divider that
+// scales it down by this factor (for example 50K and 10K resistors give 6).
+// Solenoid duty cycles are scaled to what they would be at the reference
+// voltage, see SupplyVoltage.h.
+#define SUPPLY_VOLTAGE_DIVIDER 6.0f
+#define SUPPLY_REFERENCE_VOLTAGE 13.5f
+
+// Oil pressure from a PLX fluid pressure sensor, if there is one in the PLX
+// chain. Below the minimum the solenoids are disabled, since the phasers
+// cannot be moved reliably. The feedback gains were tuned at the reference
+// pressure, and are scaled for other pressures, see OilPressureState.h.
+#define MINIMUM_OIL_PRESSURE_PSI 10.0f
+#define REFERENCE_OIL_PRESSURE_PSI 40.0f
+
+// Target angle steps are shaped into a trajectory that the phasers can
+// follow, see TargetTrajectory.h. Until the solenoids have been
+// characterised the rate limit is TARGET_RATE_LIMIT degrees per second;
+// after that it is a fraction of the measured slew rate. Either way the
+// trajectory reaches full rate in TARGET_RISE_TIME seconds.
+#define TARGET_RATE_LIMIT 60.0f
+#define TARGET_RATE_FRACTION 0.5f
+#define TARGET_RISE_TIME 0.1f
+
+// The velocity of the trajectory is fed forward into the feedback loops,
+// projected ahead by the typical time from a cam angle sample to the duty
+// cycle that acts on it (see the latency screens). Duty cycles are written
+// as soon as they are computed and take effect at the end of the current PWM
+// period, so this is about half a period.
+#define TARGET_FEEDFORWARD_LEAD 0.002f
+
+// Relay autotuning, see RelayAutotuner.h. The amplitude is in feedback
+// output units (see SolenoidMap.h), the hysteresis should be above the
+// noise in the cam angle, and the experiment is abandoned if the cam moves
+// further than the excursion from its target or the RPM changes by more
+// than the tolerance.
+#define AUTOTUNE_RELAY_AMPLITUDE 1.0f
+#define AUTOTUNE_HYSTERESIS 0.25f
+#define AUTOTUNE_MAX_EXCURSION 5.0f
+#define AUTOTUNE_RPM_TOLERANCE 200
+
+// Oscillation in the cam angle error is reported when its peak reaches the
+// minimum amplitude (degrees) for several cycles in a row, see
+// OscillationDetector.h. Each detection multiplies the feedback gains by
+// the backoff, down to the minimum scale. Set the backoff to 1 to report
+// oscillation without changing the gains.
+#define OSCILLATION_MIN_AMPLITUDE 0.5f
+#define OSCILLATION_BACKOFF 0.75f
+#define OSCILLATION_MIN_GAIN_SCALE 0.25f
+
+// Each bank's cam target is the shared target plus a per-bank trim, see
+// BankTargets.h. Uncomment UseCommonCamAngle to ignore the trims and drive
+// both banks to the same angle. Either way, neither bank is allowed to move
+// more than BANK_DIFFERENCE_LIMIT degrees away from the other (0 disables).
+//#define UseCommonCamAngle
+#define BANK_DIFFERENCE_LIMIT 5.0f
+
+// Maximum valve overlap, in crank degrees at 0.050" lift, that the cam
+// targets may produce, see ValveEvents.h. 11 degrees ran rough.
+#define MAX_VALVE_OVERLAP 5.0f
+
+// Cross-sensor plausibility checks, see PlausibilityMonitor.h. A check must
+// fail this many more times than it passes before its fault is set.
+#define PLAUSIBILITY_DEBOUNCE 5
+
+// Largest believable difference between a cam's RPM and the crank RPM, as a
+// fraction of the crank RPM.
+#define PLAUSIBLE_RPM_DIFFERENCE 0.1f
+
+// Fastest believable change in cam angle, in degrees per second. This is
+// well above what the phasers can do, and well below a jump between marks.
+#define PLAUSIBLE_ANGLE_RATE 500.0f
+
+// After the crank signal is lost while running, the cams are held in limp
+// mode until this many crank pulses arrive without another timeout.
+#define LIMP_RECOVERY_PULSES 20
+
+// Without capture timers, a cam or crank signal is declared lost after this
+// many of its expected pulse intervals go by without a pulse, or after
+// SIGNAL_LOSS_MAX_TIME milliseconds, whichever is sooner.
+#define SIGNAL_LOSS_PERIODS 4
+#define SIGNAL_LOSS_MAX_TIME 500
+
+// Uncomment this to run the feedback loops at a fixed rate from a timer,
+// using the latest cam angles, rather than once per cam angle measurement.
+// The duty cycles are written at the same rate.
+//#define UseFixedRateControl
+#define CONTROL_RATE_HZ 1000
+
+// Uncomment this to control the intake cams as well as the exhaust cams.
+// This needs sensors on both intake cams and two more solenoid drivers, see
+// Controller.ino for the pins. Without intake cam signals the controller
+// will never finish calibrating, so leave it off for exhaust-only engines.
+//#define UseIntakeCams
\ No newline at end of file
@@ -0,0 +1,125 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "DueTimer.h"
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "ControlTimer.h"
+#include "SelfTest.h"
+
+ControlTimer FixedRateTimer;
+
+ControlTimer::ControlTimer()
+{
+	NominalPeriod = 0;
+	Jitter = 0;
+	MaxJitter = 0;
+	TickCount = 0;
+	lastTick = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Set the period that ticks are measured against.
+///////////////////////////////////////////////////////////////////////////////
+void ControlTimer::SetRate(unsigned rateHz)
+{
+	NominalPeriod = 1000000 / rateHz;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start invoking the tick function at the given rate.
+//
+// The timer's interrupt handler does not check for a missing callback, so a
+// NULL tick is refused rather than left to fault on the first interrupt.
+///////////////////////////////////////////////////////////////////////////////
+void ControlTimer::Start(unsigned rateHz, void (*tick)())
+{
+	if ((tick == NULL) || (rateHz == 0))
+	{
+		return;
+	}
+
+	SetRate(rateHz);
+
+#ifdef ARDUINO
+	Timer6.attachInterrupt(tick).setFrequency(rateHz).start();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Measure the time since the previous tick against the nominal period.
+///////////////////////////////////////////////////////////////////////////////
+void ControlTimer::RecordTick(unsigned now)
+{
+	TickCount++;
+
+	// The first tick has nothing to compare against.
+	if (TickCount > 1)
+	{
+		unsigned period = now - lastTick;
+		Jitter = period > NominalPeriod ? period - NominalPeriod : NominalPeriod - period;
+		if (Jitter > MaxJitter)
+		{
+			MaxJitter = Jitter;
+		}
+	}
+
+	lastTick = now;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Ticks that arrive early or late are both counted as jitter.
+///////////////////////////////////////////////////////////////////////////////
+bool TestControlJitter()
+{
+	ControlTimer timer;
+	timer.SetRate(1000);
+
+	if (!CompareUnsigned(timer.NominalPeriod, 1000, "Period"))
+	{
+		return false;
+	}
+
+	timer.RecordTick(5000);
+	timer.RecordTick(6000);
+	if (!CompareUnsigned(timer.Jitter, 0, "OnTime"))
+	{
+		return false;
+	}
+
+	timer.RecordTick(7030);
+	if (!CompareUnsigned(timer.Jitter, 30, "Late"))
+	{
+		return false;
+	}
+
+	timer.RecordTick(8010);
+	if (!CompareUnsigned(timer.Jitter, 20, "Early"))
+	{
+		return false;
+	}
+
+	if (!CompareUnsigned(timer.MaxJitter, 30, "Max"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestControlTimer()
+{
+	InvokeTest(ControlJitter);
+}
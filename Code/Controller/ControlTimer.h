@@ -0,0 +1,41 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Fixed-rate tick for the time-triggered control mode (UseFixedRateControl
+// in Configuration.h). On the Due this uses DueTimer channel 6 (TC6).
+//
+// Each tick's deviation from the nominal period is measured, so that the
+// time-triggered and event-triggered modes can be compared.
+///////////////////////////////////////////////////////////////////////////////
+class ControlTimer
+{
+public:
+	// Microseconds between ticks.
+	unsigned NominalPeriod;
+
+	// Deviation from the nominal period, in microseconds.
+	unsigned Jitter;
+	unsigned MaxJitter;
+
+	unsigned TickCount;
+
+	ControlTimer();
+
+	// Set the nominal period only, without starting the hardware timer.
+	void SetRate(unsigned rateHz);
+
+	void Start(unsigned rateHz, void (*tick)());
+
+	// To be invoked at the start of each tick.
+	void RecordTick(unsigned now);
+
+private:
+	unsigned lastTick;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestControlTimer();
+
+extern ControlTimer FixedRateTimer;
@@ -17,6 +17,8 @@
 // Pin D3 = TIOA7 = left cam 
 // Pin D11 = TIOA8 = right cam 
 // Pin D2 = TIOA0 = crank
+// Pin D12 = TIOB8 = left intake cam (only with UseIntakeCams)
+// Pin A7 (D61) = TIOA1 = right intake cam (only with UseIntakeCams)
 //
 // Cam timers are triggered on rising and falling edges of cam signal
 // Crank time is read 'manually' when interrupt is processed - would
@@ -26,8 +28,8 @@
 // Analog input 1 is used for crank sensor analog (which is only useful for diagnostics)
 // Analog 8 = MAP sensor
 // Analog 9 = input knob 1
-// Analog 10 = input knob 2
-// Analog 10-15 available for whatever else.
+// Analog 10 = supply voltage, through a divider (see Configuration.h)
+// Analog 11-15 available for whatever else.
 // 
 // Digital pin 36 = PWM out for left cam
 // Digital pin 38 = PWM out for right cam
@@ -47,6 +49,7 @@
 #include "DFR_Key.h"
 #include "RollingAverage.h"
 #include "ExhaustCamState.h"
+#include "IntakeCamState.h"
 #include "CrankState.h"
 #include "InterruptHandlers.h"
 #include "Globals.h"
@@ -59,6 +62,21 @@
 #include "Terminal.h"
 #include "Configuration.h"
 #include "CurveTable.h"
+#include "AngleScheduler.h"
+#include "InterruptPriorities.h"
+#include "ControlTimer.h"
+#include "LatencyHistogram.h"
+#include "SolenoidOutput.h"
+#include "SolenoidMap.h"
+#include "SolenoidCharacterizer.h"
+#include "TargetTrajectory.h"
+#include "RelayAutotuner.h"
+#include "OscillationDetector.h"
+#include "BankTargets.h"
+#include "ValveEvents.h"
+#include "PlausibilityMonitor.h"
+#include "SupplyVoltage.h"
+#include "OilPressureState.h"
 
 //#include <..\Pwm_Lib\pwm_lib.h>
 #include "pwm_lib\pwm_lib.h"
@@ -75,6 +93,8 @@ IPeriodicJobs *jobs = IPeriodicJobs::GetInstance();
 IIntervalRecorder *intervalRecorder = IIntervalRecorder::GetInstance();
 ITerminal *terminal = ITerminal::GetInstance();
 CurveTable *table = CurveTable::CreateExhaustCamTable();
+CurveTable *intakeTable = CurveTable::CreateIntakeCamTable();
+IAngleScheduler *angleScheduler = IAngleScheduler::GetInstance();
 
 // Do not change these at run-time!
 //
@@ -101,14 +121,599 @@ int useStaticBaseline = 1;
 
 // Exhaust cam solenoid drivers
 using namespace arduino_due::pwm_lib;
-pwm<pwm_pin::PWML1_PC4> RightSolenoid; // pin 36, blue, passenger side
-pwm<pwm_pin::PWML2_PC6> LeftSolenoid; // pin 38, yellow, driver side
+SolenoidOutput<pwm<pwm_pin::PWML1_PC4> > RightSolenoid; // pin 36, blue, passenger side
+SolenoidOutput<pwm<pwm_pin::PWML2_PC6> > LeftSolenoid; // pin 38, yellow, driver side
+
+#ifdef UseIntakeCams
+// Intake cam solenoid drivers
+SolenoidOutput<pwm<pwm_pin::PWML0_PC2> > RightIntakeSolenoid; // pin 34, passenger side
+SolenoidOutput<pwm<pwm_pin::PWML3_PC8> > LeftIntakeSolenoid; // pin 40, driver side
+#endif
 
 // 300hz = 3.33ms
 // = 3330.0 microseconds
 // Period is defined in hundredths of a microsecond
+// This is only the initial period, see GetSolenoidPeriod.
 #define PWM_PERIOD 333 * 1000
 
+///////////////////////////////////////////////////////////////////////////////
+// Convert a duty cycle in percent, at the reference supply voltage, into a
+// fraction of the PWM period at the measured supply voltage.
+///////////////////////////////////////////////////////////////////////////////
+float GetCompensatedDuty(float duty)
+{
+	return Supply.Compensate(duty) / 100.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Convert the output of a feedback loop into a solenoid duty cycle, as a
+// fraction of the PWM period. The output is a requested flow, and the map
+// turns that into a duty cycle for this particular solenoid.
+///////////////////////////////////////////////////////////////////////////////
+float GetSolenoidDuty(Feedback *feedback, SolenoidMap *map)
+{
+	return GetCompensatedDuty(map->GetDuty(feedback->Output));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tell a feedback loop how much flow its solenoid can deliver at the present
+// supply voltage, so that the integral term does not wind up beyond it.
+///////////////////////////////////////////////////////////////////////////////
+void SetOutputLimits(Feedback *feedback, SolenoidMap *map)
+{
+	map->GetFlowLimits(Supply.GetMaximumDuty(), &(feedback->OutputMinimum), &(feedback->OutputMaximum));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Limit a target trajectory to what the slower of two characterised
+// solenoids can deliver in either direction. Uncharacterised solenoids
+// leave the configured limit in place.
+///////////////////////////////////////////////////////////////////////////////
+void SetTrajectoryLimit(TargetTrajectory *trajectory, SolenoidMap *left, SolenoidMap *right)
+{
+	if ((left->PointCount == 0) || (right->PointCount == 0))
+	{
+		return;
+	}
+
+	float maximumDuty = Supply.GetMaximumDuty();
+	float leftMinimum, leftMaximum, rightMinimum, rightMaximum;
+	left->GetFlowLimits(maximumDuty, &leftMinimum, &leftMaximum);
+	right->GetFlowLimits(maximumDuty, &rightMinimum, &rightMaximum);
+
+	float limits[] = { -leftMinimum, leftMaximum, -rightMinimum, rightMaximum };
+	float flow = limits[0];
+	for (int i = 1; i < 4; i++)
+	{
+		if (limits[i] < flow)
+		{
+			flow = limits[i];
+		}
+	}
+
+	if (flow > 0)
+	{
+		trajectory->SetFlowLimit(flow);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// While an autotuner is running, its relay output goes through the map in
+// place of the feedback loop's.
+///////////////////////////////////////////////////////////////////////////////
+float GetAutotuneDuty(RelayAutotuner *autotuner, Feedback *feedback, SolenoidMap *map, unsigned sampleTime, float angle, float target)
+{
+	float output = autotuner->Update(sampleTime, Crank.Rpm, angle, target, feedback->Output, feedback->GainScale);
+	return GetCompensatedDuty(map->GetDuty(output));
+}
+
+// Set at the end of setup(), once the solenoid drivers have been started.
+volatile int controlReady;
+
+// Edge timestamps behind the pending duty cycles, for the latency histograms.
+volatile unsigned LeftSolenoidSampleTime;
+volatile unsigned RightSolenoidSampleTime;
+volatile unsigned LeftIntakeSolenoidSampleTime;
+volatile unsigned RightIntakeSolenoidSampleTime;
+
+///////////////////////////////////////////////////////////////////////////////
+// Invoked after each control computation. The PWM update registers hold a
+// new duty cycle until the end of the current period, so it is written as
+// soon as it is known rather than waiting for a point in the engine cycle.
+///////////////////////////////////////////////////////////////////////////////
+void ApplySolenoidDuty()
+{
+	LeftSolenoid.Apply();
+	RightSolenoid.Apply();
+#ifdef UseIntakeCams
+	LeftIntakeSolenoid.Apply();
+	RightIntakeSolenoid.Apply();
+#endif
+
+	unsigned now = micros();
+	LeftLatency.Record(LeftSolenoidSampleTime, now);
+	RightLatency.Record(RightSolenoidSampleTime, now);
+#ifdef UseIntakeCams
+	LeftLatency.Record(LeftIntakeSolenoidSampleTime, now, LatencyHistogram::IntakeSolenoid);
+	RightLatency.Record(RightIntakeSolenoidSampleTime, now, LatencyHistogram::IntakeSolenoid);
+#endif
+}
+
+// Set by the angle scheduler, cleared once the main loop has read the sensor.
+volatile int manifoldPressureRequested;
+
+///////////////////////////////////////////////////////////////////////////////
+// Invoked by the angle scheduler at MAP_SAMPLE_ANGLE. analogRead is not
+// reentrant, and the main loop uses the ADC too, so the conversion itself
+// happens in the main loop.
+///////////////////////////////////////////////////////////////////////////////
+void SampleManifoldPressure()
+{
+	manifoldPressureRequested = 1;
+}
+
+// Set while the feedback loops are controlling the cams.
+int controlEnabled;
+
+// Set while limp mode is holding the solenoids at their learned outputs.
+int limpHolding;
+
+// Set while a characterizer or autotuner drives each solenoid.
+int leftOverride;
+int rightOverride;
+int leftIntakeOverride;
+int rightIntakeOverride;
+
+///////////////////////////////////////////////////////////////////////////////
+// While a characterizer or autotuner drives a solenoid, its cam does not
+// follow the feedback loop, so the loop neither integrates nor learns, and
+// the oscillation detector does not mistake the experiment for a limit
+// cycle. When the experiment finishes, the loop starts over from its
+// learned output.
+///////////////////////////////////////////////////////////////////////////////
+bool IsOverridden(bool active, int *overridden, Feedback *feedback)
+{
+	if (active)
+	{
+		*overridden = 1;
+		return true;
+	}
+
+	if (*overridden)
+	{
+		*overridden = 0;
+		feedback->Engage(Crank.Rpm);
+	}
+
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Whether the cams should be under control. Once enabled, control stays on
+// until RPM falls EXAVCS_RPM_HYSTERESIS below the threshold, so that RPM
+// hovering around the threshold does not toggle it.
+///////////////////////////////////////////////////////////////////////////////
+int IsControlAllowed()
+{
+	// A lost signal is only acted on by the main loop, but control stops
+	// as soon as it is reported.
+	if ((mode.GetMode() != Mode::Running) || mode.IsSignalLost() || !OilPressure.IsSufficient() || onlyMeasureBaseline)
+	{
+		return 0;
+	}
+
+	unsigned threshold = MINIMUM_EXAVCS_RPM;
+	if (controlEnabled)
+	{
+		threshold -= EXAVCS_RPM_HYSTERESIS;
+	}
+
+	return Crank.Rpm > threshold;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The feedback loops start from the learned output for the current RPM, so
+// the cams are not disturbed when control resumes.
+///////////////////////////////////////////////////////////////////////////////
+void EngageControl()
+{
+	LeftFeedback.Engage(Crank.Rpm);
+	RightFeedback.Engage(Crank.Rpm);
+	ExhaustTrajectory.Reset((LeftExhaustCam.Angle + RightExhaustCam.Angle) / 2);
+#ifdef UseIntakeCams
+	LeftIntakeFeedback.Engage(Crank.Rpm);
+	RightIntakeFeedback.Engage(Crank.Rpm);
+	IntakeTrajectory.Reset(-(LeftIntakeCam.Angle + RightIntakeCam.Angle) / 2);
+#endif
+
+	leftOverride = 0;
+	rightOverride = 0;
+	leftIntakeOverride = 0;
+	rightIntakeOverride = 0;
+	controlEnabled = 1;
+	limpHolding = 0;
+}
+
+void DisengageControl()
+{
+	LeftSolenoid.Disable();
+	RightSolenoid.Disable();
+	LeftCharacterizer.Cancel();
+	RightCharacterizer.Cancel();
+	LeftAutotuner.Cancel();
+	RightAutotuner.Cancel();
+
+#ifdef UseIntakeCams
+	LeftIntakeSolenoid.Disable();
+	RightIntakeSolenoid.Disable();
+	LeftIntakeCharacterizer.Cancel();
+	RightIntakeCharacterizer.Cancel();
+	LeftIntakeAutotuner.Cancel();
+	RightIntakeAutotuner.Cancel();
+#endif
+
+	controlEnabled = 0;
+	limpHolding = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Limp mode. Without the crank signal there are no cam angles, so the
+// feedback loops cannot run. If they were running, each solenoid holds the
+// learned output for the RPM from the cams, which is what held its cam on
+// target at that RPM, rather than dropping to zero duty.
+///////////////////////////////////////////////////////////////////////////////
+void HoldCams()
+{
+	if (controlEnabled)
+	{
+		LeftCharacterizer.Cancel();
+		RightCharacterizer.Cancel();
+		LeftAutotuner.Cancel();
+		RightAutotuner.Cancel();
+#ifdef UseIntakeCams
+		LeftIntakeCharacterizer.Cancel();
+		RightIntakeCharacterizer.Cancel();
+		LeftIntakeAutotuner.Cancel();
+		RightIntakeAutotuner.Cancel();
+#endif
+
+		// Control engages from scratch when the crank signal returns.
+		controlEnabled = 0;
+		limpHolding = 1;
+	}
+
+	if (!limpHolding)
+	{
+		return;
+	}
+
+	unsigned rpm = GetCamRpm();
+	if (rpm < MINIMUM_EXAVCS_RPM - EXAVCS_RPM_HYSTERESIS)
+	{
+		DisengageControl();
+		return;
+	}
+
+	LeftFeedback.Hold(rpm);
+	RightFeedback.Hold(rpm);
+	LeftSolenoid.Pending = GetSolenoidDuty(&LeftFeedback, &LeftSolenoidMap);
+	RightSolenoid.Pending = GetSolenoidDuty(&RightFeedback, &RightSolenoidMap);
+	LeftSolenoid.Apply();
+	RightSolenoid.Apply();
+#ifdef UseIntakeCams
+	LeftIntakeFeedback.Hold(rpm);
+	RightIntakeFeedback.Hold(rpm);
+	LeftIntakeSolenoid.Pending = GetSolenoidDuty(&LeftIntakeFeedback, &LeftIntakeSolenoidMap);
+	RightIntakeSolenoid.Pending = GetSolenoidDuty(&RightIntakeFeedback, &RightIntakeSolenoidMap);
+	LeftIntakeSolenoid.Apply();
+	RightIntakeSolenoid.Apply();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs the feedback loops for any cams with new angle measurements, holds
+// any whose last measurement is too old, or disables the solenoids when the
+// controller isn't running. This runs in
+// the PendSV interrupt, raised by the cam edge handlers and by loop(), so
+// that LCD and serial work in the main loop cannot delay it.
+///////////////////////////////////////////////////////////////////////////////
+void UpdateControl()
+{
+	// Edges can raise PendSV before setup() has started the solenoids.
+	if (!controlReady)
+	{
+		return;
+	}
+
+	// A crank timeout is acted on by the main loop, but the cams are held
+	// from the moment it happens.
+	if ((mode.GetMode() == Mode::Limp) || mode.IsCrankLost())
+	{
+		HoldCams();
+		return;
+	}
+
+	float exhaustTarget = table->GetValue(Crank.Rpm);
+	float intakeTarget = intakeTable->GetValue(Crank.Rpm);
+	CamTargetAngle = exhaustTarget;
+	IntakeCamTargetAngle = intakeTarget;
+
+	// RPM jumps around a lot at idle, so rather than chasing noisy 
+	// data I am just letting the cams rest. At least for now.
+	// Might be fun to try creating overlap at idle, just to see if 
+	// it starts to sound like an old-school muscle car...
+	if (IsControlAllowed())
+	{
+		if (!controlEnabled)
+		{
+			EngageControl();
+		}
+
+#ifdef UseFixedRateControl
+		// Only the control tick raises PendSV in this mode, and every tick
+		// uses the latest angles whether or not they have changed.
+		LeftExhaustCam.Updated = 1;
+		RightExhaustCam.Updated = 1;
+		LeftIntakeCam.Updated = 1;
+		RightIntakeCam.Updated = 1;
+#endif
+
+		// The feedback loops follow the shaped targets rather than the
+		// table, with each bank's trim, and the trajectory velocity is fed
+		// forward. A bank held back by the bank difference limit or the
+		// overlap limit is not following the trajectory, so it gets no
+		// feedforward.
+		unsigned now = micros();
+		SetTrajectoryLimit(&ExhaustTrajectory, &LeftSolenoidMap, &RightSolenoidMap);
+		CamTargetAngle = ExhaustTrajectory.Update(exhaustTarget, now);
+		ExhaustTargets.Update(Crank.Rpm, CamTargetAngle, LeftExhaustCam.Angle, RightExhaustCam.Angle);
+#ifdef UseIntakeCams
+		SetTrajectoryLimit(&IntakeTrajectory, &LeftIntakeSolenoidMap, &RightIntakeSolenoidMap);
+		IntakeCamTargetAngle = IntakeTrajectory.Update(intakeTarget, now);
+		IntakeTargets.Update(Crank.Rpm, IntakeCamTargetAngle, -LeftIntakeCam.Angle, -RightIntakeCam.Angle);
+		LeftValves.Limit(&ExhaustTargets.Left, LeftExhaustCam.Angle, &IntakeTargets.Left, -LeftIntakeCam.Angle);
+		RightValves.Limit(&ExhaustTargets.Right, RightExhaustCam.Angle, &IntakeTargets.Right, -RightIntakeCam.Angle);
+		LeftValves.Update(LeftExhaustCam.Angle, -LeftIntakeCam.Angle);
+		RightValves.Update(RightExhaustCam.Angle, -RightIntakeCam.Angle);
+
+		float feedforward = IntakeTrajectory.GetFeedforward();
+		LeftIntakeFeedback.Feedforward = (IntakeTargets.LeftLimited || LeftValves.IntakeLimit > 0) ? 0 : feedforward;
+		RightIntakeFeedback.Feedforward = (IntakeTargets.RightLimited || RightValves.IntakeLimit > 0) ? 0 : feedforward;
+#else
+		// Without intake cam sensors, assume the ECU is running the intake
+		// table. Only the exhaust targets can be limited in this case.
+		float leftIntake = IntakeCamTargetAngle;
+		float rightIntake = IntakeCamTargetAngle;
+		LeftValves.Limit(&ExhaustTargets.Left, LeftExhaustCam.Angle, &leftIntake, IntakeCamTargetAngle);
+		RightValves.Limit(&ExhaustTargets.Right, RightExhaustCam.Angle, &rightIntake, IntakeCamTargetAngle);
+		LeftValves.Update(LeftExhaustCam.Angle, IntakeCamTargetAngle);
+		RightValves.Update(RightExhaustCam.Angle, IntakeCamTargetAngle);
+#endif
+		float exhaustFeedforward = ExhaustTrajectory.GetFeedforward();
+		LeftFeedback.Feedforward = (ExhaustTargets.LeftLimited || LeftValves.ExhaustLimit > 0) ? 0 : exhaustFeedforward;
+		RightFeedback.Feedforward = (ExhaustTargets.RightLimited || RightValves.ExhaustLimit > 0) ? 0 : exhaustFeedforward;
+
+		float gainScale = OilPressure.GetGainScale();
+		LeftFeedback.GainScale = gainScale * LeftOscillation.GainScale;
+		RightFeedback.GainScale = gainScale * RightOscillation.GainScale;
+		LeftIntakeFeedback.GainScale = gainScale;
+		RightIntakeFeedback.GainScale = gainScale;
+
+		unsigned period = GetSolenoidPeriod(Crank.Rpm, OilTemperature);
+		LeftSolenoid.PendingPeriod = period;
+		RightSolenoid.PendingPeriod = period;
+#ifdef UseIntakeCams
+		LeftIntakeSolenoid.PendingPeriod = period;
+		RightIntakeSolenoid.PendingPeriod = period;
+#endif
+
+		if (LeftExhaustCam.Updated)
+		{
+			LeftExhaustCam.Updated = 0;
+			LeftCamError = ExhaustTargets.Left - LeftExhaustCam.Angle;
+
+			if (IsOverridden(LeftCharacterizer.IsActive() || LeftAutotuner.IsActive(), &leftOverride, &LeftFeedback))
+			{
+				if (LeftCharacterizer.IsActive())
+				{
+					LeftSolenoid.Pending = GetCompensatedDuty(LeftCharacterizer.Update(LeftExhaustCam.SampleTime, LeftExhaustCam.Angle));
+				}
+				if (LeftAutotuner.IsActive())
+				{
+					LeftSolenoid.Pending = GetAutotuneDuty(&LeftAutotuner, &LeftFeedback, &LeftSolenoidMap, LeftExhaustCam.SampleTime, LeftExhaustCam.Angle, ExhaustTargets.Left);
+				}
+			}
+			else
+			{
+				SetOutputLimits(&LeftFeedback, &LeftSolenoidMap);
+				LeftFeedback.Update(LeftExhaustCam.SampleTime, micros(), Crank.Rpm, LeftExhaustCam.Angle, ExhaustTargets.Left);
+				LeftOscillation.Update(LeftExhaustCam.SampleTime, LeftCamError);
+				LeftSolenoid.Pending = GetSolenoidDuty(&LeftFeedback, &LeftSolenoidMap);
+			}
+			LeftSolenoidSampleTime = LeftFeedback.SampleTime;
+		}
+		// Without a new edge, nothing else would notice that the last sample
+		// has gone stale, so each pass checks its age.
+		else if (!leftOverride && LeftFeedback.HoldIfStale(LeftExhaustCam.SampleTime, now, Crank.Rpm))
+		{
+			LeftSolenoid.Pending = GetSolenoidDuty(&LeftFeedback, &LeftSolenoidMap);
+			LeftSolenoidSampleTime = LeftFeedback.SampleTime;
+		}
+
+		if (RightExhaustCam.Updated)
+		{
+			RightExhaustCam.Updated = 0;
+			RightCamError = ExhaustTargets.Right - RightExhaustCam.Angle;
+
+			if (IsOverridden(RightCharacterizer.IsActive() || RightAutotuner.IsActive(), &rightOverride, &RightFeedback))
+			{
+				if (RightCharacterizer.IsActive())
+				{
+					RightSolenoid.Pending = GetCompensatedDuty(RightCharacterizer.Update(RightExhaustCam.SampleTime, RightExhaustCam.Angle));
+				}
+				if (RightAutotuner.IsActive())
+				{
+					RightSolenoid.Pending = GetAutotuneDuty(&RightAutotuner, &RightFeedback, &RightSolenoidMap, RightExhaustCam.SampleTime, RightExhaustCam.Angle, ExhaustTargets.Right);
+				}
+			}
+			else
+			{
+				SetOutputLimits(&RightFeedback, &RightSolenoidMap);
+				RightFeedback.Update(RightExhaustCam.SampleTime, micros(), Crank.Rpm, RightExhaustCam.Angle, ExhaustTargets.Right);
+				RightOscillation.Update(RightExhaustCam.SampleTime, RightCamError);
+				RightSolenoid.Pending = GetSolenoidDuty(&RightFeedback, &RightSolenoidMap);
+			}
+			RightSolenoidSampleTime = RightFeedback.SampleTime;
+		}
+		else if (!rightOverride && RightFeedback.HoldIfStale(RightExhaustCam.SampleTime, now, Crank.Rpm))
+		{
+			RightSolenoid.Pending = GetSolenoidDuty(&RightFeedback, &RightSolenoidMap);
+			RightSolenoidSampleTime = RightFeedback.SampleTime;
+		}
+
+#ifdef UseIntakeCams
+		// The intake cam angle is degrees of retard, but the intake phasers
+		// advance the cam as duty increases, so the feedback loops work in
+		// degrees of advance to keep the same sign convention as the exhaust.
+		if (LeftIntakeCam.Updated)
+		{
+			LeftIntakeCam.Updated = 0;
+
+			if (IsOverridden(LeftIntakeCharacterizer.IsActive() || LeftIntakeAutotuner.IsActive(), &leftIntakeOverride, &LeftIntakeFeedback))
+			{
+				if (LeftIntakeCharacterizer.IsActive())
+				{
+					LeftIntakeSolenoid.Pending = GetCompensatedDuty(LeftIntakeCharacterizer.Update(LeftIntakeCam.SampleTime, -LeftIntakeCam.Angle));
+				}
+				if (LeftIntakeAutotuner.IsActive())
+				{
+					LeftIntakeSolenoid.Pending = GetAutotuneDuty(&LeftIntakeAutotuner, &LeftIntakeFeedback, &LeftIntakeSolenoidMap, LeftIntakeCam.SampleTime, -LeftIntakeCam.Angle, IntakeTargets.Left);
+				}
+			}
+			else
+			{
+				SetOutputLimits(&LeftIntakeFeedback, &LeftIntakeSolenoidMap);
+				LeftIntakeFeedback.Update(LeftIntakeCam.SampleTime, micros(), Crank.Rpm, -LeftIntakeCam.Angle, IntakeTargets.Left);
+				LeftIntakeSolenoid.Pending = GetSolenoidDuty(&LeftIntakeFeedback, &LeftIntakeSolenoidMap);
+			}
+			LeftIntakeSolenoidSampleTime = LeftIntakeFeedback.SampleTime;
+		}
+		else if (!leftIntakeOverride && LeftIntakeFeedback.HoldIfStale(LeftIntakeCam.SampleTime, now, Crank.Rpm))
+		{
+			LeftIntakeSolenoid.Pending = GetSolenoidDuty(&LeftIntakeFeedback, &LeftIntakeSolenoidMap);
+			LeftIntakeSolenoidSampleTime = LeftIntakeFeedback.SampleTime;
+		}
+
+		if (RightIntakeCam.Updated)
+		{
+			RightIntakeCam.Updated = 0;
+
+			if (IsOverridden(RightIntakeCharacterizer.IsActive() || RightIntakeAutotuner.IsActive(), &rightIntakeOverride, &RightIntakeFeedback))
+			{
+				if (RightIntakeCharacterizer.IsActive())
+				{
+					RightIntakeSolenoid.Pending = GetCompensatedDuty(RightIntakeCharacterizer.Update(RightIntakeCam.SampleTime, -RightIntakeCam.Angle));
+				}
+				if (RightIntakeAutotuner.IsActive())
+				{
+					RightIntakeSolenoid.Pending = GetAutotuneDuty(&RightIntakeAutotuner, &RightIntakeFeedback, &RightIntakeSolenoidMap, RightIntakeCam.SampleTime, -RightIntakeCam.Angle, IntakeTargets.Right);
+				}
+			}
+			else
+			{
+				SetOutputLimits(&RightIntakeFeedback, &RightIntakeSolenoidMap);
+				RightIntakeFeedback.Update(RightIntakeCam.SampleTime, micros(), Crank.Rpm, -RightIntakeCam.Angle, IntakeTargets.Right);
+				RightIntakeSolenoid.Pending = GetSolenoidDuty(&RightIntakeFeedback, &RightIntakeSolenoidMap);
+			}
+			RightIntakeSolenoidSampleTime = RightIntakeFeedback.SampleTime;
+		}
+		else if (!rightIntakeOverride && RightIntakeFeedback.HoldIfStale(RightIntakeCam.SampleTime, now, Crank.Rpm))
+		{
+			RightIntakeSolenoid.Pending = GetSolenoidDuty(&RightIntakeFeedback, &RightIntakeSolenoidMap);
+			RightIntakeSolenoidSampleTime = RightIntakeFeedback.SampleTime;
+		}
+#endif
+
+		ApplySolenoidDuty();
+	}
+	else if (controlEnabled || limpHolding)
+	{
+		DisengageControl();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Dither the solenoids at the end of each PWM period. The left exhaust
+// solenoid's channel (PWML2) provides the period interrupt; the channels all
+// share a period, so the others are in step with it.
+///////////////////////////////////////////////////////////////////////////////
+void StartDither()
+{
+	LeftSolenoid.DitherAmplitude = DITHER_AMPLITUDE;
+	LeftSolenoid.DitherHalfPeriod = DITHER_HALF_PERIOD;
+	RightSolenoid.DitherAmplitude = DITHER_AMPLITUDE;
+	RightSolenoid.DitherHalfPeriod = DITHER_HALF_PERIOD;
+#ifdef UseIntakeCams
+	LeftIntakeSolenoid.DitherAmplitude = DITHER_AMPLITUDE;
+	LeftIntakeSolenoid.DitherHalfPeriod = DITHER_HALF_PERIOD;
+	RightIntakeSolenoid.DitherAmplitude = DITHER_AMPLITUDE;
+	RightIntakeSolenoid.DitherHalfPeriod = DITHER_HALF_PERIOD;
+#endif
+
+	PWM->PWM_IER1 = PWM_IER1_CHID2;
+	NVIC_EnableIRQ(PWM_IRQn);
+}
+
+extern "C" void PWM_Handler()
+{
+	// Reading the status register clears the interrupt.
+	if ((PWM->PWM_ISR1 & PWM_ISR1_CHID2) == 0)
+	{
+		return;
+	}
+
+	LeftSolenoid.Dither();
+	RightSolenoid.Dither();
+#ifdef UseIntakeCams
+	LeftIntakeSolenoid.Dither();
+	RightIntakeSolenoid.Dither();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PendSV hook from the Arduino core. See InterruptPriorities.h.
+///////////////////////////////////////////////////////////////////////////////
+extern "C" void pendSVHook()
+{
+	UpdateControl();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SysTick hook from the Arduino core, once per millisecond. Returning zero
+// lets the core carry on with its own tick handling.
+///////////////////////////////////////////////////////////////////////////////
+extern "C" int sysTickHook()
+{
+	if (controlReady)
+	{
+		SuperviseSignals();
+	}
+
+	return 0;
+}
+
+#ifdef UseFixedRateControl
+///////////////////////////////////////////////////////////////////////////////
+// Invoked by the fixed-rate control timer. Each tick runs the control
+// computation, which writes the new duty cycles when it is done.
+///////////////////////////////////////////////////////////////////////////////
+void ControlTick()
+{
+	FixedRateTimer.RecordTick(micros());
+	RequestControlUpdate();
+}
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // The setup function runs once when you press reset or power the board.
 ///////////////////////////////////////////////////////////////////////////////
@@ -133,6 +738,10 @@ void setup() {
 	pinMode(2, INPUT_PULLUP); // crank
 	pinMode(3, INPUT_PULLUP); // left cam
 	pinMode(11, INPUT_PULLUP); // right cam
+#ifdef UseIntakeCams
+	pinMode(12, INPUT_PULLUP); // left intake cam
+	pinMode(A7, INPUT_PULLUP); // right intake cam
+#endif
 	pinMode(13, OUTPUT); // onboard LED
 
 	// This is the power supply for the TCRT5000 crank sensor
@@ -143,24 +752,36 @@ void setup() {
 	// Testing
 	pinMode(22, OUTPUT);
 	
-	// pinMode(A8, INPUT); // MAP sensor
+	pinMode(A8, INPUT); // MAP sensor
+	pinMode(A10, INPUT); // Supply voltage
 	// pinMode(A9, INPUT); // Knob?
 
 	navigator.Initialize(&mode);
 	plx.Initialize(&Serial3, &Serial2);	
 	interruptHandlers.Initialize();
+	angleScheduler->AddEvent(MAP_SAMPLE_ANGLE, SampleManifoldPressure);
 	mode.Initialize();
 	jobs->Initialize();
 	intervalRecorder->Initialize();
 	terminal->Initialize();
 
-	LeftCamError = -10;
-	RightCamError = 10;
+	LeftIntakeFeedback.Reset(Feedback::IntakeGains);
+	RightIntakeFeedback.Reset(Feedback::IntakeGains);
 
-	LeftSolenoid.start(PWM_PERIOD, 0);
-	RightSolenoid.start(PWM_PERIOD, 0);
+	LeftSolenoid.Start(PWM_PERIOD);
+	RightSolenoid.Start(PWM_PERIOD);
+#ifdef UseIntakeCams
+	LeftIntakeSolenoid.Start(PWM_PERIOD);
+	RightIntakeSolenoid.Start(PWM_PERIOD);
+#endif
+	StartDither();
 
 	Serial.begin(115200);
+	controlReady = 1;
+
+#ifdef UseFixedRateControl
+	FixedRateTimer.Start(CONTROL_RATE_HZ, ControlTick);
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -170,6 +791,20 @@ void loop()
 {
 	iterationCounter++;
 
+	// Everything below reads the decoder and feedback state through these
+	// snapshots, so each pass sees values that belong together.
+	LeftExhaustCam.Refresh();
+	RightExhaustCam.Refresh();
+	Crank.Refresh();
+	LeftFeedback.Refresh();
+	RightFeedback.Refresh();
+#ifdef UseIntakeCams
+	LeftIntakeCam.Refresh();
+	RightIntakeCam.Refresh();
+	LeftIntakeFeedback.Refresh();
+	RightIntakeFeedback.Refresh();
+#endif
+
 	int key = keys.getKey();
 	if (navigator.Update(key))
 	{
@@ -184,56 +819,41 @@ void loop()
 
 	jobs->Update();
 	mode.Update();
-	plx.Update();
-	terminal->Update();
-	
-	CamTargetAngle = table->GetValue(Crank.Rpm);
 
-	// RPM jumps around a lot at idle, so rather than chasing noisy 
-	// data I am just letting the cams rest. At least for now.
-	// Might be fun to try creating overlap at idle, just to see if 
-	// it starts to sound like an old-school muscle car...
-	if ((mode.GetMode() == Mode::Running) && (Crank.Rpm > MINIMUM_EXAVCS_RPM) && !onlyMeasureBaseline)
+	// The cross-checks only make sense once the decoders are calibrated,
+	// and with the crank signal present. Only a confirmed fault sends the
+	// controller back to calibration.
+	if ((mode.GetMode() != Mode::Calibrating) && (mode.GetMode() != Mode::Limp))
 	{
-		float baseDuty = 44.0f;
-		float ratio;
-		float duty;
-
-		if (LeftExhaustCam.Updated)
+		unsigned faults = Plausibility.Update(Crank.View, LeftExhaustCam.View, RightExhaustCam.View);
+		if (faults != 0)
 		{
-			LeftExhaustCam.Updated = 0;
-
-			LeftFeedback.Update(micros(), Crank.Rpm, LeftExhaustCam.Angle, CamTargetAngle);
-			float ratio = (baseDuty + LeftFeedback.Output) / 100.0f;
-			float duty = PWM_PERIOD * ratio;
-			LeftSolenoid.set_duty((uint32_t)duty);
-		}
-
-		if (RightExhaustCam.Updated)
-		{
-			RightExhaustCam.Updated = 0;
-
-			RightFeedback.Update(micros(), Crank.Rpm, RightExhaustCam.Angle, CamTargetAngle);
-			ratio = (baseDuty + RightFeedback.Output) / 100.0f;
-			duty = PWM_PERIOD * ratio;
-			RightSolenoid.set_duty((uint32_t)duty);
+			mode.Fail(PlausibilityMonitor::GetFaultName(faults));
 		}
 	}
-	else
-	{
-		LeftFeedback.Reset(0);
-		RightFeedback.Reset(1);
 
-		LeftSolenoid.set_duty(0);
-		RightSolenoid.set_duty(0);
-	}
+	plx.Update();
+	terminal->Update();
+	
+#ifndef UseFixedRateControl
+	// Mode changes are handled by the control computation as well.
+	RequestControlUpdate();
+#endif
 
 	LeftExhaustCam.PinState = (unsigned)digitalRead(3);
 	RightExhaustCam.PinState = (unsigned)digitalRead(11);
 	Crank.PinState = (unsigned)digitalRead(2);
 	Crank.AnalogValue = (unsigned)analogRead(A1);
+	Supply.Sample((unsigned)analogRead(A10));
+
+	if (manifoldPressureRequested)
+	{
+		manifoldPressureRequested = 0;
+		MapSensorState = (unsigned)analogRead(A8);
+	}
 
-	LeftExhaustCam.Process();
-	RightExhaustCam.Process();
-	Crank.Process();
+#ifdef UseIntakeCams
+	LeftIntakeCam.PinState = (unsigned)digitalRead(12);
+	RightIntakeCam.PinState = (unsigned)digitalRead(A7);
+#endif
 }
@@ -1,3 +1,7 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
 #include "stdafx.h"
 #include "Globals.h"
 #include "RollingAverage.h"
@@ -5,42 +9,325 @@
 #include "CrankState.h"
 #include "ExhaustCamState.h"
 #include "IntervalRecorder.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+static const float ConfiguredMarkAngles[] = CRANK_MARK_ANGLES;
+static const float ConfiguredMarkWidths[] = CRANK_MARK_WIDTHS;
 
 CrankState Crank;
 
+///////////////////////////////////////////////////////////////////////////////
+// Initialize an instance of CrankState, using the marks in Configuration.h
+///////////////////////////////////////////////////////////////////////////////
+CrankState::CrankState()
+{
+	CalibrationCountdown = 0;
+	Rpm = 0;
+	AverageInterval = 0;
+	PulseDuration = 0;
+	PinState = 0;
+	PulseState = 0;
+	Timeout = 0;
+	AnalogValue = 0;
+	MarkErrors = 0;
+	PulseCount = 0;
+
+	Configure(CRANK_MARK_COUNT, ConfiguredMarkAngles, ConfiguredMarkWidths);
+	Publish();
+	Refresh();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Set the number, positions and widths of the timing marks.
+///////////////////////////////////////////////////////////////////////////////
+void CrankState::Configure(unsigned markCount, const float *markAngles, const float *markWidths)
+{
+	if (markCount > MaxMarks)
+	{
+		markCount = MaxMarks;
+	}
+
+	if (markCount == 0)
+	{
+		markCount = 1;
+	}
+
+	MarkCount = markCount;
+	for (unsigned mark = 0; mark < MarkCount; mark++)
+	{
+		MarkAngles[mark] = markAngles[mark];
+		MarkWidths[mark] = markWidths[mark];
+	}
+
+	// The first pulse will advance this to mark zero.
+	CurrentMark = MarkCount - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Degrees of pulley rotation between the previous mark and the current one.
+///////////////////////////////////////////////////////////////////////////////
+float CrankState::GetDegreesSincePreviousMark()
+{
+	unsigned previousMark = (CurrentMark == 0) ? MarkCount - 1 : CurrentMark - 1;
+	float degrees = MarkAngles[CurrentMark] - MarkAngles[previousMark];
+	if (degrees <= 0)
+	{
+		degrees += 360.0f;
+	}
+
+	return degrees;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find the mark whose width is closest to the given pulse duration.
+///////////////////////////////////////////////////////////////////////////////
+unsigned CrankState::IdentifyMark(unsigned pulseDuration)
+{
+	float width = ((float)pulseDuration * 360.0f) / (float)AverageInterval;
+	unsigned bestMark = 0;
+	float bestDifference = 360.0f;
+
+	for (unsigned mark = 0; mark < MarkCount; mark++)
+	{
+		float difference = width - MarkWidths[mark];
+		if (difference < 0)
+		{
+			difference = -difference;
+		}
+
+		if (difference < bestDifference)
+		{
+			bestDifference = difference;
+			bestMark = mark;
+		}
+	}
+
+	return bestMark;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Process the start of a pulse from the crank sensor.
+//
+// Elapsed time is the time since the start of the previous mark's pulse.
+///////////////////////////////////////////////////////////////////////////////
 void CrankState::BeginPulse(unsigned elapsed)
 {
-	IIntervalRecorder::GetInstance()->LogInterval(Intervals::CrankHigh);
+	// Assume the marks arrive in order, EndPulse will correct this if not.
+	CurrentMark = (CurrentMark + 1) % MarkCount;
+	PulseCount++;
+
+	if (CurrentMark == 0)
+	{
+		IIntervalRecorder::GetInstance()->LogInterval(Intervals::CrankHigh);
+	}
 
 	Crank.PulseState = 1;
 
+	// Scale the time between marks up to the time for a whole revolution.
+	unsigned revolution = (unsigned)(((float)elapsed * 360.0f) / GetDegreesSincePreviousMark());
+
 	if (CalibrationCountdown > 0)
 	{
 		CalibrationCountdown--;
 
 		// Seed the average
-		if (CalibrationCountdown > (Mode::CalibrationCountdown * 0.8f))
+		if (CalibrationCountdown > (MarkCount * Mode::CalibrationCountdown * 0.8f))
 		{
-			AverageInterval = elapsed;
+			AverageInterval = revolution;
 		}
 	}
 
-	UpdateRollingAverage(&AverageInterval, elapsed, 1);
+	UpdateRollingAverage(&AverageInterval, revolution, 1);
 
 	unsigned rpm = (TicksPerMinute / AverageInterval) * 2; // x2 because the sensor is on a cam pulley, not the crank itself.
 	UpdateRollingAverage(&Rpm, rpm, 1);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Process the end of a pulse from the crank sensor.
+//
+// With more than one mark, this is where the width of the pulse is used to
+// confirm which mark it was.
+///////////////////////////////////////////////////////////////////////////////
 void CrankState::EndPulse(unsigned interval)
 {
 	IIntervalRecorder::GetInstance()->LogInterval(Intervals::CrankLow);
 
 	Crank.PulseState = 0;
 
-	if (CalibrationCountdown > (Mode::CalibrationCountdown * 0.8f))
+	UpdateRollingAverage(&PulseDuration, interval, 1);
+
+	if ((MarkCount < 2) || (AverageInterval == 0))
 	{
-		PulseDuration = interval;
+		return;
 	}
 
-	UpdateRollingAverage(&PulseDuration, interval, 1);
-}
\ No newline at end of file
+	unsigned mark = IdentifyMark(interval);
+	if (mark != CurrentMark)
+	{
+		MarkErrors++;
+		CurrentMark = mark;
+
+		// The cam angles computed since this pulse began were measured from
+		// the wrong mark, which would spoil the baselines, so start over.
+		// Once running, the marks are back in sync from the next pulse,
+		// and the plausibility monitor decides whether the errors are
+		// frequent enough to matter. This runs in the crank edge handler,
+		// so the failure is left for Mode::Update.
+		if (!testMode && (mode.GetMode() == Mode::Calibrating))
+		{
+			mode.SignalLost("Crank Mark Sync");
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy the fields in CrankSnapshot for the main loop.
+///////////////////////////////////////////////////////////////////////////////
+void CrankState::Publish()
+{
+	published.BeginWrite();
+	CrankSnapshot *data = published.GetData();
+	data->CalibrationCountdown = CalibrationCountdown;
+	data->Rpm = Rpm;
+	data->AverageInterval = AverageInterval;
+	data->PulseDuration = PulseDuration;
+	data->PulseState = PulseState;
+	data->CurrentMark = CurrentMark;
+	data->MarkErrors = MarkErrors;
+	published.EndWrite();
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulate one revolution of a pulley with two marks, 180 degrees apart,
+// 20 and 10 degrees wide.
+///////////////////////////////////////////////////////////////////////////////
+void SimulateTwoMarkRevolution(CrankState *test, unsigned ticksPerRevolution)
+{
+	unsigned half = ticksPerRevolution / 2;
+	test->BeginPulse(half);
+	test->EndPulse((ticksPerRevolution * 20) / 360);
+	test->BeginPulse(half);
+	test->EndPulse((ticksPerRevolution * 10) / 360);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Verify that a single mark behaves the way the original code did.
+///////////////////////////////////////////////////////////////////////////////
+bool TestCrankOneMark()
+{
+	float angles[] = { 0.0f };
+	float widths[] = { 20.0f };
+
+	CrankState test;
+	test.Configure(1, angles, widths);
+
+	// 3000 cam RPM = 6000 crank RPM
+	unsigned ticksPerRevolution = TicksPerMinute / 3000;
+	for (int i = 0; i < 10; i++)
+	{
+		test.BeginPulse(ticksPerRevolution);
+		test.EndPulse(ticksPerRevolution / 18);
+	}
+
+	if (!CompareUnsigned(test.CurrentMark, 0, "Mark"))
+	{
+		return false;
+	}
+
+	return WithinOnePercent((float)test.Rpm, 6000.0f, "Rpm");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Verify that two marks each produce a revolution-length interval.
+///////////////////////////////////////////////////////////////////////////////
+bool TestCrankTwoMarks()
+{
+	float angles[] = { 0.0f, 180.0f };
+	float widths[] = { 20.0f, 10.0f };
+
+	CrankState test;
+	test.Configure(2, angles, widths);
+
+	unsigned ticksPerRevolution = TicksPerMinute / 1250;
+	for (int i = 0; i < 10; i++)
+	{
+		SimulateTwoMarkRevolution(&test, ticksPerRevolution);
+	}
+
+	if (!CompareUnsigned(test.MarkErrors, 0, "Errors"))
+	{
+		return false;
+	}
+
+	if (!CompareUnsigned(test.CurrentMark, 1, "Mark"))
+	{
+		return false;
+	}
+
+	if (!WithinOnePercent(test.AverageInterval, ticksPerRevolution, "Interval"))
+	{
+		return false;
+	}
+
+	return WithinOnePercent((float)test.Rpm, 2500.0f, "Rpm");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start in the middle of a revolution and verify that the marks are 
+// identified by their widths.
+///////////////////////////////////////////////////////////////////////////////
+bool TestCrankMarkSync()
+{
+	float angles[] = { 0.0f, 180.0f };
+	float widths[] = { 20.0f, 10.0f };
+
+	CrankState test;
+	test.Configure(2, angles, widths);
+
+	unsigned ticksPerRevolution = TicksPerMinute / 1250;
+	unsigned half = ticksPerRevolution / 2;
+
+	// The sync errors here must not restart the shared calibration.
+	int previousTestMode = testMode;
+	testMode = 1;
+
+	// First pulse seen is the narrow one, but it will be taken for mark zero.
+	test.BeginPulse(half);
+	test.AverageInterval = ticksPerRevolution;
+	test.EndPulse((ticksPerRevolution * 10) / 360);
+	unsigned syncMark = test.CurrentMark;
+
+	for (int i = 0; i < 10; i++)
+	{
+		SimulateTwoMarkRevolution(&test, ticksPerRevolution);
+	}
+
+	testMode = previousTestMode;
+
+	if (!CompareUnsigned(syncMark, 1, "Sync"))
+	{
+		return false;
+	}
+
+	return CompareUnsigned(test.MarkErrors, 1, "Errors");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Self-test the crank timing code.
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestCrankState()
+{
+	InvokeTest(CrankOneMark);
+	InvokeTest(CrankTwoMarks);
+	InvokeTest(CrankMarkSync);
+}
@@ -1,10 +1,35 @@
 #pragma once
 
+#include "Snapshot.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The CrankState fields that code outside the interrupt handlers reads,
+// copied together so that they all come from the same edge.
+///////////////////////////////////////////////////////////////////////////////
+struct CrankSnapshot
+{
+	unsigned CalibrationCountdown;
+	unsigned Rpm;
+	unsigned AverageInterval;
+	unsigned PulseDuration;
+	unsigned PulseState;
+	unsigned CurrentMark;
+	unsigned MarkErrors;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Holds the state for the "crank" signal, which comes from one or more 
+// timing marks on a cam pulley. See Configuration.h for mark settings.
+///////////////////////////////////////////////////////////////////////////////
 class CrankState
 {
 public:
+	static const unsigned MaxMarks = 4;
+
 	unsigned CalibrationCountdown;
 	unsigned Rpm;
+
+	// Ticks per revolution of the pulley, estimated from the time between marks.
 	unsigned AverageInterval;
 	unsigned PulseDuration;
 	unsigned PinState;
@@ -12,27 +37,53 @@ public:
 	unsigned Timeout;
 	unsigned AnalogValue;
 
-	CrankState()
-	{
-		CalibrationCountdown = 0;
-		Rpm = 0;
-		PulseDuration = 0;
-		PinState = 0;
-		PulseState = 0;
-		Timeout = 0;
-	}
+	// Mark configuration, in cam degrees.
+	unsigned MarkCount;
+	float MarkAngles[MaxMarks];
+	float MarkWidths[MaxMarks];
+
+	// Index of the mark whose pulse began most recently.
+	unsigned CurrentMark;
+
+	// Number of times a pulse width did not match the expected mark.
+	unsigned MarkErrors;
+
+	// Number of pulses since power-up, so that the signal can be seen to
+	// have returned after a timeout.
+	unsigned PulseCount;
+
+	// Copy of the fields above for the main loop, LCD, terminal and PLX
+	// code, taken by Refresh at the start of each pass through loop().
+	CrankSnapshot View;
+
+	CrankState();
 
+	void Configure(unsigned markCount, const float *markAngles, const float *markWidths);
 	void BeginPulse(unsigned interval);
 	void EndPulse(unsigned interval);
 
-	void Process()
+	// Angle of the most recent mark, relative to mark zero.
+	float GetMarkAngle() { return MarkAngles[CurrentMark]; }
+
+	// Called by the edge interrupt handler after each pulse.
+	void Publish();
+
+	// Called by the main loop to update View.
+	void Refresh()
 	{
-		// Clean up if wraparound happened due to a race condition
-		if (CalibrationCountdown > 10000)
-		{
-			CalibrationCountdown = 0;
-		}
+		published.Read(&View);
 	}
+
+private:
+	Snapshot<CrankSnapshot> published;
+
+	float GetDegreesSincePreviousMark();
+	unsigned IdentifyMark(unsigned pulseDuration);
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Self-test the crank timing code
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestCrankState();
+
 extern CrankState Crank;
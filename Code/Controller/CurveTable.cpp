@@ -19,6 +19,85 @@ CurveTable * CurveTable::CreateExhaustCamTable()
 		output);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Intake cam targets are degrees of advance. These are the intake values that
+// were running alongside the exhaust table above.
+///////////////////////////////////////////////////////////////////////////////
+CurveTable * CurveTable::CreateIntakeCamTable()
+{
+	static float input[] = { MINIMUM_EXAVCS_RPM,  2000.0f, 3200.0f, 5600.0f,  8000.0f };
+	static float output[] = { 0.0f,                 30.0f,   30.0f,   15.0f,    10.0f };
+
+	return new CurveTable(
+		5,
+		input,
+		output);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Solenoid PWM frequency in hertz. Keep these between 161 and 320, see
+// GetSolenoidPeriod in SolenoidOutput.cpp.
+///////////////////////////////////////////////////////////////////////////////
+CurveTable * CurveTable::CreatePwmFrequencyTable()
+{
+	static float input[] = { MINIMUM_EXAVCS_RPM,  3000.0f, 4500.0f, 6000.0f };
+	static float output[] = { 200.0f,              250.0f,  300.0f,  320.0f };
+
+	return new CurveTable(
+		4,
+		input,
+		output);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-bank trims, in degrees, added to the cam target tables above (see
+// BankTargets.h). They start out at zero, so both banks follow the shared
+// tables until one is tuned on its own.
+///////////////////////////////////////////////////////////////////////////////
+CurveTable * CurveTable::CreateLeftExhaustTrimTable()
+{
+	static float input[] = { MINIMUM_EXAVCS_RPM,  8000.0f };
+	static float output[] = { 0.0f,                  0.0f };
+
+	return new CurveTable(
+		2,
+		input,
+		output);
+}
+
+CurveTable * CurveTable::CreateRightExhaustTrimTable()
+{
+	static float input[] = { MINIMUM_EXAVCS_RPM,  8000.0f };
+	static float output[] = { 0.0f,                  0.0f };
+
+	return new CurveTable(
+		2,
+		input,
+		output);
+}
+
+CurveTable * CurveTable::CreateLeftIntakeTrimTable()
+{
+	static float input[] = { MINIMUM_EXAVCS_RPM,  8000.0f };
+	static float output[] = { 0.0f,                  0.0f };
+
+	return new CurveTable(
+		2,
+		input,
+		output);
+}
+
+CurveTable * CurveTable::CreateRightIntakeTrimTable()
+{
+	static float input[] = { MINIMUM_EXAVCS_RPM,  8000.0f };
+	static float output[] = { 0.0f,                  0.0f };
+
+	return new CurveTable(
+		2,
+		input,
+		output);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Tests for the ExhaustCamTable instance.
 ///////////////////////////////////////////////////////////////////////////////
@@ -59,6 +138,32 @@ bool TestExhaustCamTable()
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Tests for the IntakeCamTable instance.
+///////////////////////////////////////////////////////////////////////////////
+bool TestIntakeCamTable()
+{
+	CurveTable *testTable = CurveTable::CreateIntakeCamTable();
+
+	if (testTable->GetValue(1000.0f) != 0.0f)
+	{
+		TestFailed("Idle");
+		return false;
+	}
+
+	if (!WithinOnePercent(testTable->GetValue(2600.0f), 30.0f, "Cruise"))
+	{
+		return false;
+	}
+
+	if (!WithinOnePercent(testTable->GetValue(4400.0f), 22.5f, "MidHigh"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Tests for the CurveTable class.
 ///////////////////////////////////////////////////////////////////////////////
@@ -70,4 +175,5 @@ bool TestExhaustCamTable()
 void SelfTestCurveTable()
 {
 	InvokeTest(ExhaustCamTable);
+	InvokeTest(IntakeCamTable);
 }
@@ -25,6 +25,12 @@ private:
 
 public:
 	static CurveTable * CreateExhaustCamTable();
+	static CurveTable * CreateIntakeCamTable();
+	static CurveTable * CreatePwmFrequencyTable();
+	static CurveTable * CreateLeftExhaustTrimTable();
+	static CurveTable * CreateRightExhaustTrimTable();
+	static CurveTable * CreateLeftIntakeTrimTable();
+	static CurveTable * CreateRightIntakeTrimTable();
 
 	CurveTable(
 		int elements,
@@ -43,7 +49,7 @@ public:
 			return _pOutputValues[0];
 		}
 
-		for (int element = 1; element <= _elements; element++)
+		for (int element = 1; element < _elements; element++)
 		{
 			if (input < _pInputValues[element])
 			{
@@ -259,7 +259,7 @@ long DueTimer::getPeriod(void) const {
 }
 
 unsigned DueTimer::getElapsed(void) const {
-	TC_ReadCV(Timers[timer].tc, Timers[timer].channel);
+	return TC_ReadCV(Timers[timer].tc, Timers[timer].channel);
 }
 /*
 	Implementation of the timer callbacks defined in 
@@ -22,6 +22,7 @@
 #include "Configuration.h"
 #include "Globals.h"
 #include "RollingAverage.h"
+#include "CrankState.h"
 #include "ExhaustCamState.h"
 #include "SelfTest.h"
 #include "IntervalRecorder.h"
@@ -41,6 +42,27 @@ int RightCamDurationDiagnosticPin = 25;
 ExhaustCamState LeftExhaustCam(1);
 ExhaustCamState RightExhaustCam(0);
 
+///////////////////////////////////////////////////////////////////////////////
+// Engine RPM from the exhaust cam pulse trains, for when the crank signal
+// has been lost.
+///////////////////////////////////////////////////////////////////////////////
+unsigned GetCamRpm()
+{
+	unsigned left = LeftExhaustCam.Rpm;
+	unsigned right = RightExhaustCam.Rpm;
+	if (left == 0)
+	{
+		return right;
+	}
+
+	if (right == 0)
+	{
+		return left;
+	}
+
+	return (left + right) / 2;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Simplified implementation of BeginPulse, for investigation/diagnosis
 ///////////////////////////////////////////////////////////////////////////////
@@ -79,7 +101,9 @@ void ExhaustCamState::StartCycle()
 ///////////////////////////////////////////////////////////////////////////////
 // Cam interval: elapsed time since start of the previous cam pulse.
 // Crank interval: elapsed time since last start of crank pulse.
-void ExhaustCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
+// Crank mark angle: position of that crank mark, relative to mark zero.
+// Edge time: timestamp of the edge that started this pulse.
+void ExhaustCamState::BeginPulse(unsigned camInterval, unsigned crankInterval, float crankMarkAngle, unsigned edgeTime)
 {
 	PulseState = 1;
 
@@ -136,26 +160,27 @@ void ExhaustCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
 		}
 	}
 
-	// Cam interval is only used to determine RPM.
+	// Cam interval is only used to determine RPM. This is updated on every
+	// pulse, so that the RPM keeps tracking the engine without the crank.
 	UpdateRollingAverage(&AverageInterval, camInterval, 1);
 
+	unsigned ticksPerCamRevolution = AverageInterval * 2;
+	unsigned camRpm = TicksPerMinute / ticksPerCamRevolution;
+	unsigned crankRpm = camRpm * 2;
+	UpdateRollingAverage(&Rpm, crankRpm, 1);
+
 	// Set/update TimeSinceCrankSignal
 	if (CycleState == CycleStates::Pulse1)
 	{
 		int pin = this->Left ? LeftCamDurationDiagnosticPin : RightCamDurationDiagnosticPin;
 		digitalWrite(pin, LOW);
 
-		// Update this instance's RPM value based on the time since the last pulse
-		unsigned ticksPerCamRevolution = AverageInterval * 2;
-		unsigned camRpm = TicksPerMinute / ticksPerCamRevolution;
-		unsigned crankRpm = camRpm * 2;
-		UpdateRollingAverage(&Rpm, crankRpm, 1);
-	
 		// Crank interval is used to determine cam position.
 		UpdateRollingAverage(&TimeSinceCrankSignal, crankInterval, 1);
 
 		float ticksPerDegree = (float)ticksPerCamRevolution / 360.0f;
-		float angle = ((float)TimeSinceCrankSignal) / ticksPerDegree;
+		float angle = crankMarkAngle + (((float)TimeSinceCrankSignal) / ticksPerDegree);
+		Pulse1RawAngle = angle;
 		
 		// Update the baseline cam angle while solenoids are disabled.
 		if ((CalibrationCountdown > 0) || onlyMeasureBaseline)
@@ -190,6 +215,27 @@ void ExhaustCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
 
 		angle = angle - Baseline;
 		UpdateRollingAverage(&Angle, angle, 1);
+		SampleTime = edgeTime;
+		Updated = 1;
+	}
+	else if ((CycleState == CycleStates::Pulse2) && (Crank.MarkCount > 1))
+	{
+		// With more than one crank mark, the second pulse is measured from
+		// the nearest mark before it, which gives a second angle sample per
+		// revolution with half the extrapolation.
+		float ticksPerDegree = (float)(AverageInterval * 2) / 360.0f;
+		float angle = crankMarkAngle + (((float)crankInterval) / ticksPerDegree);
+
+		// The second pulse is not exactly 180 degrees after the first, so 
+		// learn the actual spacing while the solenoids are disabled.
+		if ((CalibrationCountdown > 0) || onlyMeasureBaseline)
+		{
+			UpdateRollingAverage(&Pulse2Offset, angle - Pulse1RawAngle, 0.1f);
+		}
+
+		angle = angle - Pulse2Offset - Baseline;
+		UpdateRollingAverage(&Angle, angle, 1);
+		SampleTime = edgeTime;
 		Updated = 1;
 	}
 }
@@ -232,6 +278,25 @@ void ExhaustCamState::EndPulse(unsigned camInterval)
 	UpdateRollingAverage(&PulseDuration, camInterval, 1);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Copy the fields in ExhaustCamSnapshot for the main loop.
+///////////////////////////////////////////////////////////////////////////////
+void ExhaustCamState::Publish()
+{
+	published.BeginWrite();
+	ExhaustCamSnapshot *data = published.GetData();
+	data->AverageInterval = AverageInterval;
+	data->PulseDuration = PulseDuration;
+	data->Rpm = Rpm;
+	data->CalibrationCountdown = CalibrationCountdown;
+	data->TimeSinceCrankSignal = TimeSinceCrankSignal;
+	data->Baseline = Baseline;
+	data->Angle = Angle;
+	data->PulseState = PulseState;
+	data->SampleTime = SampleTime;
+	published.EndWrite();
+}
+
 // ############################################################################
 // ############################################################################
 //
@@ -257,8 +322,8 @@ bool TestExhaustCamPulseSeries(unsigned rpm)
 	
 	for (int i = 0; i < Mode::CalibrationCountdown * 2; i++)
 	{
-		test.BeginPulse(duration + 1, (duration * 3) / 2);
-		test.BeginPulse(duration - 1, duration / 2);
+		test.BeginPulse(duration + 1, (duration * 3) / 2, 0.0f, 0);
+		test.BeginPulse(duration - 1, duration / 2, 0.0f, 0);
 	}
 
 	if (!WithinOnePercent((unsigned)test.AverageInterval, duration, "AvgIntv"))
@@ -302,6 +367,23 @@ bool TestExhaustCam10k()
 	return TestExhaustCamPulseSeries(10 * 1000);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Verify that each angle sample carries the timestamp of its edge.
+///////////////////////////////////////////////////////////////////////////////
+bool TestExhaustCamStamp()
+{
+	ExhaustCamState test(1);
+	test.StartCycle();
+	test.BeginPulse(10000, 5000, 0.0f, 1234);
+
+	if (!CompareUnsigned(test.Updated, 1, "Updated"))
+	{
+		return false;
+	}
+
+	return CompareUnsigned(test.SampleTime, 1234, "SampleTime");
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Self-test the cam timing code.
 ///////////////////////////////////////////////////////////////////////////////
@@ -309,4 +391,5 @@ void SelfTestExhaustCamTiming()
 {
 	InvokeTest(ExhaustCamIdle);
 	InvokeTest(ExhaustCam10k);
+	InvokeTest(ExhaustCamStamp);
 }
\ No newline at end of file
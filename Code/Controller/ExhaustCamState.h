@@ -1,5 +1,24 @@
 #pragma once
 
+#include "Snapshot.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The ExhaustCamState fields that code outside the interrupt handlers reads,
+// copied together so that they all come from the same edge.
+///////////////////////////////////////////////////////////////////////////////
+struct ExhaustCamSnapshot
+{
+	unsigned AverageInterval;
+	unsigned PulseDuration;
+	unsigned Rpm;
+	unsigned CalibrationCountdown;
+	unsigned TimeSinceCrankSignal;
+	float Baseline;
+	float Angle;
+	unsigned PulseState;
+	unsigned SampleTime;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Holds the state for a single exhaust cam and its associated pulse train
 //
@@ -29,16 +48,28 @@ public:
 
 	// Each cam instance maintains an RPM value so it can be sanity-checked against the others.
 	unsigned Rpm;
-	unsigned CalibrationCountdown; // May go slightly negative due to race conditions
+	unsigned CalibrationCountdown;
 	CycleStates CycleState;
 	unsigned TimeSinceCrankSignal;
 	float Baseline; 
 	float Angle;
+
+	// Only used with more than one crank mark. Raw angle of the first pulse,
+	// and the learned spacing between the first and second pulses.
+	float Pulse1RawAngle;
+	float Pulse2Offset;
 	unsigned PinState; // set by the .ino code, should match PulseState
 	unsigned PulseState; // set by the interrupt handler, should match PinState
 	unsigned Timeout;
 	unsigned Updated;
 
+	// Timestamp of the edge that produced the current Angle value.
+	unsigned SampleTime;
+
+	// Copy of the fields above for the main loop, LCD, terminal and PLX
+	// code, taken by Refresh at the start of each pass through loop().
+	ExhaustCamSnapshot View;
+
 	ExhaustCamState(int left)
 	{
 		Left = left;
@@ -49,24 +80,32 @@ public:
 		TimeSinceCrankSignal = 0;
 		Baseline = 0;
 		Angle = 0;
+		Pulse1RawAngle = 0;
+		Pulse2Offset = 180.0f;
 		PinState = 0;
 		PulseState = 0;
 		Timeout = 0;
 		Updated = 0;
+		SampleTime = 0;
+		Publish();
+		Refresh();
 	}
 
 	void StartCycle();
-	void BeginPulse(unsigned camInterval, unsigned crankInterval);
+	void BeginPulse(unsigned camInterval, unsigned crankInterval, float crankMarkAngle, unsigned edgeTime);
 	void EndPulse(unsigned camInterval);
 
-	// Clean up if wraparound happened due to a race condition
-	void Process()
+	// Called by the edge interrupt handlers after each pulse.
+	void Publish();
+
+	// Called by the main loop to update View.
+	void Refresh()
 	{
-		if (CalibrationCountdown > 10000)
-		{
-			CalibrationCountdown = 0;
-		}
+		published.Read(&View);
 	}
+
+private:
+	Snapshot<ExhaustCamSnapshot> published;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -79,3 +118,8 @@ void SelfTestExhaustCamTiming();
 ///////////////////////////////////////////////////////////////////////////////
 extern ExhaustCamState LeftExhaustCam;
 extern ExhaustCamState RightExhaustCam;
+
+///////////////////////////////////////////////////////////////////////////////
+// Engine RPM from the exhaust cams, for when the crank signal has been lost.
+///////////////////////////////////////////////////////////////////////////////
+unsigned GetCamRpm();
@@ -8,6 +8,7 @@
 #include "RollingAverage.h"
 #include "Utilities.h"
 #include "Feedback.h"
+#include "GainSchedule.h"
 #include "SelfTest.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -19,13 +20,20 @@
 ///////////////////////////////////////////////////////////////////////////////
 Feedback LeftFeedback;
 Feedback RightFeedback;
+Feedback LeftIntakeFeedback;
+Feedback RightIntakeFeedback;
+
+// Created on first use, since the Feedback instances above are constructed
+// during static initialization.
+static GainSchedule *exhaustSchedule;
+static GainSchedule *intakeSchedule;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Initialize an instance of Feedback.
 ///////////////////////////////////////////////////////////////////////////////
 Feedback::Feedback()
 {
-	Reset(0);
+	Reset(ExhaustGains);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -34,16 +42,38 @@ Feedback::Feedback()
 void Feedback::Reset(int gainType)
 {
 	lastTime = 0;
+	SampleTime = 0;
 
+	// The schedules start out with P=1.0, I=2.5, D=0.001 everywhere.
 	// This works, but probably could be much improved.
 	// Does not oscillate while driving, tracks well as RPM increases.
 	// Overshoots target significantly when transitioning above RPM threshold (target changes abruptly from 0 degrees to 1 degree).
 	// Try more P, less I
 	// Try more I (7.5 was tried briefly, but not while driving, might work fine.)
 	// Try more D
-	ProportionalGain = 1.0f;
-	IntegralGain = 2.5f; 
-	DerivativeGain = 0.001f;
+	if (exhaustSchedule == NULL)
+	{
+		exhaustSchedule = GainSchedule::CreateExhaustSchedule();
+		intakeSchedule = GainSchedule::CreateIntakeSchedule();
+	}
+
+	schedule = (gainType == IntakeGains) ? intakeSchedule : exhaustSchedule;
+	ScheduleGains(0);
+	GainScale = 1.0f;
+	Feedforward = 0;
+	appliedProportionalGain = 0;
+
+	// The filter time constant is about half the time between exhaust cam
+	// samples at the minimum control RPM. The tracking time is on the order
+	// of the integral time (P/I) of the default gains.
+	SetpointWeight = 1.0f;
+	DerivativeFilterTime = 0.02f;
+	DerivativeOnMeasurement = true;
+	TrackingTime = 0.2f;
+
+	// Wide enough not to matter until the caller sets real limits.
+	OutputMinimum = -100;
+	OutputMaximum = 100;
 
 	// Reset state variables
 	ProportionalTerm = 0;
@@ -51,55 +81,235 @@ void Feedback::Reset(int gainType)
 	DerivativeTerm = 0;
 
 	PreviousError = 0;
+	PreviousActual = 0;
 	Output = 0;
+	RepeatedSamples = 0;
+	StaleSamples = 0;
 
 	for (int i = 0; i < Feedback::BucketCount; i++)
 	{
 		Average[i] = 0;
 	}
+
+	Publish();
+	Refresh();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The learned average is the output that held the cam at its target at this
+// RPM, so starting the integral term there lets control resume without the
+// integrator having to wind up from zero.
+///////////////////////////////////////////////////////////////////////////////
+void Feedback::Engage(unsigned rpm)
+{
+	lastTime = 0;
+	SampleTime = 0;
+
+	ProportionalTerm = 0;
+	IntegralTerm = Average[GetBucket(rpm)];
+	DerivativeTerm = 0;
+	PreviousError = 0;
+	PreviousActual = 0;
+	appliedProportionalGain = 0;
+
+	IntegralTerm = Saturate(IntegralTerm);
+	Output = IntegralTerm;
+	Publish();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Samples older than this are not used for control. At the minimum control
+// RPM the exhaust cams produce a sample every 40ms or so.
+///////////////////////////////////////////////////////////////////////////////
+static const long MaxSampleAgeInMilliseconds = 100;
+
+///////////////////////////////////////////////////////////////////////////////
+// Stale-sample policy:
+//
+// If no edge has arrived for a while, the last angle no longer says where 
+// the cam is, so the output falls back to the learned average for this RPM
+// and the integral is left alone until fresh samples arrive.
+//
+// If the sample is the same one used last time, see the other overload.
+///////////////////////////////////////////////////////////////////////////////
+void Feedback::Update(long sampleTime, long currentTime, unsigned rpm, float actual, float target)
+{
+	if (HoldIfStale(sampleTime, currentTime, rpm))
+	{
+		return;
+	}
+
+	Update(sampleTime, rpm, actual, target);
+}
+
+bool Feedback::HoldIfStale(long sampleTime, long currentTime, unsigned rpm)
+{
+	long maxSampleAge = (long)((TicksPerSecond / 1000) * MaxSampleAgeInMilliseconds);
+	if ((currentTime - sampleTime) <= maxSampleAge)
+	{
+		return false;
+	}
+
+	StaleSamples++;
+	Hold(rpm);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The next sample after a hold is treated as the first one, rather than
+// integrating and differentiating across the whole gap.
+///////////////////////////////////////////////////////////////////////////////
+void Feedback::Hold(unsigned rpm)
+{
+	lastTime = 0;
+	SampleTime = 0;
+	DerivativeTerm = 0;
+	Output = Average[GetBucket(rpm)];
+	Publish();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Update the Output value based on actual and target values
 ///////////////////////////////////////////////////////////////////////////////
-void Feedback::Update(long currentTimeInMicroseconds, unsigned rpm, float actual, float target)
+void Feedback::Update(long sampleTime, unsigned rpm, float actual, float target)
+{
+	Calculate(sampleTime, rpm, actual, target);
+	Publish();
+}
+
+void Feedback::Calculate(long sampleTime, unsigned rpm, float actual, float target)
 {
-	// 2^63 microseconds = 292,805 years.
-	// So, wraparound won't be a problem.
-	float time = ((float)(currentTimeInMicroseconds - lastTime)) / ((float)TicksPerSecond);
-	lastTime = currentTimeInMicroseconds;
+	ScheduleGains(rpm);
+
+	// Bumpless gain changes: the change that a new gain alone would make to
+	// the proportional term is taken up by the integral term instead, and
+	// the integral and derivative gains only affect new error.
+	float proportionalGain = ProportionalGain * GainScale;
+	if ((lastTime != 0) && (appliedProportionalGain != 0) && (proportionalGain != appliedProportionalGain))
+	{
+		IntegralTerm += ProportionalTerm * (1 - (proportionalGain / appliedProportionalGain));
+	}
+
+	appliedProportionalGain = proportionalGain;
+
+	// The feedforward is a duty like the other terms, so the oil pressure
+	// changes how far it moves the cam in the same way.
+	float feedforward = Feedforward * GainScale;
 
 	float error = target - actual;
-//	error = -error;
-	float errorChange = error - PreviousError;
-	
-	ProportionalTerm = error * ProportionalGain;
-	IntegralTerm += (error * time) * IntegralGain;
-	DerivativeTerm = DerivativeGain * (errorChange / time);
+	ProportionalTerm = ((SetpointWeight * target) - actual) * proportionalGain;
+
+	// The first sample after a reset has no previous edge to measure from.
+	if (lastTime == 0)
+	{
+		lastTime = sampleTime;
+		SampleTime = sampleTime;
+		PreviousError = error;
+		PreviousActual = actual;
+		Output = Saturate(ProportionalTerm + IntegralTerm + feedforward);
+		return;
+	}
+
+	// Without a new sample there is no elapsed time to integrate over or
+	// differentiate by, so only the proportional term follows the target.
+	if (sampleTime == lastTime)
+	{
+		RepeatedSamples++;
+		Output = Saturate(ProportionalTerm + IntegralTerm + DerivativeTerm + feedforward);
+		return;
+	}
 
-	// Make sure that the integral term never gets excessive.
-	float integralLimit = 10;
-	if (IntegralTerm > integralLimit)
+	// The time step is measured between the edges that produced the samples,
+	// not between calls, so main loop jitter does not show up in the D term.
+	// Unsigned subtraction handles timer wraparound.
+	float time = ((float)((unsigned)sampleTime - (unsigned)lastTime)) / ((float)TicksPerSecond);
+	lastTime = sampleTime;
+	SampleTime = sampleTime;
+
+	// Angle samples are quantised to the crank timer resolution, and the raw
+	// difference divided by a short time step is mostly that noise, so the
+	// derivative goes through a first-order low-pass filter.
+	float change = DerivativeOnMeasurement ? (PreviousActual - actual) : (error - PreviousError);
+	float derivative = DerivativeGain * GainScale * (change / time);
+	DerivativeTerm += (derivative - DerivativeTerm) * (time / (DerivativeFilterTime + time));
+
+	// The scale is applied to each integral step rather than to the sum, so
+	// that a change in scale does not make the output jump.
+	IntegralTerm += (error * time) * IntegralGain * GainScale;
+
+	// Anti-windup by back-calculation: whatever the solenoid cannot deliver
+	// is fed back into the integral term, so it stops growing while the
+	// output is saturated and comes out of saturation without overshoot.
+	float unsaturated = ProportionalTerm + IntegralTerm + DerivativeTerm + feedforward;
+	Output = Saturate(unsaturated);
+	IntegralTerm += (Output - unsaturated) * (time / (TrackingTime + time));
+
+	UpdateRollingAverage(&(Average[GetBucket(rpm)]), Output, 0.1f);
+
+	PreviousError = error;
+	PreviousActual = actual;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Clamp a value to the output limits.
+///////////////////////////////////////////////////////////////////////////////
+float Feedback::Saturate(float output)
+{
+	if (output > OutputMaximum)
 	{
-		IntegralTerm = integralLimit;
+		return OutputMaximum;
 	}
 
-	if (IntegralTerm < -integralLimit)
+	if (output < OutputMinimum)
 	{
-		IntegralTerm = -integralLimit;
+		return OutputMinimum;
 	}
 
-	Output = ProportionalTerm + IntegralTerm + DerivativeTerm;
+	return output;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Look up the gains for the current operating point.
+///////////////////////////////////////////////////////////////////////////////
+void Feedback::ScheduleGains(unsigned rpm)
+{
+	schedule->GetGains(rpm, OilTemperature, &ProportionalGain, &IntegralGain, &DerivativeGain);
+}
+
+void Feedback::StoreGains(unsigned rpm, float proportional, float integral, float derivative)
+{
+	schedule->SetGains(rpm, OilTemperature, proportional, integral, derivative);
+}
 
+///////////////////////////////////////////////////////////////////////////////
+// Index of the learned-average bucket for the given RPM.
+///////////////////////////////////////////////////////////////////////////////
+unsigned Feedback::GetBucket(unsigned rpm)
+{
 	unsigned bucket = rpm / 500;
 	if (bucket >= Feedback::BucketCount)
 	{
 		bucket = Feedback::BucketCount - 1;
 	}
 
-	UpdateRollingAverage(&(Average[bucket]), Output, 0.1f);
+	return bucket;
+}
 
-	PreviousError = error;
+void Feedback::Publish()
+{
+	published.BeginWrite();
+	FeedbackSnapshot *data = published.GetData();
+	data->ProportionalTerm = ProportionalTerm;
+	data->IntegralTerm = IntegralTerm;
+	data->DerivativeTerm = DerivativeTerm;
+	data->ProportionalGain = ProportionalGain;
+	data->IntegralGain = IntegralGain;
+	data->DerivativeGain = DerivativeGain;
+	data->GainScale = GainScale;
+	data->Feedforward = Feedforward;
+	data->Output = Output;
+	data->SampleTime = SampleTime;
+	published.EndWrite();
 }
 
 // ############################################################################
@@ -359,6 +569,204 @@ bool TestAccumulator()
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// A repeated sample must not integrate or differentiate.
+///////////////////////////////////////////////////////////////////////////////
+bool TestFeedbackRepeat()
+{
+	Feedback test;
+	test.Update(1000, 2500, 50, 55);
+	test.Update(2000, 2500, 50, 55);
+	float integral = test.IntegralTerm;
+
+	// Same sample, new target.
+	test.Update(2000, 2500, 50, 60);
+
+	if (!CompareUnsigned(test.RepeatedSamples, 1, "Repeated"))
+	{
+		return false;
+	}
+
+	if (test.IntegralTerm != integral)
+	{
+		TestFailed("Integral moved");
+		return false;
+	}
+
+	return WithinOnePercent(test.ProportionalTerm, 10.0f, "Proportional");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// An old sample falls back to the learned average for the RPM.
+///////////////////////////////////////////////////////////////////////////////
+bool TestFeedbackStale()
+{
+	Feedback test;
+	test.Average[5] = 3.0f;
+
+	long sampleTime = 1000;
+	long currentTime = sampleTime + (TicksPerSecond / 5);
+	test.Update(sampleTime, currentTime, 2500, 50, 55);
+
+	if (!CompareUnsigned(test.StaleSamples, 1, "Stale"))
+	{
+		return false;
+	}
+
+	if (!WithinOnePercent(test.Output, 3.0f, "Output"))
+	{
+		return false;
+	}
+
+	// A fresh sample is used normally.
+	test.Update(currentTime, currentTime + 100, 2500, 50, 55);
+	if (!CompareUnsigned(test.StaleSamples, 1, "Fresh"))
+	{
+		return false;
+	}
+
+	return WithinOnePercent(test.ProportionalTerm, 5.0f, "Proportional");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A sample that arrives after a hold does not integrate across the gap.
+///////////////////////////////////////////////////////////////////////////////
+bool TestFeedbackGap()
+{
+	Feedback test;
+	test.Update(1000, 2500, 50, 55);
+	test.Update(2000, 2500, 50, 55);
+	float integral = test.IntegralTerm;
+
+	long currentTime = 2000 + TicksPerSecond;
+	if (test.HoldIfStale(2000, 1000 + (TicksPerSecond / 50), 2500))
+	{
+		TestFailed("Not Stale");
+		return false;
+	}
+
+	if (!test.HoldIfStale(2000, currentTime, 2500))
+	{
+		TestFailed("Stale");
+		return false;
+	}
+
+	test.Update(currentTime, currentTime + 100, 2500, 50, 55);
+	return WithinOnePercent(test.IntegralTerm, integral, "Integral");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The feedforward term is scaled with the gains.
+///////////////////////////////////////////////////////////////////////////////
+bool TestFeedforwardScale()
+{
+	Feedback test;
+	test.Feedforward = 2.0f;
+	test.GainScale = 1.5f;
+
+	// On target, so the feedforward is the whole output.
+	test.Update(1000, 2500, 55, 55);
+	return WithinOnePercent(test.Output, 3.0f, "Output");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A change in gain does not change the output by itself.
+///////////////////////////////////////////////////////////////////////////////
+bool TestFeedbackBumpless()
+{
+	Feedback test;
+	test.Update(1000, 2500, 50, 55);
+	test.Update(2000, 2500, 50, 55);
+	float before = test.Output;
+
+	test.GainScale = 2.0f;
+	test.Update(2000, 2500, 50, 55);
+
+	return WithinOnePercent(test.Output, before, "Output");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Engaging starts from the learned average and keeps the others.
+///////////////////////////////////////////////////////////////////////////////
+bool TestFeedbackEngage()
+{
+	Feedback test;
+	test.Update(1000, 2500, 50, 55);
+	test.Update(2000, 2500, 50, 55);
+	test.Average[5] = 3.0f;
+	test.Average[6] = 4.0f;
+
+	test.Engage(2500);
+	if (!WithinOnePercent(test.IntegralTerm, 3.0f, "Integral") ||
+		!WithinOnePercent(test.Output, 3.0f, "Output") ||
+		!WithinOnePercent(test.Average[6], 4.0f, "Average"))
+	{
+		return false;
+	}
+
+	// The first sample after engaging only sets the time reference.
+	test.Update(5000, 2500, 55, 55);
+	return WithinOnePercent(test.Output, 3.0f, "First");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A target step does not kick the derivative term, and a step in the angle
+// is filtered.
+///////////////////////////////////////////////////////////////////////////////
+bool TestFeedbackDFilter()
+{
+	Feedback test;
+	test.Update(1000, 2500, 50, 50);
+	test.Update(41000, 2500, 50, 60);
+	if (test.DerivativeTerm != 0)
+	{
+		TestFailed("Kick");
+		return false;
+	}
+
+	// 40ms step, 20ms filter time constant.
+	test.Update(81000, 2500, 55, 60);
+	float unfiltered = test.DerivativeGain * (5.0f / 0.04f);
+	return WithinOnePercent(-test.DerivativeTerm, unfiltered * (0.04f / 0.06f), "Filtered");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The integral term does not wind up while the output is saturated, so the
+// output leaves saturation as soon as the error goes away.
+///////////////////////////////////////////////////////////////////////////////
+bool TestFeedbackWindup()
+{
+	Feedback test;
+	test.OutputMaximum = 5;
+
+	long time = 1000;
+	for (int i = 0; i < 100; i++)
+	{
+		test.Update(time, 2500, 50, 60);
+		time += 40000;
+	}
+
+	if (!WithinOnePercent(test.Output, 5.0f, "Saturated"))
+	{
+		return false;
+	}
+
+	if (test.IntegralTerm > 2)
+	{
+		TestFailed("Wound up");
+		return false;
+	}
+
+	test.Update(time, 2500, 50, 50);
+	if (test.Output > 2)
+	{
+		TestFailed("Stuck");
+		return false;
+	}
+
+	return true;
+}
+
 void SelfTestFeedback()
 {
 	/*
@@ -371,4 +779,12 @@ void SelfTestFeedback()
 	InvokeTest(Baseline); 
 	*/
 //	InvokeTest(Accumulator);
+	InvokeTest(FeedbackRepeat);
+	InvokeTest(FeedbackStale);
+	InvokeTest(FeedbackGap);
+	InvokeTest(FeedbackBumpless);
+	InvokeTest(FeedforwardScale);
+	InvokeTest(FeedbackEngage);
+	InvokeTest(FeedbackDFilter);
+	InvokeTest(FeedbackWindup);
 }
@@ -1,30 +1,146 @@
 #pragma once
 
+#include "Snapshot.h"
+
+class GainSchedule;
+
+///////////////////////////////////////////////////////////////////////////////
+// The Feedback fields that code outside the control interrupt reads, copied
+// together so that they all come from the same update.
+///////////////////////////////////////////////////////////////////////////////
+struct FeedbackSnapshot
+{
+	float ProportionalTerm;
+	float IntegralTerm;
+	float DerivativeTerm;
+	float ProportionalGain;
+	float IntegralGain;
+	float DerivativeGain;
+	float GainScale;
+	float Feedforward;
+	float Output;
+	unsigned SampleTime;
+};
+
 class Feedback
 {
 public:
 	static const int BucketCount = 20;
+
+	// Gain types for Reset, which select the gain schedule.
+	static const int ExhaustGains = 0;
+	static const int IntakeGains = 1;
+
 	float Average[BucketCount];
 	float ProportionalTerm;
 	float IntegralTerm;
 	float DerivativeTerm;
 
+	// Looked up from the gain schedule by RPM and oil temperature on each
+	// update, and public so they can be logged.
 	float ProportionalGain;
 	float IntegralGain;
 	float DerivativeGain;
 
+	// Multiplies all three gains, for operating conditions that change how
+	// fast the cams respond (see OilPressureState.h). Set before Update.
+	float GainScale;
+
+	// Added to the output, for the part of it that is known in advance
+	// (see TargetTrajectory.h), multiplied by GainScale. Set before Update.
+	float Feedforward;
+
+	// Weight of the target in the proportional term. Below 1, a step in the
+	// target moves the output less, and the integral term makes up the rest.
+	float SetpointWeight;
+
+	// Time constant of the low-pass filter on the derivative term, seconds.
+	float DerivativeFilterTime;
+
+	// Differentiate the measured angle rather than the error, so that steps
+	// in the target do not kick the output.
+	bool DerivativeOnMeasurement;
+
+	// Limits of the output that the solenoid can actually deliver. Set these
+	// before each Update (see SolenoidMap::GetFlowLimits).
+	float OutputMinimum;
+	float OutputMaximum;
+
+	// While the output is saturated, the integral term is pulled back by the
+	// excess over this time constant, in seconds.
+	float TrackingTime;
+
 	float PreviousError;
+	float PreviousActual;
 
 	float Output;
 
 	long lastTime;
 
+	// Edge timestamp behind the current Output, or zero if the Output is not
+	// based on a fresh sample. Used to measure control latency.
+	unsigned SampleTime;
+
+	// Updates that had no new sample, and updates whose sample was too old.
+	unsigned RepeatedSamples;
+	unsigned StaleSamples;
+
+	// Copy of the fields above for the main loop, LCD, terminal and PLX
+	// code, taken by Refresh at the start of each pass through loop().
+	FeedbackSnapshot View;
+
 	Feedback();
 	void Reset(int gainType);
-	void Update(long currentTimeInMicroseconds, unsigned rpm, float actual, float target);
+
+	// Prepare to take control of the cam. The learned averages are kept, and
+	// the integral term starts from the one for this RPM.
+	void Engage(unsigned rpm);
+
+	// The sample time is the timestamp of the edge that produced the angle.
+	void Update(long sampleTime, unsigned rpm, float actual, float target);
+
+	// As above, but applies the stale-sample policy first.
+	void Update(long sampleTime, long currentTime, unsigned rpm, float actual, float target);
+
+	// Set the output to the learned average for this RPM, without using the
+	// angle. For when there is no angle to use.
+	void Hold(unsigned rpm);
+
+	// The stale-sample policy on its own, for control passes with no new
+	// sample. Returns true if the sample was too old and the output is held.
+	bool HoldIfStale(long sampleTime, long currentTime, unsigned rpm);
+
+	// Replace the scheduled gains nearest this RPM and the current oil
+	// temperature. The schedule is shared by all loops with the same gain
+	// type.
+	void StoreGains(unsigned rpm, float proportional, float integral, float derivative);
+
+	// Called by the control interrupt after each change to the output.
+	// Reset, Engage and Update do this themselves.
+	void Publish();
+
+	// Called by the main loop to update View.
+	void Refresh()
+	{
+		published.Read(&View);
+	}
+
+private:
+	GainSchedule *schedule;
+	Snapshot<FeedbackSnapshot> published;
+
+	// Proportional gain (times GainScale) behind ProportionalTerm.
+	float appliedProportionalGain;
+
+	void Calculate(long sampleTime, unsigned rpm, float actual, float target);
+	unsigned GetBucket(unsigned rpm);
+	float Saturate(float output);
+	void ScheduleGains(unsigned rpm);
 };
 
 extern Feedback LeftFeedback;
 extern Feedback RightFeedback;
+extern Feedback LeftIntakeFeedback;
+extern Feedback RightIntakeFeedback;
 
 void SelfTestFeedback();
\ No newline at end of file
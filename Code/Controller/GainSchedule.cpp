@@ -0,0 +1,233 @@
+#include "stdafx.h"
+
+#include <stdio.h>
+#include "SelfTest.h"
+#include "GainSchedule.h"
+#include "Configuration.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Temperatures start at the warm-up threshold, since the cams are not
+// controlled below it.
+///////////////////////////////////////////////////////////////////////////////
+static const float ScheduleRpms[GainSchedule::RpmCount] = { MINIMUM_EXAVCS_RPM, 2500.0f, 3500.0f, 4500.0f, 5500.0f, 6500.0f };
+static const float ScheduleTemperatures[GainSchedule::TemperatureCount] = { MINIMUM_TEMPERATURE_C, 90.0f, 110.0f };
+
+///////////////////////////////////////////////////////////////////////////////
+// These start out as the single set of gains that was tuned by driving (see
+// the notes in Feedback.cpp), so the behavior is unchanged until the table
+// is tuned cell by cell.
+///////////////////////////////////////////////////////////////////////////////
+GainSchedule * GainSchedule::CreateExhaustSchedule()
+{
+	static const float proportional[TemperatureCount * RpmCount] =
+	{
+		//  1500    2500    3500    4500    5500    6500
+		1.0f,   1.0f,   1.0f,   1.0f,   1.0f,   1.0f,   // 71C
+		1.0f,   1.0f,   1.0f,   1.0f,   1.0f,   1.0f,   // 90C
+		1.0f,   1.0f,   1.0f,   1.0f,   1.0f,   1.0f,   // 110C
+	};
+
+	static const float integral[TemperatureCount * RpmCount] =
+	{
+		2.5f,   2.5f,   2.5f,   2.5f,   2.5f,   2.5f,
+		2.5f,   2.5f,   2.5f,   2.5f,   2.5f,   2.5f,
+		2.5f,   2.5f,   2.5f,   2.5f,   2.5f,   2.5f,
+	};
+
+	static const float derivative[TemperatureCount * RpmCount] =
+	{
+		0.001f, 0.001f, 0.001f, 0.001f, 0.001f, 0.001f,
+		0.001f, 0.001f, 0.001f, 0.001f, 0.001f, 0.001f,
+		0.001f, 0.001f, 0.001f, 0.001f, 0.001f, 0.001f,
+	};
+
+	return new GainSchedule(ScheduleRpms, ScheduleTemperatures, proportional, integral, derivative);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The intake gains have not been tuned separately yet.
+///////////////////////////////////////////////////////////////////////////////
+GainSchedule * GainSchedule::CreateIntakeSchedule()
+{
+	return CreateExhaustSchedule();
+}
+
+GainSchedule::GainSchedule(
+	const float *rpms,
+	const float *temperatures,
+	const float *proportional,
+	const float *integral,
+	const float *derivative)
+{
+	this->rpms = rpms;
+	this->temperatures = temperatures;
+
+	for (int i = 0; i < CellCount; i++)
+	{
+		this->proportional[i] = proportional[i];
+		this->integral[i] = integral[i];
+		this->derivative[i] = derivative[i];
+	}
+}
+
+void GainSchedule::GetGains(unsigned rpm, unsigned oilTemperature, float *proportional, float *integral, float *derivative)
+{
+	int rpmIndex;
+	float rpmFraction;
+	FindCell(rpms, RpmCount, (float)rpm, &rpmIndex, &rpmFraction);
+
+	int temperatureIndex;
+	float temperatureFraction;
+	FindCell(temperatures, TemperatureCount, (float)oilTemperature, &temperatureIndex, &temperatureFraction);
+
+	*proportional = Lookup(this->proportional, rpmIndex, rpmFraction, temperatureIndex, temperatureFraction);
+	*integral = Lookup(this->integral, rpmIndex, rpmFraction, temperatureIndex, temperatureFraction);
+	*derivative = Lookup(this->derivative, rpmIndex, rpmFraction, temperatureIndex, temperatureFraction);
+}
+
+void GainSchedule::SetGains(unsigned rpm, unsigned oilTemperature, float proportional, float integral, float derivative)
+{
+	int rpmIndex = FindNearest(rpms, RpmCount, (float)rpm);
+	int temperatureIndex = FindNearest(temperatures, TemperatureCount, (float)oilTemperature);
+	int cell = (temperatureIndex * RpmCount) + rpmIndex;
+
+	this->proportional[cell] = proportional;
+	this->integral[cell] = integral;
+	this->derivative[cell] = derivative;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find the breakpoint at or below the value, and how far the value is from
+// there to the next breakpoint (0 to 1). Values beyond the ends are clamped.
+///////////////////////////////////////////////////////////////////////////////
+void GainSchedule::FindCell(const float *breakpoints, int count, float value, int *index, float *fraction)
+{
+	if (value <= breakpoints[0])
+	{
+		*index = 0;
+		*fraction = 0;
+		return;
+	}
+
+	for (int i = 1; i < count; i++)
+	{
+		if (value < breakpoints[i])
+		{
+			*index = i - 1;
+			*fraction = (value - breakpoints[i - 1]) / (breakpoints[i] - breakpoints[i - 1]);
+			return;
+		}
+	}
+
+	*index = count - 2;
+	*fraction = 1;
+}
+
+int GainSchedule::FindNearest(const float *breakpoints, int count, float value)
+{
+	int index;
+	float fraction;
+	FindCell(breakpoints, count, value, &index, &fraction);
+	return (fraction < 0.5f) ? index : index + 1;
+}
+
+float GainSchedule::Lookup(const float *table, int rpmIndex, float rpmFraction, int temperatureIndex, float temperatureFraction)
+{
+	const float *row0 = &table[temperatureIndex * RpmCount];
+	const float *row1 = &table[(temperatureIndex + 1) * RpmCount];
+
+	float value0 = row0[rpmIndex] + ((row0[rpmIndex + 1] - row0[rpmIndex]) * rpmFraction);
+	float value1 = row1[rpmIndex] + ((row1[rpmIndex + 1] - row1[rpmIndex]) * rpmFraction);
+
+	return value0 + ((value1 - value0) * temperatureFraction);
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Interpolation in both directions, and clamping beyond the table.
+///////////////////////////////////////////////////////////////////////////////
+bool TestGainLookup()
+{
+	static const float rpms[GainSchedule::RpmCount] = { 1000.0f, 2000.0f, 3000.0f, 4000.0f, 5000.0f, 6000.0f };
+	static const float temperatures[GainSchedule::TemperatureCount] = { 80.0f, 100.0f, 120.0f };
+	static const float table[GainSchedule::TemperatureCount * GainSchedule::RpmCount] =
+	{
+		1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f,
+		2.0f, 4.0f, 6.0f, 8.0f, 10.0f, 12.0f,
+		3.0f, 6.0f, 9.0f, 12.0f, 15.0f, 18.0f,
+	};
+
+	GainSchedule test(rpms, temperatures, table, table, table);
+	float p, i, d;
+
+	test.GetGains(2500, 80, &p, &i, &d);
+	if (!WithinOnePercent(p, 2.5f, "Rpm"))
+	{
+		return false;
+	}
+
+	test.GetGains(2500, 90, &p, &i, &d);
+	if (!WithinOnePercent(i, 3.75f, "Both"))
+	{
+		return false;
+	}
+
+	test.GetGains(500, 50, &p, &i, &d);
+	if (!WithinOnePercent(d, 1.0f, "Low"))
+	{
+		return false;
+	}
+
+	test.GetGains(9000, 150, &p, &i, &d);
+	return WithinOnePercent(p, 18.0f, "High");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stored gains replace the nearest cell only.
+///////////////////////////////////////////////////////////////////////////////
+bool TestGainStore()
+{
+	GainSchedule *test = GainSchedule::CreateExhaustSchedule();
+	test->SetGains(2400, 95, 2.0f, 5.0f, 0.01f);
+
+	float p, i, d;
+	test->GetGains(2500, 90, &p, &i, &d);
+	if (!WithinOnePercent(p, 2.0f, "P") ||
+		!WithinOnePercent(i, 5.0f, "I") ||
+		!WithinOnePercent(d, 0.01f, "D"))
+	{
+		return false;
+	}
+
+	// Half way to the next RPM breakpoint.
+	test->GetGains(3000, 90, &p, &i, &d);
+	if (!WithinOnePercent(p, 1.5f, "Between"))
+	{
+		return false;
+	}
+
+	// Other schedules are unaffected.
+	GainSchedule *other = GainSchedule::CreateExhaustSchedule();
+	other->GetGains(2500, 90, &p, &i, &d);
+	bool result = WithinOnePercent(p, 1.0f, "Other");
+
+	delete test;
+	delete other;
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestGainSchedule()
+{
+	InvokeTest(GainLookup);
+	InvokeTest(GainStore);
+}
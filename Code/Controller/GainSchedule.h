@@ -0,0 +1,53 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Feedback gains by RPM and oil temperature.
+//
+// Each gain comes from a 2-D table, with bilinear interpolation between the
+// breakpoints and the edge values beyond them. Because the interpolation is
+// continuous, the gains change smoothly as the operating point moves, and
+// Feedback takes care of keeping its output steady when they do.
+//
+// The schedule keeps its own copy of the tables, so that cells can be
+// replaced at run time with gains from the autotuner (see RelayAutotuner.h).
+///////////////////////////////////////////////////////////////////////////////
+class GainSchedule
+{
+public:
+	static const int RpmCount = 6;
+	static const int TemperatureCount = 3;
+
+	// The tables are indexed [temperature][rpm].
+	GainSchedule(
+		const float *rpms,
+		const float *temperatures,
+		const float *proportional,
+		const float *integral,
+		const float *derivative);
+
+	static GainSchedule * CreateExhaustSchedule();
+	static GainSchedule * CreateIntakeSchedule();
+
+	void GetGains(unsigned rpm, unsigned oilTemperature, float *proportional, float *integral, float *derivative);
+
+	// Replace the gains in the cell nearest to the given operating point.
+	void SetGains(unsigned rpm, unsigned oilTemperature, float proportional, float integral, float derivative);
+
+private:
+	static const int CellCount = TemperatureCount * RpmCount;
+
+	const float *rpms;
+	const float *temperatures;
+	float proportional[CellCount];
+	float integral[CellCount];
+	float derivative[CellCount];
+
+	static void FindCell(const float *breakpoints, int count, float value, int *index, float *fraction);
+	static int FindNearest(const float *breakpoints, int count, float value);
+	float Lookup(const float *table, int rpmIndex, float rpmFraction, int temperatureIndex, float temperatureFraction);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestGainSchedule();
@@ -44,6 +44,14 @@ EXTERN unsigned DebugRight;
 EXTERN unsigned DebugLong1;
 EXTERN unsigned DebugLong2;
 
+// Longest time spent in any of the cam or crank interrupt handlers, in
+// microseconds. Together with IterationsPerSecond, this shows whether the
+// ISRs and the main loop still fit in their time budgets.
+EXTERN unsigned IsrMaxDuration;
+
+// Angle-scheduled events that fired more than a crank degree late.
+EXTERN unsigned LateAngleEvents;
+
 // To measure update rate
 EXTERN unsigned IterationsPerSecond;
 
@@ -62,6 +70,13 @@ EXTERN float CamTargetAngle;
 EXTERN float LeftCamError;
 EXTERN float RightCamError;
 
+// Intake target is degrees of advance, exhaust target is degrees of retard.
+EXTERN float IntakeCamTargetAngle;
+
+// PWM duty cycle writes, and updates skipped because the duty was unchanged.
+EXTERN unsigned SolenoidWrites;
+EXTERN unsigned SolenoidWritesSkipped;
+
 // Actuator Duty Cycle
 EXTERN unsigned LeftSolenoidDutyCycle;
 EXTERN unsigned RightSolenoidDutyCycle;
@@ -10,7 +10,7 @@
 #include "stdafx.h"
 #include "Mode.h"
 #include "Globals.h"
-//#include "Timing.h"
+#include "RollingAverage.h"
 #include "IntakeCamState.h"
 #include "SelfTest.h"
 
@@ -21,6 +21,14 @@
 IntakeCamState LeftIntakeCam(1);
 IntakeCamState RightIntakeCam(0);
 
+///////////////////////////////////////////////////////////////////////////////
+// The average interval is what distinguishes long pulses from short ones, so
+// unlike the exhaust cam code it must actually be smoothed. The pattern is
+// short, short, long (1:1:2) so the average settles around 4/3 of a short
+// interval, comfortably between the two.
+///////////////////////////////////////////////////////////////////////////////
+const float AverageIntervalWeight = 0.25f;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Simplified implementation of BeginPulse, for investigation/diagnosis
 ///////////////////////////////////////////////////////////////////////////////
@@ -47,8 +55,11 @@ void IntakeCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
 
 ///////////////////////////////////////////////////////////////////////////////
 // Process the start of a single pulse from the cam position sensor.
+//
+// The crank mark angle is in cam degrees, relative to crank mark zero. The
+// edge time is the timestamp of the edge that started this pulse.
 ///////////////////////////////////////////////////////////////////////////////
-void IntakeCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
+void IntakeCamState::BeginPulse(unsigned camInterval, unsigned crankInterval, float crankMarkAngle, unsigned edgeTime)
 {
 	PulseState = 1;
 
@@ -76,7 +87,7 @@ void IntakeCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
 		{
 			// Smooth the average pulse length to a reasonable value.
 			CountdownState = CountdownStates::Countdown1;
-			UpdateRollingAverage(&AverageInterval, camInterval);
+			UpdateRollingAverage(&AverageInterval, camInterval, AverageIntervalWeight);
 			return;
 		}
 		else if (CalibrationCountdown > ((2 * Mode::CalibrationCountdown) / 5)) // > 36
@@ -101,7 +112,7 @@ void IntakeCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
 		CountdownState = CountdownStates::Run;
 	}
 
-	UpdateRollingAverage(&AverageInterval, camInterval);
+	UpdateRollingAverage(&AverageInterval, camInterval, AverageIntervalWeight);
 	
 	if (camInterval > AverageInterval)
 	{
@@ -114,15 +125,18 @@ void IntakeCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
 		}
 		else
 		{
-			UpdateRollingAverage(&LongInterval, camInterval);
-			UpdateRollingAverage(&TimeSinceCrankSignal, crankInterval);
+			UpdateRollingAverage(&LongInterval, camInterval, 1);
+			UpdateRollingAverage(&TimeSinceCrankSignal, crankInterval, 1);
 		}
 
 		unsigned camRpm = TicksPerMinute / LongInterval;
 		unsigned crankRpm = camRpm / 2;
 
 		unsigned ticksPerRevolution = LongInterval * 2;
-		unsigned retard = (crankInterval * 360) / ticksPerRevolution;
+		float retard = ((float)crankInterval * 360.0f) / (float)ticksPerRevolution;
+
+		// Retard is in crank degrees, the mark angle is in cam degrees.
+		retard += crankMarkAngle * 2;
 
 		if (CountdownState == CountdownStates::Initialize1)
 		{
@@ -131,17 +145,19 @@ void IntakeCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
 		}
 		else
 		{
-			UpdateRollingAverage(&Rpm, crankRpm);
+			UpdateRollingAverage(&Rpm, crankRpm, 1);
 		}
 
 		if (CountdownState == CountdownStates::Initialize2)
 		{
 			// Baseline is not modified after initialization.
-			UpdateRollingAverage(&Baseline, retard);
+			UpdateRollingAverage(&Baseline, retard, 0.1f);
 		}
 
 		retard = retard - Baseline;
-		UpdateRollingAverage(&Angle, retard);
+		UpdateRollingAverage(&Angle, retard, 1.0f);
+		SampleTime = edgeTime;
+		Updated = 1;
 
 		// Validate long/short pulse calibration
 		if (CountdownState == CountdownStates::Run)
@@ -168,7 +184,7 @@ void IntakeCamState::BeginPulse(unsigned camInterval, unsigned crankInterval)
 		}
 		else
 		{
-			UpdateRollingAverage(&ShortInterval, camInterval);
+			UpdateRollingAverage(&ShortInterval, camInterval, 1);
 		}
 
 		// Validate long/short pulse calibration
@@ -200,10 +216,29 @@ void IntakeCamState::EndPulse(unsigned camInterval)
 	}
 	else
 	{
-		UpdateRollingAverage(&PulseDuration, camInterval);
+		UpdateRollingAverage(&PulseDuration, camInterval, 1);
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Copy the fields in IntakeCamSnapshot for the main loop.
+///////////////////////////////////////////////////////////////////////////////
+void IntakeCamState::Publish()
+{
+	published.BeginWrite();
+	IntakeCamSnapshot *data = published.GetData();
+	data->AverageInterval = AverageInterval;
+	data->PulseDuration = PulseDuration;
+	data->Rpm = Rpm;
+	data->CalibrationCountdown = CalibrationCountdown;
+	data->TimeSinceCrankSignal = TimeSinceCrankSignal;
+	data->Baseline = Baseline;
+	data->Angle = Angle;
+	data->PulseState = PulseState;
+	data->SampleTime = SampleTime;
+	published.EndWrite();
+}
+
 // ############################################################################
 // ############################################################################
 //
@@ -230,9 +265,9 @@ bool TestIntakeCamPulseSeries(unsigned rpm)
 	
 	for (int i = 0; i < Mode::CalibrationCountdown * 2; i++)
 	{
-		test.BeginPulse(shortDuration, (shortDuration / 2) + shortDuration);
-		test.BeginPulse(shortDuration, (shortDuration / 2) + shortDuration + shortDuration);
-		test.BeginPulse(shortDuration * 2, shortDuration / 2);
+		test.BeginPulse(shortDuration, (shortDuration / 2) + shortDuration, 0.0f, 0);
+		test.BeginPulse(shortDuration, (shortDuration / 2) + shortDuration + shortDuration, 0.0f, 0);
+		test.BeginPulse(shortDuration * 2, shortDuration / 2, 0.0f, 0);
 	}
 
 	if (!WithinOnePercent(test.ShortInterval, shortDuration, "ShortIntv"))
@@ -245,7 +280,7 @@ bool TestIntakeCamPulseSeries(unsigned rpm)
 		return false;
 	}
 
-	if (!WithinOnePercent(test.Rpm, revsPerMinute, "Rpm"))
+	if (!WithinOnePercent((float)test.Rpm, revsPerMinute, "Rpm"))
 	{
 		return false;
 	}
@@ -255,7 +290,7 @@ bool TestIntakeCamPulseSeries(unsigned rpm)
 		return false;
 	}
 	
-	if (!WithinOnePercent(test.Baseline, 45, "Baseline"))
+	if (!WithinOnePercent(test.Baseline, 45.0f, "Baseline"))
 	{
 		return false;
 	}
@@ -284,7 +319,7 @@ bool TestIntakeCam10k()
 ///////////////////////////////////////////////////////////////////////////////
 // Self-test the cam timing code.
 ///////////////////////////////////////////////////////////////////////////////
-void SelfTestIntakeCamState()
+void SelfTestIntakeCamTiming()
 {
 	InvokeTest(IntakeCamIdle);
 	InvokeTest(IntakeCam10k);
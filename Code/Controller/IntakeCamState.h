@@ -1,11 +1,30 @@
 #pragma once
 
+#include "Snapshot.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The IntakeCamState fields that code outside the interrupt handlers reads,
+// copied together so that they all come from the same edge.
+///////////////////////////////////////////////////////////////////////////////
+struct IntakeCamSnapshot
+{
+	unsigned AverageInterval;
+	unsigned PulseDuration;
+	unsigned Rpm;
+	unsigned CalibrationCountdown;
+	unsigned TimeSinceCrankSignal;
+	float Baseline;
+	float Angle;
+	unsigned PulseState;
+	unsigned SampleTime;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Holds the state for a single intake cam and its associated pulse train
-// 
-// TODO: migrate IntakeCamTiming to interface pattern
+//
+// TODO: migrate IntakeCamState to interface pattern
 ///////////////////////////////////////////////////////////////////////////////
-class IntakeCamTiming
+class IntakeCamState
 {
 private:
 	enum CountdownStates
@@ -18,9 +37,8 @@ private:
 		Run,
 	};
 
-	void RollingAverage(unsigned *average, unsigned newValue);
-
 public:
+	// Nonzero for left cam, zero for right cam.
 	unsigned Left;
 	unsigned AverageInterval;
 	unsigned ShortInterval;
@@ -28,16 +46,27 @@ public:
 	unsigned PulseDuration;
 	unsigned IntervalState; // 0 = long interval, 1 = first short interval, 2 = second short interval
 	unsigned Rpm;
-	unsigned SyncCountdown; // May go slightly negative due to race conditions
-    CountdownStates CountdownState;
+	unsigned CalibrationCountdown;
+	CountdownStates CountdownState;
 	unsigned TimeSinceCrankSignal;
-	unsigned Baseline; 
-	unsigned Angle;
+	float Baseline;
+
+	// Degrees of retard relative to the baseline. Intake phasers advance the
+	// cam, so this will be zero or negative when the solenoid is active.
+	float Angle;
 	unsigned PinState; // set by the .ino code, should match PulseState
 	unsigned PulseState; // set by the interrupt handler, should match PinState
 	unsigned Timeout;
+	unsigned Updated;
+
+	// Timestamp of the edge that produced the current Angle value.
+	unsigned SampleTime;
 
-	IntakeCamTiming(int left)
+	// Copy of the fields above for the main loop, LCD, terminal and PLX
+	// code, taken by Refresh at the start of each pass through loop().
+	IntakeCamSnapshot View;
+
+	IntakeCamState(int left)
 	{
 		CountdownState = CountdownStates::Reset;
 		IntervalState = 0;
@@ -46,29 +75,34 @@ public:
 		ShortInterval = 0;
 		LongInterval = 0;
 		PulseDuration = 0;
-		IntervalState = 0;
 		Rpm = 0;
-		SyncCountdown = 0;
+		CalibrationCountdown = 0;
 		TimeSinceCrankSignal = 0;
 		Baseline = 0;
 		Angle = 0;
 		PinState = 0;
 		PulseState = 0;
-		Baseline = 0;
 		Timeout = 0;
+		Updated = 0;
+		SampleTime = 0;
+		Publish();
+		Refresh();
 	}
 
-	void BeginPulse(unsigned camInterval, unsigned crankInterval);
+	void BeginPulse(unsigned camInterval, unsigned crankInterval, float crankMarkAngle, unsigned edgeTime);
 	void EndPulse(unsigned camInterval);
 
-	// Clean up if wraparound happened due to a race condition
-	void Process()
+	// Called by the edge interrupt handlers after each pulse.
+	void Publish();
+
+	// Called by the main loop to update View.
+	void Refresh()
 	{
-		if (SyncCountdown > 10000)
-		{
-			SyncCountdown = 0;
-		}
+		published.Read(&View);
 	}
+
+private:
+	Snapshot<IntakeCamSnapshot> published;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -77,7 +111,7 @@ public:
 void SelfTestIntakeCamTiming();
 
 ///////////////////////////////////////////////////////////////////////////////
-// Global instances of CamTiming
+// Global instances of IntakeCamState
 ///////////////////////////////////////////////////////////////////////////////
-extern IntakeCamTiming LeftIntakeCam;
-extern IntakeCamTiming RightIntakeCam;
+extern IntakeCamState LeftIntakeCam;
+extern IntakeCamState RightIntakeCam;
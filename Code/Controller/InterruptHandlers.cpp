@@ -14,7 +14,12 @@
 #include "Globals.h"
 #include "Mode.h"
 #include "ExhaustCamState.h"
+#include "IntakeCamState.h"
 #include "CrankState.h"
+#include "PatternDetector.h"
+#include "AngleScheduler.h"
+#include "InterruptPriorities.h"
+#include "Configuration.h"
 
 //#define UseCaptureTimers
 
@@ -27,6 +32,12 @@ int RightCamPin = 11;
 // pin D2, fifth pin on 1602 top-right header
 int CrankPin = 2;
 
+// pin D12 (TIOB8), driver side intake
+int LeftIntakeCamPin = 12;
+
+// pin A7 (D61, TIOA1), passenger side intake
+int RightIntakeCamPin = 61;
+
 // This pin will be high while the de-noising pin-read code is active.
 // This can be used with a scope to determine if the pin read process
 // is covering a large enough span of time to filter out noise.
@@ -39,12 +50,16 @@ int DiagnosticOutputPin = 23;
 CaptureTimer LeftCamTimer = Timer0;
 CaptureTimer RightCamTimer = Timer1;
 CaptureTimer CrankTimer = Timer2;
+CaptureTimer LeftIntakeCamTimer = Timer3;
+CaptureTimer RightIntakeCamTimer = Timer4;
 
 const unsigned TicksPerSecond = 42 * 1000 * 1000;
 #else
 TrivialTimer LeftCamTimer;
 TrivialTimer RightCamTimer;
 TrivialTimer CrankTimer;
+TrivialTimer LeftIntakeCamTimer;
+TrivialTimer RightIntakeCamTimer;
 
 const unsigned TicksPerSecond = 1000 * 1000;
 #endif
@@ -62,9 +77,101 @@ enum PinState
 PinState LeftCamPinState = PinState::None;
 PinState RightCamPinState = PinState::None;
 PinState CrankPinState = PinState::None;
+PinState LeftIntakeCamPinState = PinState::None;
+PinState RightIntakeCamPinState = PinState::None;
 
 int PinOfInterest = RightCamPin;
 
+///////////////////////////////////////////////////////////////////////////////
+// Measures the time spent in an interrupt handler, from construction to
+// destruction, and keeps track of the longest one seen so far.
+///////////////////////////////////////////////////////////////////////////////
+class IsrTimer
+{
+private:
+	unsigned start;
+
+public:
+	IsrTimer()
+	{
+		start = micros();
+	}
+
+	~IsrTimer()
+	{
+		unsigned duration = micros() - start;
+		if (duration > IsrMaxDuration)
+		{
+			IsrMaxDuration = duration;
+		}
+	}
+};
+
+IPatternDetector *patternDetector = IPatternDetector::GetInstance();
+IAngleScheduler *angleScheduler = IAngleScheduler::GetInstance();
+
+///////////////////////////////////////////////////////////////////////////////
+// Send the start of a cam pulse to the decoder for the input's trigger
+// pattern. Left inputs feed the left bank's decoders, right inputs the right.
+///////////////////////////////////////////////////////////////////////////////
+void BeginCamPulse(int input, unsigned camInterval, unsigned crankInterval, unsigned edgeTime)
+{
+	patternDetector->BeginPulse(input, camInterval);
+
+	int left = (input == LeftCamInput) || (input == LeftIntakeCamInput);
+	switch (patternDetector->GetPattern(input))
+	{
+	case TwoPulse:
+	{
+		ExhaustCamState &cam = left ? LeftExhaustCam : RightExhaustCam;
+		cam.BeginPulse(camInterval, crankInterval, Crank.GetMarkAngle(), edgeTime);
+		cam.Publish();
+		angleScheduler->SetSpeed(cam.AverageInterval * 2);
+		break;
+	}
+
+	case ThreeMinusOne:
+	{
+		IntakeCamState &cam = left ? LeftIntakeCam : RightIntakeCam;
+		cam.BeginPulse(camInterval, crankInterval, Crank.GetMarkAngle(), edgeTime);
+		cam.Publish();
+		angleScheduler->SetSpeed(cam.AverageInterval * 3);
+		break;
+	}
+	}
+
+#ifndef UseFixedRateControl
+	// The control computation runs as soon as the edge handlers are done.
+	RequestControlUpdate();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Send the end of a cam pulse to the decoder for the input's trigger pattern.
+///////////////////////////////////////////////////////////////////////////////
+void EndCamPulse(int input, unsigned camInterval)
+{
+	int left = (input == LeftCamInput) || (input == LeftIntakeCamInput);
+	switch (patternDetector->GetPattern(input))
+	{
+	case TwoPulse:
+	{
+		ExhaustCamState &cam = left ? LeftExhaustCam : RightExhaustCam;
+		cam.EndPulse(camInterval);
+		cam.Publish();
+		break;
+	}
+
+	case ThreeMinusOne:
+	{
+		IntakeCamState &cam = left ? LeftIntakeCam : RightIntakeCam;
+		cam.EndPulse(camInterval);
+		cam.Publish();
+		break;
+	}
+	}
+}
+
 PinState GetPinState(int pin)
 {
 	if (pin == PinOfInterest)
@@ -128,30 +235,85 @@ void StartCrankTimer()
 	CrankTimer.start();
 }
 
+void StartLeftIntakeCamTimer()
+{
+	LeftIntakeCamTimer.start();
+}
+
+void StartRightIntakeCamTimer()
+{
+	RightIntakeCamTimer.start();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A lost signal has no speed. The edge handlers publish the same snapshot,
+// and they can preempt the SysTick hook, so interrupts are off while it is
+// republished. This happens at most once per lost signal.
+///////////////////////////////////////////////////////////////////////////////
+template <class TState> void ClearRpm(TState *state)
+{
+	noInterrupts();
+	state->Rpm = 0;
+	state->Publish();
+	interrupts();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// These run in an interrupt handler, so they only count the timeout, clear
+// the RPM and report the lost signal to the mode, which acts on it from the
+// main loop. Each one also runs the control computation straight away, so
+// that the solenoids are disabled (or held, in limp mode) without waiting
+// for an edge that may never come, or for the main loop.
+///////////////////////////////////////////////////////////////////////////////
 void LeftCamTimeout(unsigned status)
 {
 	LeftExhaustCam.Timeout++;
 	StartLeftCamTimer();
-	mode.Fail("Left Cam Timeout");
-
+	ClearRpm(&LeftExhaustCam);
+	mode.SignalLost("Left Cam Timeout");
+	RequestControlUpdate();
 }
 
 void RightCamTimeout(unsigned status)
 {
 	RightExhaustCam.Timeout++;
 	StartRightCamTimer();
-	mode.Fail("Rght Cam Timeout");
+	ClearRpm(&RightExhaustCam);
+	mode.SignalLost("Rght Cam Timeout");
+	RequestControlUpdate();
 }
 
 void CrankTimeout(unsigned status)
 {
 	Crank.Timeout++;
 	StartCrankTimer();
-	mode.Fail("Crank Timeout");
+	ClearRpm(&Crank);
+	mode.CrankLost();
+	RequestControlUpdate();
+}
+
+void LeftIntakeCamTimeout(unsigned status)
+{
+	LeftIntakeCam.Timeout++;
+	StartLeftIntakeCamTimer();
+	ClearRpm(&LeftIntakeCam);
+	mode.SignalLost("L Intake Timeout");
+	RequestControlUpdate();
+}
+
+void RightIntakeCamTimeout(unsigned status)
+{
+	RightIntakeCam.Timeout++;
+	StartRightIntakeCamTimer();
+	ClearRpm(&RightIntakeCam);
+	mode.SignalLost("R Intake Timeout");
+	RequestControlUpdate();
 }
 
 void LeftCamSignalChange()
 {
+	IsrTimer isrTimer;
+	unsigned edgeTime = micros();
 	unsigned camInterval = LeftCamTimer.getElapsed();
 	unsigned crankInterval = CrankTimer.getElapsed();
 
@@ -169,18 +331,20 @@ void LeftCamSignalChange()
 	if (LeftCamPinState == PinState::Low)
 	{
 		DebugLeft = camInterval;
-		LeftExhaustCam.BeginPulse(camInterval, crankInterval);
+		BeginCamPulse(LeftCamInput, camInterval, crankInterval, edgeTime);
 		StartLeftCamTimer();
 	}
 	else if (LeftCamPinState == PinState::High)
 	{
-		LeftExhaustCam.EndPulse(camInterval);
+		EndCamPulse(LeftCamInput, camInterval);
 	}
 
 }
 
 void RightCamSignalChange()
 {
+	IsrTimer isrTimer;
+	unsigned edgeTime = micros();
 	unsigned camInterval = RightCamTimer.getElapsed();
 	unsigned crankInterval = CrankTimer.getElapsed();
 
@@ -197,17 +361,19 @@ void RightCamSignalChange()
 	if (RightCamPinState == PinState::Low)
 	{
 		DebugRight = camInterval;
-		RightExhaustCam.BeginPulse(camInterval, crankInterval);
+		BeginCamPulse(RightCamInput, camInterval, crankInterval, edgeTime);
 		StartRightCamTimer();
 	}
 	else if (RightCamPinState == PinState::High)
 	{
-		RightExhaustCam.EndPulse(camInterval);
+		EndCamPulse(RightCamInput, camInterval);
 	}
 }
 
 void CrankSignalChange()
 {
+	IsrTimer isrTimer;
+	unsigned edgeTime = micros();
 	unsigned interval = CrankTimer.getElapsed();
 	
 	PinState pinState = GetPinState(CrankPin);
@@ -223,14 +389,82 @@ void CrankSignalChange()
 	if (CrankPinState == PinState::Low)
 	{
 		DebugCrank = interval;
+		patternDetector->BeginPulse(CrankInput, interval);
 		Crank.BeginPulse(interval);
+		Crank.Publish();
 		StartCrankTimer();
-		LeftExhaustCam.StartCycle();
-		RightExhaustCam.StartCycle();
+
+		// Each mark is a new reference for the angle-scheduled events.
+		angleScheduler->SetReference(edgeTime, Crank.GetMarkAngle(), Crank.AverageInterval);
+
+		// The exhaust cam pulse sequence is counted from mark zero.
+		if (Crank.CurrentMark == 0)
+		{
+			LeftExhaustCam.StartCycle();
+			RightExhaustCam.StartCycle();
+		}
 	}
 	else if (CrankPinState == PinState::High)
 	{
+		patternDetector->EndPulse(CrankInput, interval);
 		Crank.EndPulse(interval);
+		Crank.Publish();
+	}
+}
+
+void LeftIntakeCamSignalChange()
+{
+	IsrTimer isrTimer;
+	unsigned edgeTime = micros();
+	unsigned camInterval = LeftIntakeCamTimer.getElapsed();
+	unsigned crankInterval = CrankTimer.getElapsed();
+
+	PinState pinState = GetPinState(LeftIntakeCamPin);
+
+	// Ignore noise
+	if ((pinState == LeftIntakeCamPinState) || (pinState == PinState::None))
+	{
+		return;
+	}
+
+	LeftIntakeCamPinState = pinState;
+
+	if (LeftIntakeCamPinState == PinState::Low)
+	{
+		BeginCamPulse(LeftIntakeCamInput, camInterval, crankInterval, edgeTime);
+		StartLeftIntakeCamTimer();
+	}
+	else if (LeftIntakeCamPinState == PinState::High)
+	{
+		EndCamPulse(LeftIntakeCamInput, camInterval);
+	}
+}
+
+void RightIntakeCamSignalChange()
+{
+	IsrTimer isrTimer;
+	unsigned edgeTime = micros();
+	unsigned camInterval = RightIntakeCamTimer.getElapsed();
+	unsigned crankInterval = CrankTimer.getElapsed();
+
+	PinState pinState = GetPinState(RightIntakeCamPin);
+
+	// Ignore noise
+	if ((pinState == RightIntakeCamPinState) || (pinState == PinState::None))
+	{
+		return;
+	}
+
+	RightIntakeCamPinState = pinState;
+
+	if (RightIntakeCamPinState == PinState::Low)
+	{
+		BeginCamPulse(RightIntakeCamInput, camInterval, crankInterval, edgeTime);
+		StartRightIntakeCamTimer();
+	}
+	else if (RightIntakeCamPinState == PinState::High)
+	{
+		EndCamPulse(RightIntakeCamInput, camInterval);
 	}
 }
 
@@ -239,6 +473,10 @@ void InterruptHandlers::Initialize()
 	pinMode(DiagnosticOutputPin, OUTPUT);
 	pinMode(DiagnosticTimingPin, OUTPUT);
 
+	// Start recording trigger patterns from scratch, after the self-tests.
+	patternDetector->Initialize();
+	angleScheduler->Initialize();
+
 #ifdef UseCaptureTimers
 	LeftCamTimer.configure(timeout);
 	RightCamTimer.configure(timeout);
@@ -247,14 +485,109 @@ void InterruptHandlers::Initialize()
 	LeftCamTimer.attachInterrupt(LeftCamTimeout);
 	RightCamTimer.attachInterrupt(RightCamTimeout);
 	CrankTimer.attachInterrupt(CrankTimeout);
+
+#ifdef UseIntakeCams
+	LeftIntakeCamTimer.configure(timeout);
+	RightIntakeCamTimer.configure(timeout);
+
+	LeftIntakeCamTimer.attachInterrupt(LeftIntakeCamTimeout);
+	RightIntakeCamTimer.attachInterrupt(RightIntakeCamTimeout);
+#endif
 #else
 	attachInterrupt(digitalPinToInterrupt(LeftCamPin), LeftCamSignalChange, CHANGE);
 	attachInterrupt(digitalPinToInterrupt(RightCamPin), RightCamSignalChange, CHANGE);
 	attachInterrupt(digitalPinToInterrupt(CrankPin), CrankSignalChange, CHANGE);
+#ifdef UseIntakeCams
+	attachInterrupt(digitalPinToInterrupt(LeftIntakeCamPin), LeftIntakeCamSignalChange, CHANGE);
+	attachInterrupt(digitalPinToInterrupt(RightIntakeCamPin), RightIntakeCamSignalChange, CHANGE);
+#endif
+
+	// These are polled by SuperviseSignals.
+	LeftCamTimer.attachInterrupt(LeftCamTimeout);
+	RightCamTimer.attachInterrupt(RightCamTimeout);
+	CrankTimer.attachInterrupt(CrankTimeout);
+#ifdef UseIntakeCams
+	LeftIntakeCamTimer.attachInterrupt(LeftIntakeCamTimeout);
+	RightIntakeCamTimer.attachInterrupt(RightIntakeCamTimeout);
+#endif
 #endif
 	StartLeftCamTimer();
 	StartRightCamTimer();
 	StartCrankTimer();
+	StartLeftIntakeCamTimer();
+	StartRightIntakeCamTimer();
+
+	ConfigureInterruptPriorities();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// See InterruptPriorities.h for the reasoning behind these values.
+///////////////////////////////////////////////////////////////////////////////
+void ConfigureInterruptPriorities()
+{
+	NVIC_SetPriority(PIOA_IRQn, EdgeCapturePriority);
+	NVIC_SetPriority(PIOB_IRQn, EdgeCapturePriority);
+	NVIC_SetPriority(PIOC_IRQn, EdgeCapturePriority);
+	NVIC_SetPriority(PIOD_IRQn, EdgeCapturePriority);
+	NVIC_SetPriority(TC0_IRQn, EdgeCapturePriority);
+	NVIC_SetPriority(TC1_IRQn, EdgeCapturePriority);
+	NVIC_SetPriority(TC7_IRQn, EdgeCapturePriority);
+	NVIC_SetPriority(TC8_IRQn, EdgeCapturePriority);
+
+	NVIC_SetPriority(TC5_IRQn, AngleSchedulerPriority);
+	NVIC_SetPriority(TC6_IRQn, AngleSchedulerPriority);
+
+	NVIC_SetPriority(PWM_IRQn, PwmPriority);
+
+	NVIC_SetPriority(UART_IRQn, SerialPriority);
+	NVIC_SetPriority(USART0_IRQn, SerialPriority);
+	NVIC_SetPriority(USART1_IRQn, SerialPriority);
+	NVIC_SetPriority(USART2_IRQn, SerialPriority);
+	NVIC_SetPriority(USART3_IRQn, SerialPriority);
+
+	NVIC_SetPriority(PendSV_IRQn, ControlPriority);
+}
+
+void RequestControlUpdate()
+{
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+#ifndef UseCaptureTimers
+///////////////////////////////////////////////////////////////////////////////
+// A signal is lost after SIGNAL_LOSS_PERIODS of its expected pulse interval,
+// or after SIGNAL_LOSS_MAX_TIME if that is sooner or the interval is not
+// known yet. A signal with no RPM is already lost (or was never found), so
+// it is not checked again until its pulses return.
+///////////////////////////////////////////////////////////////////////////////
+void SuperviseSignal(TrivialTimer *timer, unsigned rpm, unsigned interval)
+{
+	if (rpm == 0)
+	{
+		return;
+	}
+
+	unsigned maximum = (TicksPerSecond / 1000) * SIGNAL_LOSS_MAX_TIME;
+	timer->configure(TrivialTimer::getTimeout(interval, SIGNAL_LOSS_PERIODS, maximum));
+	timer->poll();
+}
+#endif
+
+void SuperviseSignals()
+{
+#ifndef UseCaptureTimers
+	SuperviseSignal(&LeftCamTimer, LeftExhaustCam.Rpm, LeftExhaustCam.AverageInterval);
+	SuperviseSignal(&RightCamTimer, RightExhaustCam.Rpm, RightExhaustCam.AverageInterval);
+
+	// The crank average is for a whole revolution of the pulley.
+	SuperviseSignal(&CrankTimer, Crank.Rpm, Crank.AverageInterval / Crank.MarkCount);
+
+#ifdef UseIntakeCams
+	// The long gap in the three-minus-one pattern is the longest wait.
+	SuperviseSignal(&LeftIntakeCamTimer, LeftIntakeCam.Rpm, LeftIntakeCam.LongInterval);
+	SuperviseSignal(&RightIntakeCamTimer, RightIntakeCam.Rpm, RightIntakeCam.LongInterval);
+#endif
+#endif
 }
 
 
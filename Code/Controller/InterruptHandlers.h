@@ -11,5 +11,12 @@ public:
 	void Initialize ();
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Declare cam and crank signals lost when their pulses stop. To be called
+// once per millisecond. Does nothing with capture timers, which have
+// timeout interrupts of their own.
+///////////////////////////////////////////////////////////////////////////////
+void SuperviseSignals();
+
 
 
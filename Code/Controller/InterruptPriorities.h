@@ -0,0 +1,43 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Interrupt priority plan. All NVIC priorities are set from these values,
+// by ConfigureInterruptPriorities in InterruptHandlers.cpp.
+//
+// The SAM3X has four priority bits. Lower numbers preempt higher numbers,
+// so 0 is the most urgent and 15 the least.
+//
+//  0  Reserved.
+//  1  Edge capture: pin change (PIOA-PIOD) and the TC capture channels.
+//     These record edge times, so they must never wait for anything else.
+//  2  Angle scheduler (TC5) and the fixed-rate control tick (TC6).
+//     Deadlines are projected from edge times, so these run after the edge
+//     handlers but ahead of everything else.
+//  3  PWM period interrupt, which steps the solenoid dither. A late step
+//     only stretches the dither waveform, but it should not wait for the
+//     serial ports.
+//  4  Serial: UART (terminal) and USART0-3 (PLX). These have receive
+//     buffers, so a few tens of microseconds of delay does no harm.
+// 15  PendSV: control computation, raised by the cam edge handlers or by
+//     the fixed-rate control tick. It only preempts the main loop, so LCD
+//     and terminal work cannot delay it, and it cannot delay the above.
+//
+// SysTick stays at the Arduino core's setting (also 15). micros() accounts
+// for a pending tick, so edge timing does not depend on SysTick running.
+///////////////////////////////////////////////////////////////////////////////
+const unsigned EdgeCapturePriority = 1;
+const unsigned AngleSchedulerPriority = 2;
+const unsigned PwmPriority = 3;
+const unsigned SerialPriority = 4;
+const unsigned ControlPriority = 15;
+
+///////////////////////////////////////////////////////////////////////////////
+// Apply the plan above. Must be called after attachInterrupt, because the
+// Arduino core resets the PIO priorities when it attaches the first handler.
+///////////////////////////////////////////////////////////////////////////////
+void ConfigureInterruptPriorities();
+
+///////////////////////////////////////////////////////////////////////////////
+// Raise the PendSV interrupt, which runs the control computation.
+///////////////////////////////////////////////////////////////////////////////
+void RequestControlUpdate();
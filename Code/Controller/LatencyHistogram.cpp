@@ -0,0 +1,179 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "LatencyHistogram.h"
+#include "SelfTest.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// One histogram per bank. Intake and exhaust solenoids on the same bank
+// share a histogram.
+///////////////////////////////////////////////////////////////////////////////
+LatencyHistogram LeftLatency;
+LatencyHistogram RightLatency;
+
+// At 1500 RPM a cam revolution takes 80ms, so the top buckets cover
+// duty updates that waited most of a revolution for the angle scheduler.
+const unsigned LatencyHistogram::BucketLimits[BucketCount] =
+{
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 0xFFFFFFFF
+};
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Reset()
+{
+	for (int i = 0; i < BucketCount; i++)
+	{
+		Counts[i] = 0;
+	}
+
+	Last = 0;
+	Max = 0;
+	Median = 0;
+	Percentile99 = 0;
+
+	for (int i = 0; i < SolenoidCount; i++)
+	{
+		lastSampleTimes[i] = 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Record the latency of a duty cycle write.
+///////////////////////////////////////////////////////////////////////////////
+void LatencyHistogram::Record(unsigned sampleTime, unsigned now, int solenoid)
+{
+	if ((sampleTime == 0) || (sampleTime == lastSampleTimes[solenoid]))
+	{
+		return;
+	}
+
+	lastSampleTimes[solenoid] = sampleTime;
+	Last = now - sampleTime;
+	if (Last > Max)
+	{
+		Max = Last;
+	}
+
+	for (int i = 0; i < BucketCount; i++)
+	{
+		if (Last <= BucketLimits[i])
+		{
+			Counts[i]++;
+			break;
+		}
+	}
+}
+
+void LatencyHistogram::Summarize()
+{
+	Median = GetPercentile(50);
+	Percentile99 = GetPercentile(99);
+}
+
+unsigned LatencyHistogram::GetPercentile(unsigned percent)
+{
+	unsigned total = 0;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		total += Counts[i];
+	}
+
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	unsigned threshold = ((total * percent) + 99) / 100;
+	unsigned sum = 0;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		sum += Counts[i];
+		if (sum >= threshold)
+		{
+			return BucketLimits[i];
+		}
+	}
+
+	return BucketLimits[BucketCount - 1];
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Latencies land in the right buckets, and repeats are ignored.
+///////////////////////////////////////////////////////////////////////////////
+bool TestLatencyBuckets()
+{
+	LatencyHistogram test;
+	test.Record(1000, 1050);
+	test.Record(1000, 1900);
+	test.Record(2000, 2300);
+	test.Record(3000, 3300);
+	test.Record(4000, 24000);
+
+	if (!CompareUnsigned(test.Counts[0], 1, "Bucket 0") ||
+		!CompareUnsigned(test.Counts[2], 2, "Bucket 2") ||
+		!CompareUnsigned(test.Counts[7], 1, "Bucket 7"))
+	{
+		return false;
+	}
+
+	if (!CompareUnsigned(test.Max, 20000, "Max") ||
+		!CompareUnsigned(test.Last, 20000, "Last"))
+	{
+		return false;
+	}
+
+	test.Summarize();
+	if (!CompareUnsigned(test.Median, 500, "Median") ||
+		!CompareUnsigned(test.Percentile99, 25000, "P99"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Exhaust and intake writes on one bank are deduplicated separately, so
+// repeated writes of either one's samples are ignored.
+///////////////////////////////////////////////////////////////////////////////
+bool TestLatencyShared()
+{
+	LatencyHistogram test;
+	for (int i = 0; i < 3; i++)
+	{
+		test.Record(1000, 1200 + (i * 1000), LatencyHistogram::ExhaustSolenoid);
+		test.Record(1100, 1200 + (i * 1000), LatencyHistogram::IntakeSolenoid);
+	}
+
+	if (!CompareUnsigned(test.Counts[0], 1, "Bucket 0") ||
+		!CompareUnsigned(test.Counts[1], 1, "Bucket 1"))
+	{
+		return false;
+	}
+
+	return CompareUnsigned(test.Max, 200, "Max");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestLatencyHistogram()
+{
+	InvokeTest(LatencyBuckets);
+	InvokeTest(LatencyShared);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Histogram of control latency: the time from the cam edge that produced an
+// angle sample to the PWM duty register write that acts on it.
+///////////////////////////////////////////////////////////////////////////////
+class LatencyHistogram
+{
+public:
+	static const int BucketCount = 10;
+
+	// Solenoids whose writes go into the same histogram. Each keeps its
+	// own last sample time, so that their samples are not confused.
+	static const int ExhaustSolenoid = 0;
+	static const int IntakeSolenoid = 1;
+	static const int SolenoidCount = 2;
+
+	// Upper bound of each bucket, in microseconds. The last one is open.
+	static const unsigned BucketLimits[BucketCount];
+
+	unsigned Counts[BucketCount];
+	unsigned Last;
+	unsigned Max;
+
+	// Upper bound of the bucket holding the median and the 99th percentile.
+	unsigned Median;
+	unsigned Percentile99;
+
+	LatencyHistogram();
+	void Reset();
+
+	// The sample time is the edge timestamp carried with the duty cycle.
+	// Each sample is only recorded once, however often its duty is written.
+	void Record(unsigned sampleTime, unsigned now, int solenoid = ExhaustSolenoid);
+
+	// Refresh Median and Percentile99 from the bucket counts.
+	void Summarize();
+
+private:
+	unsigned lastSampleTimes[SolenoidCount];
+	unsigned GetPercentile(unsigned percent);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestLatencyHistogram();
+
+extern LatencyHistogram LeftLatency;
+extern LatencyHistogram RightLatency;
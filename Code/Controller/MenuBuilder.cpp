@@ -6,8 +6,21 @@
 #include "MenuBuilder.h"
 #include "Globals.h"
 #include "ExhaustCamState.h"
+#include "IntakeCamState.h"
 #include "CrankState.h"
 #include "Feedback.h"
+#include "PatternDetector.h"
+#include "ControlTimer.h"
+#include "LatencyHistogram.h"
+#include "SolenoidMap.h"
+#include "SolenoidCharacterizer.h"
+#include "SupplyVoltage.h"
+#include "OilPressureState.h"
+#include "OscillationDetector.h"
+#include "BankTargets.h"
+#include "ValveEvents.h"
+#include "PlausibilityMonitor.h"
+#include "Configuration.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // At run time, in an error happens, this screen will have additional screens 
@@ -21,11 +34,12 @@ Screen *ErrorScreen = new TwoValueScreen("RunErr  InitErr", &ErrorCount, &Initia
 
 Screen* MenuBuilder::BuildMenu()
 {
+	// The top line shows the detected trigger patterns once they are known.
 	Screen *calibrationScreen = new ThreeValueScreen(
-		"Calibrating",
-		&LeftExhaustCam.CalibrationCountdown,
-		&Crank.CalibrationCountdown,
-		&RightExhaustCam.CalibrationCountdown);
+		IPatternDetector::GetInstance()->GetSummary(),
+		&LeftExhaustCam.View.CalibrationCountdown,
+		&Crank.View.CalibrationCountdown,
+		&RightExhaustCam.View.CalibrationCountdown);
 
 	Screen *warmingScreen = new SingleValueScreen(
 		"Warming",
@@ -33,9 +47,16 @@ Screen* MenuBuilder::BuildMenu()
 
 	Screen *rpmScreen = new ThreeValueScreen(
 		"Left Crank Right",
-		&LeftExhaustCam.Rpm,
-		&Crank.Rpm,
-		&RightExhaustCam.Rpm);
+		&LeftExhaustCam.View.Rpm,
+		&Crank.View.Rpm,
+		&RightExhaustCam.View.Rpm);
+
+	// Crank signal lost: RPM comes from the cams.
+	Screen *limpScreen = new ThreeValueScreen(
+		"Limp L Count R",
+		&LeftExhaustCam.View.Rpm,
+		&mode.LimpCount,
+		&RightExhaustCam.View.Rpm);
 
 	// TODO: MainScreen should alternate between rpmScreen and camErrorScreen
 	Screen *camErrorScreen = new TwoValueScreenF(
@@ -44,13 +65,24 @@ Screen* MenuBuilder::BuildMenu()
 		&RightCamError);
 
 	Screen* MainRow[] = {
-		new MainScreen(&mode, calibrationScreen, warmingScreen, rpmScreen),
+		new MainScreen(&mode, calibrationScreen, warmingScreen, rpmScreen, limpScreen),
 		new SingleValueScreen("Update Rate", &IterationsPerSecond),
+		new SingleValueScreen("Supply mV", &Supply.Millivolts),
+		new SingleValueScreen("ISR Max uSec", &IsrMaxDuration),
+		new SingleValueScreen("Late Angle Evts", &LateAngleEvents),
+		new TwoValueScreen("PWM Writes  Skip", &SolenoidWrites, &SolenoidWritesSkipped),
+		new ThreeValueScreen("LLat Med P99 Max", &LeftLatency.Median, &LeftLatency.Percentile99, &LeftLatency.Max),
+		new ThreeValueScreen("RLat Med P99 Max", &RightLatency.Median, &RightLatency.Percentile99, &RightLatency.Max),
+#ifdef UseFixedRateControl
+		new TwoValueScreen("Tick Jitter  Max", &FixedRateTimer.Jitter, &FixedRateTimer.MaxJitter),
+#endif
+		new TwoValueScreen("Faults Act Store", &Plausibility.ActiveFaults, &Plausibility.StoredFaults),
+		new TwoValueScreen("Fault Evts Fails", &Plausibility.FaultEvents, &Plausibility.FailedChecks),
 		new ThreeValueScreen("Timeouts", &LeftExhaustCam.Timeout, &Crank.Timeout, &RightExhaustCam.Timeout),
 		new ThreeValueScreen("DbgL DbgC DbgR", &DebugLeft, &DebugCrank, &DebugRight),
-		new TwoValueScreen("Left Pin & Pulse", &LeftExhaustCam.PinState, &LeftExhaustCam.PulseState),
-		new TwoValueScreen("Rght Pin & Pulse", &RightExhaustCam.PinState, &RightExhaustCam.PulseState),
-		new TwoValueScreen("Crnk Pin & Pulse", &Crank.PinState, &Crank.PulseState),
+		new TwoValueScreen("Left Pin & Pulse", &LeftExhaustCam.PinState, &LeftExhaustCam.View.PulseState),
+		new TwoValueScreen("Rght Pin & Pulse", &RightExhaustCam.PinState, &RightExhaustCam.View.PulseState),
+		new TwoValueScreen("Crnk Pin & Pulse", &Crank.PinState, &Crank.View.PulseState),
 		//new TwoLongValueScreen(&DebugLong1, &DebugLong2),
 		//new FourValueScreen(&LeftCam.PinState, &RightCam.PinState, &Crank.SensorState, &KnobState),
 		0
@@ -66,44 +98,67 @@ Screen* MenuBuilder::BuildMenu()
 		new SingleValueScreen("PLX RX Sensors", &ReceivedSensorCount),
 		new ThreeValueScreen("PLX RX RPM", &ReceivedLeftRpm, &ReceivedCrankRpm, &ReceivedRightRpm),
 		new TwoValueScreen("PLX RX Pressure", &ReceivedFluidPressureAddress, &ReceivedFluidPressure),
+		new SingleValueScreen("Oil Pressure PSI", &OilPressure.DisplayPsi),
 		0
 	};
 
 	Screen* LeftCamRow[] = {
-		new SingleValueScreen("Left Rpm", &LeftExhaustCam.Rpm),
-		new SingleValueScreen("Left Interval", &LeftExhaustCam.AverageInterval),
-		new SingleValueScreen("Left Duration", &LeftExhaustCam.PulseDuration),
-		new SingleValueScreen("Left Since Crank", &LeftExhaustCam.TimeSinceCrankSignal),
-		new SingleValueScreenF("Left Angle", &LeftExhaustCam.Angle),
-		new SingleValueScreenF("Left Baseline", &LeftExhaustCam.Baseline),
+		new SingleValueScreen("Left Rpm", &LeftExhaustCam.View.Rpm),
+		new SingleValueScreen("Left Interval", &LeftExhaustCam.View.AverageInterval),
+		new SingleValueScreen("Left Duration", &LeftExhaustCam.View.PulseDuration),
+		new SingleValueScreen("Left Since Crank", &LeftExhaustCam.View.TimeSinceCrankSignal),
+		new SingleValueScreenF("Left Angle", &LeftExhaustCam.View.Angle),
+		new SingleValueScreenF("Left Baseline", &LeftExhaustCam.View.Baseline),
 		0
 	};
 
 	Screen* RightCamRow[] = {
-		new SingleValueScreen("Right Rpm", &RightExhaustCam.Rpm),
-		new SingleValueScreen("Right Interval", &RightExhaustCam.AverageInterval),
-		new SingleValueScreen("Right Duration", &RightExhaustCam.PulseDuration),
-		new SingleValueScreen("Right Since Cran", &RightExhaustCam.TimeSinceCrankSignal),
-		new SingleValueScreenF("Right Angle", &RightExhaustCam.Angle),
-		new SingleValueScreenF("Right Baseline", &RightExhaustCam.Baseline),
+		new SingleValueScreen("Right Rpm", &RightExhaustCam.View.Rpm),
+		new SingleValueScreen("Right Interval", &RightExhaustCam.View.AverageInterval),
+		new SingleValueScreen("Right Duration", &RightExhaustCam.View.PulseDuration),
+		new SingleValueScreen("Right Since Cran", &RightExhaustCam.View.TimeSinceCrankSignal),
+		new SingleValueScreenF("Right Angle", &RightExhaustCam.View.Angle),
+		new SingleValueScreenF("Right Baseline", &RightExhaustCam.View.Baseline),
+		0
+	};
+
+	Screen* IntakeCamRow[] = {
+		new TwoValueScreen("Intake Rpm L R", &LeftIntakeCam.View.Rpm, &RightIntakeCam.View.Rpm),
+		new TwoValueScreen("Intake Cal L R", &LeftIntakeCam.View.CalibrationCountdown, &RightIntakeCam.View.CalibrationCountdown),
+		new TwoValueScreenF("Intake Angle L R", &LeftIntakeCam.View.Angle, &RightIntakeCam.View.Angle),
+		new TwoValueScreenF("Intake Base L R", &LeftIntakeCam.View.Baseline, &RightIntakeCam.View.Baseline),
+		new SingleValueScreenF("Intake Target", &IntakeCamTargetAngle),
+		new TwoValueScreenF("Intake Tgt  L R", &IntakeTargets.Left, &IntakeTargets.Right),
+		new TwoValueScreenF("Intake DC L R", &LeftIntakeFeedback.View.Output, &RightIntakeFeedback.View.Output),
+		new TwoValueScreen("Intake Timeouts", &LeftIntakeCam.Timeout, &RightIntakeCam.Timeout),
 		0
 	};
 
 	Screen* CrankRow[] = {
-		new SingleValueScreen("Crank Rpm", &Crank.Rpm),
-		new SingleValueScreen("Crank Pulse", &Crank.PulseDuration),
+		new SingleValueScreen("Crank Rpm", &Crank.View.Rpm),
+		new SingleValueScreen("Crank Pulse", &Crank.View.PulseDuration),
+		new TwoValueScreen("Crank Mark  Errs", &Crank.View.CurrentMark, &Crank.View.MarkErrors),
 		0
 	};
 
 	Screen* CamAngleRow[] = {
 		camErrorScreen,
-		new TwoValueScreenF("Cams.Actual", &LeftExhaustCam.Angle, &RightExhaustCam.Angle),
+		new TwoValueScreenF("Osc Amp     L R", &LeftOscillation.Amplitude, &RightOscillation.Amplitude),
+		new TwoValueScreenF("Osc Hz      L R", &LeftOscillation.Frequency, &RightOscillation.Frequency),
+		new TwoValueScreen("Osc Count   L R", &LeftOscillation.Detections, &RightOscillation.Detections),
+		new TwoValueScreenF("Cams.Actual", &LeftExhaustCam.View.Angle, &RightExhaustCam.View.Angle),
 		new SingleValueScreenF("Cams.Target", &CamTargetAngle),
+		new TwoValueScreenF("Bank Target L R", &ExhaustTargets.Left, &ExhaustTargets.Right),
+		new TwoValueScreenF("Overlap     L R", &LeftValves.Overlap, &RightValves.Overlap),
+		new TwoValueScreenF("Overlap Cut L R", &LeftValves.ExhaustLimit, &RightValves.ExhaustLimit),
+		new TwoValueScreen("Char Step   L R", &LeftCharacterizer.Step, &RightCharacterizer.Step),
+		new TwoValueScreenF("Null Duty   L R", &LeftSolenoidMap.NullDuty, &RightSolenoidMap.NullDuty),
+		new TwoValueScreenF("Dead Band   L R", &LeftSolenoidMap.DeadBand, &RightSolenoidMap.DeadBand),
 		NULL,
 	};
 
 	Screen** FeedbackAverageRow = new Screen*[Feedback::BucketCount + 2];
-	FeedbackAverageRow[0] = new TwoValueScreenF("Actuator DC", &LeftFeedback.Output, &RightFeedback.Output);
+	FeedbackAverageRow[0] = new TwoValueScreenF("Actuator DC", &LeftFeedback.View.Output, &RightFeedback.View.Output);
 	for (int i = 0; i < Feedback::BucketCount; i++)
 	{
 		FeedbackAverageRow[i + 1] = new ThreeValueScreenUUF(
@@ -129,6 +184,9 @@ Screen* MenuBuilder::BuildMenu()
 		ScreenNavigator::BuildRow(PlxRow),
 		ScreenNavigator::BuildRow(LeftCamRow),
 		ScreenNavigator::BuildRow(RightCamRow),
+#ifdef UseIntakeCams
+		ScreenNavigator::BuildRow(IntakeCamRow),
+#endif
 		ScreenNavigator::BuildRow(CrankRow),
 		ScreenNavigator::BuildRow(CamAngleRow),
 		ScreenNavigator::BuildRow(FeedbackAverageRow),
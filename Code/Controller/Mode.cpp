@@ -11,7 +11,9 @@
 #include "Screen.h"
 #include "SelfTest.h"
 #include "ExhaustCamState.h"
+#include "IntakeCamState.h"
 #include "CrankState.h"
+#include "PatternDetector.h"
 #include "Configuration.h"
 
 extern Screen *ErrorScreen;
@@ -25,6 +27,9 @@ void Mode::Initialize()
 {
 	ErrorCount = 0;
 	InitializationErrorCount = 0;
+	LimpCount = 0;
+	crankLost = 0;
+	lostSignal = NULL;
 	this->BeginCalibrating();
 	ErrorScreen->Right = NULL;
 }
@@ -34,9 +39,43 @@ void Mode::Initialize()
 ///////////////////////////////////////////////////////////////////////////////
 void Mode::Update()
 {
+	// The transitions write to the serial port and the LCD, so lost signals
+	// reported by interrupt handlers are acted on here.
+	const char *lost = lostSignal;
+	if (lost != NULL)
+	{
+		lostSignal = NULL;
+		Fail(lost);
+		return;
+	}
+
+	if (crankLost)
+	{
+		crankLost = 0;
+		if ((this->currentMode == Mode::Running) || (this->currentMode == Mode::Limp))
+		{
+			BeginLimp();
+		}
+		else
+		{
+			Fail("Crank Timeout");
+		}
+
+		return;
+	}
+
 	switch (this->currentMode)
 	{
 	case Mode::Calibrating:
+
+		// Once the trigger patterns have been identified, switch to the
+		// matching decoders and start calibrating them from scratch.
+		if (IPatternDetector::GetInstance()->IsComplete() && !IPatternDetector::GetInstance()->IsApplied())
+		{
+			IPatternDetector::GetInstance()->Apply();
+			this->BeginCalibrating();
+			return;
+		}
 	
 		if (Crank.Rpm < MINIMUM_EXAVCS_RPM)
 		{
@@ -60,6 +99,19 @@ void Mode::Update()
 			this->BeginRunning();
 		}
 		break;
+
+	case Mode::Limp:
+
+		// The crank angle references are good again once the signal has
+		// kept up for a while. A further timeout restarts the count.
+		if ((Crank.PulseCount - limpPulseCount) >= LIMP_RECOVERY_PULSES)
+		{
+#ifdef ARDUINO
+			Serial.println("Crank Recovered");
+#endif
+			this->BeginRunning();
+		}
+		break;
 	}
 }
 
@@ -121,6 +173,27 @@ void Mode::Fail(const char * message)
 	// this->Initialize(); ?
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// The crank sensor is the least robust part of the system. Losing it while
+// running should not take the cams straight back to zero duty, so Update
+// carries on in limp mode. Otherwise the calibration has to start over
+// anyway. Until Update runs, UpdateControl treats the flag as limp mode.
+///////////////////////////////////////////////////////////////////////////////
+void Mode::CrankLost()
+{
+	crankLost = 1;
+}
+
+void Mode::SignalLost(const char *message)
+{
+	lostSignal = message;
+}
+
+bool Mode::IsSignalLost()
+{
+	return lostSignal != NULL;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Begin calibrating cam and crank timing
 ///////////////////////////////////////////////////////////////////////////////
@@ -132,7 +205,13 @@ void Mode::BeginCalibrating()
 	// Exhaust cams have two pulses per revolution.
 	LeftExhaustCam.CalibrationCountdown = CalibrationCountdown * 2;
 	RightExhaustCam.CalibrationCountdown = CalibrationCountdown * 2;
-	Crank.CalibrationCountdown = CalibrationCountdown;
+	Crank.CalibrationCountdown = CalibrationCountdown * Crank.MarkCount;
+
+#ifdef UseIntakeCams
+	// Intake cams have three pulses per revolution.
+	LeftIntakeCam.CalibrationCountdown = CalibrationCountdown * 3;
+	RightIntakeCam.CalibrationCountdown = CalibrationCountdown * 3;
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -153,14 +232,37 @@ void Mode::BeginRunning()
 	this->currentMode = Mode::Running;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Transition to limp mode, or stay there
+///////////////////////////////////////////////////////////////////////////////
+void Mode::BeginLimp()
+{
+	if (this->currentMode != Mode::Limp)
+	{
+#ifdef ARDUINO
+		Serial.println("Crank Lost, Limp");
+#endif
+		ClearScreen();
+		LimpCount++;
+		this->currentMode = Mode::Limp;
+	}
+
+	limpPulseCount = Crank.PulseCount;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Indicates whether the cam and crank states are calibrated
 ///////////////////////////////////////////////////////////////////////////////
 int Mode::IsCalibrated()
 {
 	return
+		IPatternDetector::GetInstance()->IsApplied() &&
 		LeftExhaustCam.CalibrationCountdown == 0 &&
 		RightExhaustCam.CalibrationCountdown == 0 &&
+#ifdef UseIntakeCams
+		LeftIntakeCam.CalibrationCountdown == 0 &&
+		RightIntakeCam.CalibrationCountdown == 0 &&
+#endif
 		Crank.CalibrationCountdown == 0;
 }
 
@@ -198,11 +300,23 @@ bool ValidateRecalibrate()
 		return false;
 	}
 
-	if (!CompareUnsigned(Crank.CalibrationCountdown, Mode::CalibrationCountdown, "Crank.SC"))
+	if (!CompareUnsigned(Crank.CalibrationCountdown, Mode::CalibrationCountdown * Crank.MarkCount, "Crank.SC"))
 	{
 		return false;
 	}
 
+#ifdef UseIntakeCams
+	if (!CompareUnsigned(LeftIntakeCam.CalibrationCountdown, Mode::CalibrationCountdown * 3, "LeftInt.SC"))
+	{
+		return false;
+	}
+
+	if (!CompareUnsigned(RightIntakeCam.CalibrationCountdown, Mode::CalibrationCountdown * 3, "RightInt.SC"))
+	{
+		return false;
+	}
+#endif
+
 	if (!CompareUnsigned(mode.GetMode(), Mode::Calibrating, "Mode.1"))
 	{
 		return false;
@@ -232,11 +346,14 @@ bool TestInitializeMode()
 bool TestTransToWarming()
 {
 	TestInitializeMode();
+	IPatternDetector::GetInstance()->UseDefaults();
 
 	Crank.Rpm = MINIMUM_EXAVCS_RPM + 100;
 
 	LeftExhaustCam.CalibrationCountdown = 0;
 	RightExhaustCam.CalibrationCountdown = 0;
+	LeftIntakeCam.CalibrationCountdown = 0;
+	RightIntakeCam.CalibrationCountdown = 0;
 	Crank.CalibrationCountdown = 0;
 	
 	mode.Update();
@@ -350,6 +467,145 @@ bool TestFailRunning()
 	return ValidateRecalibrate();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Losing the crank while running goes to limp mode, a timeout during limp
+// mode restarts the recovery count, and a steady crank signal recovers.
+///////////////////////////////////////////////////////////////////////////////
+bool TestLimpRecovery()
+{
+	TestTransToRunning();
+
+	mode.CrankLost();
+	if (!CompareUnsigned(mode.GetMode(), Mode::Running, "Deferred") ||
+		!CompareUnsigned(mode.IsCrankLost(), 1, "Flag"))
+	{
+		return false;
+	}
+
+	mode.Update();
+	if (!CompareUnsigned(mode.GetMode(), Mode::Limp, "Limp") ||
+		!CompareUnsigned(mode.IsCrankLost(), 0, "Flag.2") ||
+		!CompareUnsigned(mode.LimpCount, 1, "LimpCount") ||
+		!CompareUnsigned(ErrorCount, 0, "Err.5"))
+	{
+		return false;
+	}
+
+	Crank.PulseCount += LIMP_RECOVERY_PULSES - 1;
+	mode.CrankLost();
+	mode.Update();
+	Crank.PulseCount += LIMP_RECOVERY_PULSES - 1;
+	mode.Update();
+	if (!CompareUnsigned(mode.GetMode(), Mode::Limp, "Still Limp") ||
+		!CompareUnsigned(mode.LimpCount, 1, "LimpCount.2"))
+	{
+		return false;
+	}
+
+	Crank.PulseCount++;
+	mode.Update();
+	return CompareUnsigned(mode.GetMode(), Mode::Running, "Recovered");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Losing the crank before running is an ordinary failure.
+///////////////////////////////////////////////////////////////////////////////
+bool TestLimpWarming()
+{
+	TestTransToWarming();
+
+	mode.CrankLost();
+	mode.Update();
+	if (!CompareUnsigned(ErrorCount, 1, "Err.6"))
+	{
+		return false;
+	}
+
+	return ValidateRecalibrate();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulate cam pulses with no crank signal, at the given crank RPM.
+///////////////////////////////////////////////////////////////////////////////
+void SimulateCamsOnly(unsigned rpm)
+{
+	// Two pulses per cam revolution, so each is one crank revolution apart.
+	unsigned interval = TicksPerMinute / rpm;
+	for (int i = 0; i < 20; i++)
+	{
+		LeftExhaustCam.BeginPulse(interval, 0, 0.0f, 0);
+		RightExhaustCam.BeginPulse(interval, 0, 0.0f, 0);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// With the crank lost, the cams must keep tracking the RPM as the engine
+// slows, so that the limp hold lets go below the control threshold.
+///////////////////////////////////////////////////////////////////////////////
+bool TestLimpCamRpm()
+{
+	ExhaustCamState savedLeft = LeftExhaustCam;
+	ExhaustCamState savedRight = RightExhaustCam;
+
+	TestTransToRunning();
+	LeftExhaustCam.StartCycle();
+	RightExhaustCam.StartCycle();
+	SimulateCamsOnly(3000);
+
+	mode.CrankLost();
+	mode.Update();
+
+	const unsigned release = MINIMUM_EXAVCS_RPM - EXAVCS_RPM_HYSTERESIS;
+	bool holding = 
+		CompareUnsigned(mode.GetMode(), Mode::Limp, "Limp") &&
+		WithinOnePercent((float)GetCamRpm(), 3000.0f, "Hold");
+
+	for (unsigned rpm = 2500; rpm >= IDLE_RPM; rpm -= 250)
+	{
+		SimulateCamsOnly(rpm);
+	}
+
+	unsigned camRpm = GetCamRpm();
+	LeftExhaustCam = savedLeft;
+	RightExhaustCam = savedRight;
+
+	if (!holding)
+	{
+		return false;
+	}
+
+	if (camRpm >= release)
+	{
+		return CompareUnsigned(camRpm, release - 1, "Release");
+	}
+
+	return WithinOnePercent((float)camRpm, (float)IDLE_RPM, "Idle");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A lost cam signal is a failure, but only once Update runs.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSignalLost()
+{
+	TestTransToRunning();
+
+	mode.SignalLost("Testing");
+	if (!CompareUnsigned(mode.GetMode(), Mode::Running, "Deferred") ||
+		!CompareUnsigned(mode.IsSignalLost(), 1, "Flag"))
+	{
+		return false;
+	}
+
+	mode.Update();
+	if (!CompareUnsigned(mode.IsSignalLost(), 0, "Flag.2") ||
+		!CompareUnsigned(ErrorCount, 1, "Err.7"))
+	{
+		return false;
+	}
+
+	return ValidateRecalibrate();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Self-test the Mode code.
 ///////////////////////////////////////////////////////////////////////////////
@@ -385,5 +641,9 @@ void SelfTestMode()
 	InvokeTest(FailCalibration);
 	InvokeTest(FailWarming);
 	InvokeTest(FailRunning);
+	InvokeTest(LimpRecovery);
+	InvokeTest(LimpWarming);
+	InvokeTest(LimpCamRpm);
+	InvokeTest(SignalLost);
 	testMode = 0;
 }
\ No newline at end of file
@@ -7,14 +7,20 @@
 // Synchronizing: observing the first N cycles while RPM stabilizes.
 // Warming: waiting for oil to warm up before trying to control the cams.
 // Running: controlling cams based on crank and cam sensors and feedback loops.
+// Limp: the crank signal was lost while running, so the cams are held with
+// the RPM from the cam sensors until the crank signal returns.
 ///////////////////////////////////////////////////////////////////////////////
 class Mode
 {
 private:
 	int currentMode;
+	unsigned limpPulseCount;
+	volatile int crankLost;
+	const char * volatile lostSignal;
 	void BeginCalibrating();
 	void BeginWarming();
 	void BeginRunning();
+	void BeginLimp();
 	int IsCalibrated();
 
 public:
@@ -23,10 +29,30 @@ public:
 	static const int Calibrating = 1;
 	static const int Warming = 2;
 	static const int Running = 3;
+	static const int Limp = 4;
+
+	// Number of times the crank signal was lost while running.
+	unsigned LimpCount;
 
 	void Initialize();
 	void Update();
 	void Fail(const char *message);
+
+	// To be invoked when the crank signal times out. Only a failure if the
+	// controller was not running. This is safe to call from an interrupt
+	// handler: it only sets a flag, and Update makes the transition.
+	void CrankLost();
+
+	// Whether a crank timeout is waiting for Update.
+	bool IsCrankLost() { return crankLost != 0; }
+
+	// To be invoked by interrupt handlers when a cam signal times out, or
+	// another signal fails. The message is kept, and Update passes it to
+	// Fail from the main loop.
+	void SignalLost(const char *message);
+
+	// Whether a lost signal is waiting for Update.
+	bool IsSignalLost();
 	int GetMode() { return this->currentMode; }
 	void ClearScreen();
 };
@@ -36,6 +62,12 @@ public:
 ///////////////////////////////////////////////////////////////////////////////
 extern Mode mode;
 
+///////////////////////////////////////////////////////////////////////////////
+// Nonzero while self-tests are running, so that code under test leaves the
+// shared mode and the LCD alone.
+///////////////////////////////////////////////////////////////////////////////
+extern int testMode;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Self-tests for the mode code.
 ///////////////////////////////////////////////////////////////////////////////
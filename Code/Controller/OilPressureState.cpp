@@ -0,0 +1,183 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include <math.h>
+#include "stdafx.h"
+#include "Globals.h"
+#include "OilPressureState.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+OilPressureState OilPressure;
+
+// PLX fluid pressure units, per PLX application note 18 (Docs/PLXApp018.pdf):
+// sensor 10 in PSI Oil is data / 5.115.
+static const float PlxCountsPerPsi = 5.115f;
+
+// The sensor is considered missing after this many packets without it.
+static const unsigned MaxPacketsWithoutReading = 20;
+
+// Pressure must rise this far above the minimum before control resumes, so
+// that pressure hovering around the minimum does not toggle the solenoids.
+static const float PressureHysteresis = 3.0f;
+
+// Limits on the gain scale, so a bad reading cannot make the loop unstable.
+static const float MinimumGainScale = 0.5f;
+static const float MaximumGainScale = 2.0f;
+
+OilPressureState::OilPressureState()
+{
+	Psi = 0;
+	DisplayPsi = 0;
+	Available = false;
+	sufficient = false;
+	packetsSinceReading = 0;
+}
+
+void OilPressureState::Received(unsigned raw)
+{
+	Psi = raw / PlxCountsPerPsi;
+	DisplayPsi = (unsigned)Psi;
+	Available = true;
+	packetsSinceReading = 0;
+
+	if (Psi < MINIMUM_OIL_PRESSURE_PSI)
+	{
+		sufficient = false;
+	}
+	else if (Psi > MINIMUM_OIL_PRESSURE_PSI + PressureHysteresis)
+	{
+		sufficient = true;
+	}
+}
+
+void OilPressureState::PacketEnded()
+{
+	if (packetsSinceReading < MaxPacketsWithoutReading)
+	{
+		packetsSinceReading++;
+		return;
+	}
+
+	Available = false;
+}
+
+bool OilPressureState::IsSufficient()
+{
+	return !Available || sufficient;
+}
+
+float OilPressureState::GetGainScale()
+{
+	if (!Available || (Psi <= 0))
+	{
+		return 1.0f;
+	}
+
+	float scale = sqrtf(REFERENCE_OIL_PRESSURE_PSI / Psi);
+	if (scale < MinimumGainScale)
+	{
+		return MinimumGainScale;
+	}
+
+	if (scale > MaximumGainScale)
+	{
+		return MaximumGainScale;
+	}
+
+	return scale;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Control is gated on pressure with hysteresis, and not gated at all when
+// there is no pressure sensor.
+///////////////////////////////////////////////////////////////////////////////
+bool TestOilPressGate()
+{
+	OilPressureState test;
+	if (!test.IsSufficient())
+	{
+		TestFailed("No sensor");
+		return false;
+	}
+
+	test.Received((unsigned)((MINIMUM_OIL_PRESSURE_PSI - 1) * PlxCountsPerPsi));
+	if (test.IsSufficient())
+	{
+		TestFailed("Low");
+		return false;
+	}
+
+	test.Received((unsigned)((MINIMUM_OIL_PRESSURE_PSI + 1) * PlxCountsPerPsi));
+	if (test.IsSufficient())
+	{
+		TestFailed("Hysteresis");
+		return false;
+	}
+
+	test.Received((unsigned)((MINIMUM_OIL_PRESSURE_PSI + PressureHysteresis + 1) * PlxCountsPerPsi));
+	if (!test.IsSufficient())
+	{
+		TestFailed("Recovered");
+		return false;
+	}
+
+	test.Received(0);
+	for (unsigned i = 0; i <= MaxPacketsWithoutReading; i++)
+	{
+		test.PacketEnded();
+	}
+
+	if (!test.IsSufficient() || test.Available)
+	{
+		TestFailed("Sensor lost");
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A quarter of the reference pressure doubles the gains.
+///////////////////////////////////////////////////////////////////////////////
+bool TestOilPressScale()
+{
+	OilPressureState test;
+	if (!WithinOnePercent(test.GetGainScale(), 1.0f, "No sensor"))
+	{
+		return false;
+	}
+
+	test.Received((unsigned)(REFERENCE_OIL_PRESSURE_PSI * PlxCountsPerPsi));
+	if (!WithinOnePercent(test.GetGainScale(), 1.0f, "Reference"))
+	{
+		return false;
+	}
+
+	test.Received((unsigned)((REFERENCE_OIL_PRESSURE_PSI / 4) * PlxCountsPerPsi));
+	if (!WithinOnePercent(test.GetGainScale(), 2.0f, "Quarter"))
+	{
+		return false;
+	}
+
+	test.Received((unsigned)((REFERENCE_OIL_PRESSURE_PSI / 100) * PlxCountsPerPsi));
+	return WithinOnePercent(test.GetGainScale(), 2.0f, "Limit");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestOilPressureState()
+{
+	InvokeTest(OilPressGate);
+	InvokeTest(OilPressScale);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Oil pressure from the PLX sensor stream, and what it means for cam control.
+//
+// Phaser slew rate depends on oil pressure, roughly as the square root of it
+// since the solenoid valve behaves like an orifice. GetGainScale returns the
+// factor that the feedback gains are multiplied by to make up for that, so
+// the loop responds the same way from hot idle to redline.
+//
+// Below MINIMUM_OIL_PRESSURE_PSI the phasers cannot be moved reliably, so
+// IsSufficient returns false and the solenoids are disabled.
+//
+// Without a pressure sensor in the PLX chain, the controller behaves as it
+// did before: pressure is always sufficient and the gain scale is one.
+///////////////////////////////////////////////////////////////////////////////
+class OilPressureState
+{
+public:
+	// Pounds per square inch.
+	float Psi;
+
+	// The same, for display.
+	unsigned DisplayPsi;
+
+	// True if a pressure reading arrived in the last few PLX packets.
+	bool Available;
+
+	OilPressureState();
+
+	// Invoked with each pressure reading, in PLX units.
+	void Received(unsigned raw);
+
+	// Invoked at the end of each PLX packet.
+	void PacketEnded();
+
+	bool IsSufficient();
+	float GetGainScale();
+
+private:
+	bool sufficient;
+	unsigned packetsSinceReading;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestOilPressureState();
+
+extern OilPressureState OilPressure;
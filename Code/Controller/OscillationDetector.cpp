@@ -0,0 +1,228 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include <math.h>
+#include "stdafx.h"
+#include "Globals.h"
+#include "OscillationDetector.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+OscillationDetector LeftOscillation;
+OscillationDetector RightOscillation;
+
+// Errors within this band do not count as a change of sign, so that angle
+// quantisation around the target does not look like a fast oscillation.
+static const float NoiseBand = 0.25f;
+
+// Cycles slower than this are not oscillation, and if there is no crossing
+// for this long the oscillation has stopped.
+static const float MaxPeriod = 2.0f;
+
+// Consecutive periods must agree within this ratio.
+static const float PeriodTolerance = 1.5f;
+
+OscillationDetector::OscillationDetector()
+{
+	Detections = 0;
+	Reset();
+}
+
+void OscillationDetector::Reset()
+{
+	Oscillating = 0;
+	Cycles = 0;
+	Amplitude = 0;
+	Frequency = 0;
+	GainScale = 1.0f;
+	lastTime = 0;
+	lastCrossing = 0;
+	haveCrossing = false;
+	sign = 0;
+	peak = 0;
+	lastPeriod = 0;
+}
+
+void OscillationDetector::Update(unsigned sampleTime, float error)
+{
+	if (sampleTime == lastTime)
+	{
+		return;
+	}
+
+	lastTime = sampleTime;
+
+	float magnitude = fabsf(error);
+	if (magnitude > peak)
+	{
+		peak = magnitude;
+	}
+
+	int newSign = sign;
+	if (error > NoiseBand)
+	{
+		newSign = 1;
+	}
+	else if (error < -NoiseBand)
+	{
+		newSign = -1;
+	}
+
+	if ((sign == -1) && (newSign == 1))
+	{
+		EndCycle(sampleTime);
+	}
+
+	sign = newSign;
+
+	// Unsigned subtraction handles timer wraparound.
+	float sinceCrossing = ((float)(sampleTime - lastCrossing)) / ((float)TicksPerSecond);
+	if (haveCrossing && (sinceCrossing > MaxPeriod))
+	{
+		haveCrossing = false;
+		Oscillating = 0;
+		Cycles = 0;
+		Amplitude = 0;
+		Frequency = 0;
+		lastPeriod = 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Invoked when the error crosses from negative to positive.
+///////////////////////////////////////////////////////////////////////////////
+void OscillationDetector::EndCycle(unsigned sampleTime)
+{
+	if (haveCrossing)
+	{
+		float period = ((float)(sampleTime - lastCrossing)) / ((float)TicksPerSecond);
+		bool consistent =
+			(lastPeriod == 0) ||
+			((period < lastPeriod * PeriodTolerance) && (period * PeriodTolerance > lastPeriod));
+
+		Amplitude = peak;
+		Frequency = 1.0f / period;
+
+		if ((peak >= OSCILLATION_MIN_AMPLITUDE) && consistent && (period <= MaxPeriod))
+		{
+			Cycles++;
+		}
+		else
+		{
+			Cycles = 0;
+			Oscillating = 0;
+		}
+
+		lastPeriod = period;
+
+		if ((Cycles >= SustainedCycles) && !Oscillating)
+		{
+			Oscillating = 1;
+			Detections++;
+
+			GainScale *= OSCILLATION_BACKOFF;
+			if (GainScale < OSCILLATION_MIN_GAIN_SCALE)
+			{
+				GainScale = OSCILLATION_MIN_GAIN_SCALE;
+			}
+		}
+	}
+
+	haveCrossing = true;
+	lastCrossing = sampleTime;
+	peak = 0;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Feed a sine wave of error sampled at 100Hz, and return the sample time
+// after the last sample.
+///////////////////////////////////////////////////////////////////////////////
+static unsigned FeedSine(OscillationDetector *test, unsigned sampleTime, float amplitude, float frequency, int samples)
+{
+	for (int i = 0; i < samples; i++)
+	{
+		float phase = 2 * 3.14159265f * frequency * (i / 100.0f);
+		test->Update(sampleTime, amplitude * sinf(phase));
+		sampleTime += TicksPerSecond / 100;
+	}
+
+	return sampleTime;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A sustained oscillation is detected and measured, backs off the gains
+// once, and clears when the error settles.
+///////////////////////////////////////////////////////////////////////////////
+bool TestOscDetect()
+{
+	OscillationDetector test;
+	unsigned sampleTime = FeedSine(&test, 1000, 2.0f, 5.0f, 200);
+
+	if (!CompareUnsigned(test.Oscillating, 1, "Detected") ||
+		!CompareUnsigned(test.Detections, 1, "Detections"))
+	{
+		return false;
+	}
+
+	if (!WithinOnePercent(test.Frequency, 5.0f, "Frequency") ||
+		!WithinOnePercent(test.Amplitude, 2.0f, "Amplitude") ||
+		!WithinOnePercent(test.GainScale, OSCILLATION_BACKOFF, "GainScale"))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < 300; i++)
+	{
+		test.Update(sampleTime, 0.0f);
+		sampleTime += TicksPerSecond / 100;
+	}
+
+	if (!CompareUnsigned(test.Oscillating, 0, "Cleared"))
+	{
+		return false;
+	}
+
+	return WithinOnePercent(test.GainScale, OSCILLATION_BACKOFF, "Kept");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Small errors, and a single overshoot, are not oscillation.
+///////////////////////////////////////////////////////////////////////////////
+bool TestOscIgnore()
+{
+	OscillationDetector test;
+	unsigned sampleTime = FeedSine(&test, 1000, OSCILLATION_MIN_AMPLITUDE * 0.8f, 5.0f, 200);
+	if (!CompareUnsigned(test.Oscillating, 0, "Small") ||
+		!CompareUnsigned(test.Cycles, 0, "Small Cycles"))
+	{
+		return false;
+	}
+
+	// A step response that overshoots once and settles.
+	float errors[] = { 5.0f, 3.0f, 1.0f, -1.0f, -0.5f, 0.3f, 0.1f, 0.0f };
+	for (int i = 0; i < 8; i++)
+	{
+		test.Update(sampleTime, errors[i]);
+		sampleTime += TicksPerSecond / 100;
+	}
+
+	return CompareUnsigned(test.Oscillating, 0, "Step");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestOscillationDetector()
+{
+	InvokeTest(OscDetect);
+	InvokeTest(OscIgnore);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Watches a cam angle error for sustained oscillation, which is the sign of
+// gains that are too high or of a phaser that sticks and then jumps.
+//
+// Each time the error crosses from negative to positive (outside a small
+// noise band) one cycle ends. A cycle counts toward an oscillation if its
+// peak error reaches OSCILLATION_MIN_AMPLITUDE and its period is close to
+// that of the previous cycle. After SustainedCycles such cycles in a row,
+// the detector reports an oscillation and, unless OSCILLATION_BACKOFF is 1,
+// reduces GainScale, which the controller applies to the feedback gains.
+///////////////////////////////////////////////////////////////////////////////
+class OscillationDetector
+{
+public:
+	static const unsigned SustainedCycles = 4;
+
+	int Oscillating;
+	unsigned Cycles;
+	unsigned Detections;
+
+	// Peak error (degrees) and frequency (Hz) of the last complete cycle.
+	float Amplitude;
+	float Frequency;
+
+	// Multiplier for the feedback gains, reduced by each detection.
+	float GainScale;
+
+	OscillationDetector();
+
+	// Forget the history, and restore the gains.
+	void Reset();
+
+	// Invoke with each new error sample. Repeated samples are ignored.
+	void Update(unsigned sampleTime, float error);
+
+private:
+	unsigned lastTime;
+	unsigned lastCrossing;
+	bool haveCrossing;
+	int sign;
+	float peak;
+	float lastPeriod;
+
+	void EndCycle(unsigned sampleTime);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestOscillationDetector();
+
+extern OscillationDetector LeftOscillation;
+extern OscillationDetector RightOscillation;
@@ -0,0 +1,670 @@
+///////////////////////////////////////////////////////////////////////////////
+// Startup classifier for the cam and crank trigger patterns.
+//
+// Exhaust cams have two evenly spaced pulses per revolution. Intake cams have
+// two short intervals followed by one long interval (the "3-1" pattern), so
+// roughly one interval in three is much longer than the one before it.
+//
+// The crank signal comes from one or more marks on a cam pulley. The number
+// of marks is found by counting crank pulses against a classified cam input,
+// and the marks must have distinct widths so that CrankState can tell them
+// apart. Mark zero is the widest mark.
+///////////////////////////////////////////////////////////////////////////////
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include "Globals.h"
+#include "PatternDetector.h"
+#include "CrankState.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+class PatternDetector : public IPatternDetector
+{
+private:
+	// Enough for the cam pulses seen during the crank samples, even with
+	// the intake pattern and a single crank mark.
+	static const unsigned CamSampleCount = 256;
+	static const unsigned CrankSampleCount = 64;
+
+	// Classification needs at least this many intervals on an input.
+	static const unsigned MinimumSamples = 12;
+
+	// The first interval on each input is measured from timer start-up.
+	static const unsigned SkipSamples = 2;
+
+	// The recorded edges are only needed until Apply, so they are allocated
+	// by Initialize and released once the patterns are known.
+	struct Recording
+	{
+		unsigned intervals[PatternInputCount][CamSampleCount];
+		unsigned crankWidths[CrankSampleCount];
+	};
+
+	Recording *recording;
+	unsigned sampleCounts[PatternInputCount];
+
+	// Pulses on each input since the first crank pulse.
+	unsigned edgeCounts[PatternInputCount];
+
+	int detected[PatternInputCount];
+	int decoders[PatternInputCount];
+	unsigned crankMarkCount;
+	int complete;
+	int applied;
+	char summary[DisplayWidth + 1];
+
+	static int GetDefaultPattern(int input)
+	{
+		switch (input)
+		{
+		case LeftCamInput:
+		case RightCamInput:
+			return TwoPulse;
+
+		case LeftIntakeCamInput:
+		case RightIntakeCamInput:
+			return ThreeMinusOne;
+		}
+
+		return CrankMarks;
+	}
+
+	static unsigned GetPulsesPerRevolution(int pattern)
+	{
+		switch (pattern)
+		{
+		case TwoPulse:
+			return 2;
+
+		case ThreeMinusOne:
+			return 3;
+		}
+
+		return 0;
+	}
+
+	// Two intervals match if they are within 20% of each other.
+	static int Similar(unsigned a, unsigned b)
+	{
+		return (a * 5 <= b * 6) && (b * 5 <= a * 6);
+	}
+
+	static const char* GetPatternCode(int pattern)
+	{
+		switch (pattern)
+		{
+		case NoSignal:
+			return "--";
+
+		case TwoPulse:
+			return "Ex";
+
+		case ThreeMinusOne:
+			return "In";
+		}
+
+		return "??";
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Classify a series of cam intervals by counting the intervals that are
+	// at least 50% longer than the interval before them.
+	///////////////////////////////////////////////////////////////////////////
+	int ClassifyCam(int input)
+	{
+		unsigned count = sampleCounts[input];
+		if (count == 0)
+		{
+			return NoSignal;
+		}
+
+		if (count < MinimumSamples + SkipSamples)
+		{
+			return UnknownPattern;
+		}
+
+		unsigned *samples = recording->intervals[input];
+		unsigned compared = 0;
+		unsigned rises = 0;
+		for (unsigned i = SkipSamples + 1; i < count; i++)
+		{
+			compared++;
+			if (samples[i] * 2 > samples[i - 1] * 3)
+			{
+				rises++;
+			}
+		}
+
+		// Evenly spaced pulses should almost never rise that much.
+		if (rises * 20 < compared)
+		{
+			return TwoPulse;
+		}
+
+		// One long interval in three, give or take a few glitches.
+		if ((rises * 4 >= compared) && (rises * 12 <= compared * 5))
+		{
+			return ThreeMinusOne;
+		}
+
+		return UnknownPattern;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Find the shortest period over which the crank pulse widths repeat.
+	///////////////////////////////////////////////////////////////////////////
+	unsigned GetCrankWidthPeriod()
+	{
+		for (unsigned period = 1; period <= CrankState::MaxMarks; period++)
+		{
+			unsigned i;
+			for (i = SkipSamples + period; i < CrankSampleCount; i++)
+			{
+				if (!Similar(recording->crankWidths[i], recording->crankWidths[i - period]))
+				{
+					break;
+				}
+			}
+
+			if (i == CrankSampleCount)
+			{
+				return period;
+			}
+		}
+
+		return 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Determine the number of crank marks, or zero if it cannot be determined.
+	///////////////////////////////////////////////////////////////////////////
+	unsigned ClassifyCrank()
+	{
+		unsigned widthPeriod = GetCrankWidthPeriod();
+
+		// Use the first cam input with a known pattern as the reference.
+		for (int input = LeftCamInput; input < CrankInput; input++)
+		{
+			unsigned pulsesPerRevolution = GetPulsesPerRevolution(detected[input]);
+			if ((pulsesPerRevolution == 0) || (edgeCounts[input] == 0))
+			{
+				continue;
+			}
+
+			unsigned crankPulses = edgeCounts[CrankInput] * pulsesPerRevolution;
+			unsigned marks = (crankPulses + (edgeCounts[input] / 2)) / edgeCounts[input];
+
+			// Marks that cannot be told apart by width are not usable.
+			if ((marks > 1) && (marks != widthPeriod))
+			{
+				return 0;
+			}
+
+			return (marks <= CrankState::MaxMarks) ? marks : 0;
+		}
+
+		// Without a cam reference, equally spaced identical marks would look
+		// like a single mark, but that's the best guess available.
+		return widthPeriod;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Measure the mark angles and widths, in cam degrees, and configure the
+	// crank decoder to match.
+	///////////////////////////////////////////////////////////////////////////
+	void ConfigureCrank()
+	{
+		float intervalSums[CrankState::MaxMarks];
+		float widthSums[CrankState::MaxMarks];
+		for (unsigned mark = 0; mark < crankMarkCount; mark++)
+		{
+			intervalSums[mark] = 0;
+			widthSums[mark] = 0;
+		}
+
+		for (unsigned i = SkipSamples; i < CrankSampleCount; i++)
+		{
+			intervalSums[i % crankMarkCount] += recording->intervals[CrankInput][i];
+			widthSums[i % crankMarkCount] += recording->crankWidths[i];
+		}
+
+		float revolution = 0;
+		unsigned widest = 0;
+		for (unsigned mark = 0; mark < crankMarkCount; mark++)
+		{
+			revolution += intervalSums[mark];
+			if (widthSums[mark] > widthSums[widest])
+			{
+				widest = mark;
+			}
+		}
+
+		// The interval recorded with each pulse is the time since the previous
+		// mark, so the angles accumulate from the widest mark onward.
+		float angles[CrankState::MaxMarks];
+		float widths[CrankState::MaxMarks];
+		float angle = 0;
+		for (unsigned mark = 0; mark < crankMarkCount; mark++)
+		{
+			unsigned phase = (widest + mark) % crankMarkCount;
+			if (mark > 0)
+			{
+				angle += intervalSums[phase] * 360.0f / revolution;
+			}
+
+			angles[mark] = angle;
+			widths[mark] = widthSums[phase] * 360.0f / revolution;
+		}
+
+		HoldEdges();
+		Crank.Configure(crankMarkCount, angles, widths);
+		ReleaseEdges();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Choose the decoders for a pair of inputs on the same bank. Both inputs
+	// feed the same pair of decoders, so they cannot use the same one.
+	///////////////////////////////////////////////////////////////////////////
+	void SelectDecoders(int camInput, int intakeCamInput)
+	{
+		int cam = detected[camInput];
+		int intakeCam = detected[intakeCamInput];
+
+		if (GetPulsesPerRevolution(cam) != 0)
+		{
+			decoders[camInput] = cam;
+		}
+
+		if (GetPulsesPerRevolution(intakeCam) != 0)
+		{
+			decoders[intakeCamInput] = intakeCam;
+		}
+
+		if (decoders[camInput] == decoders[intakeCamInput])
+		{
+			decoders[camInput] = GetDefaultPattern(camInput);
+			decoders[intakeCamInput] = GetDefaultPattern(intakeCamInput);
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// The edge handlers read the decoders and the crank marks, so they are
+	// held off while the main loop changes them.
+	///////////////////////////////////////////////////////////////////////////
+	static void HoldEdges()
+	{
+#ifdef ARDUINO
+		noInterrupts();
+#endif
+	}
+
+	static void ReleaseEdges()
+	{
+#ifdef ARDUINO
+		interrupts();
+#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Once detection is complete the edge handlers no longer record, so the
+	// buffers can go.
+	///////////////////////////////////////////////////////////////////////////
+	void ReleaseRecording()
+	{
+		complete = 1;
+		delete recording;
+		recording = NULL;
+	}
+
+	void UpdateSummary()
+	{
+		snprintf(
+			summary,
+			sizeof(summary),
+			"Cal %s%s C%c %s%s",
+			GetPatternCode(detected[LeftCamInput]),
+			GetPatternCode(detected[LeftIntakeCamInput]),
+			crankMarkCount ? (char)('0' + crankMarkCount) : '?',
+			GetPatternCode(detected[RightCamInput]),
+			GetPatternCode(detected[RightIntakeCamInput]));
+	}
+
+public:
+	PatternDetector()
+	{
+		recording = NULL;
+		Initialize();
+	}
+
+	virtual void Initialize()
+	{
+		if (recording == NULL)
+		{
+			recording = new Recording();
+		}
+
+		for (int input = 0; input < PatternInputCount; input++)
+		{
+			sampleCounts[input] = 0;
+			edgeCounts[input] = 0;
+			detected[input] = UnknownPattern;
+			decoders[input] = GetDefaultPattern(input);
+		}
+
+		crankMarkCount = 0;
+		complete = 0;
+		applied = 0;
+		strncpy(summary, "Calibrating", sizeof(summary));
+	}
+
+	virtual void BeginPulse(int input, unsigned interval)
+	{
+		if (complete)
+		{
+			return;
+		}
+
+		// Pulses are only counted once the crank signal is present, so that
+		// the cam and crank counts cover the same span of time.
+		if ((input == CrankInput) || (sampleCounts[CrankInput] > 0))
+		{
+			edgeCounts[input]++;
+		}
+
+		unsigned capacity = (input == CrankInput) ? CrankSampleCount : CamSampleCount;
+		if (sampleCounts[input] < capacity)
+		{
+			recording->intervals[input][sampleCounts[input]] = interval;
+			sampleCounts[input]++;
+		}
+	}
+
+	virtual void EndPulse(int input, unsigned duration)
+	{
+		if (complete || (input != CrankInput) || (sampleCounts[CrankInput] == 0))
+		{
+			return;
+		}
+
+		recording->crankWidths[sampleCounts[CrankInput] - 1] = duration;
+
+		if (sampleCounts[CrankInput] == CrankSampleCount)
+		{
+			complete = 1;
+		}
+	}
+
+	virtual int IsComplete()
+	{
+		return complete;
+	}
+
+	virtual void Apply()
+	{
+		for (int input = LeftCamInput; input < CrankInput; input++)
+		{
+			detected[input] = ClassifyCam(input);
+		}
+
+		HoldEdges();
+		SelectDecoders(LeftCamInput, LeftIntakeCamInput);
+		SelectDecoders(RightCamInput, RightIntakeCamInput);
+		ReleaseEdges();
+
+		crankMarkCount = ClassifyCrank();
+		if (crankMarkCount != 0)
+		{
+			detected[CrankInput] = CrankMarks;
+			ConfigureCrank();
+		}
+
+		ReleaseRecording();
+		UpdateSummary();
+		applied = 1;
+	}
+
+	virtual int IsApplied()
+	{
+		return applied;
+	}
+
+	virtual void UseDefaults()
+	{
+		HoldEdges();
+		for (int input = 0; input < PatternInputCount; input++)
+		{
+			detected[input] = GetDefaultPattern(input);
+			decoders[input] = detected[input];
+		}
+		ReleaseEdges();
+
+		crankMarkCount = Crank.MarkCount;
+		ReleaseRecording();
+		applied = 1;
+		UpdateSummary();
+	}
+
+	virtual int GetPattern(int input)
+	{
+		return decoders[input];
+	}
+
+	virtual int GetDetectedPattern(int input)
+	{
+		return detected[input];
+	}
+
+	virtual unsigned GetCrankMarkCount()
+	{
+		return crankMarkCount;
+	}
+
+	virtual char* GetSummary()
+	{
+		return summary;
+	}
+};
+
+static IPatternDetector *instance;
+
+///////////////////////////////////////////////////////////////////////////////
+// Factory method
+///////////////////////////////////////////////////////////////////////////////
+IPatternDetector* IPatternDetector::GetInstance()
+{
+	if (instance == NULL)
+	{
+		instance = new PatternDetector();
+	}
+
+	return instance;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// The recording buffers are large, so the tests use the live instance. The
+// self-tests run before the edge handlers are attached, and the interrupt
+// handler setup initializes it again afterwards.
+///////////////////////////////////////////////////////////////////////////////
+PatternDetector* GetPatternDetectorForTesting()
+{
+	PatternDetector *detector = (PatternDetector*)IPatternDetector::GetInstance();
+	detector->Initialize();
+	return detector;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulate one cam revolution. Intervals are in ticks, a revolution is 3600
+// ticks. Pulses on each input are interleaved roughly as they would be on
+// a running engine.
+///////////////////////////////////////////////////////////////////////////////
+void SimulatePatternRevolution(PatternDetector *detector, int camPattern, int intakeCamPattern, unsigned marks)
+{
+	const unsigned ticksPerRevolution = 3600;
+
+	for (unsigned mark = 0; mark < marks; mark++)
+	{
+		// Mark zero is twice as wide as the others.
+		detector->BeginPulse(CrankInput, ticksPerRevolution / marks);
+		detector->EndPulse(CrankInput, mark == 0 ? 200 : 100);
+	}
+
+	int inputs[] = { LeftCamInput, LeftIntakeCamInput };
+	int patterns[] = { camPattern, intakeCamPattern };
+	for (int i = 0; i < 2; i++)
+	{
+		if (patterns[i] == TwoPulse)
+		{
+			detector->BeginPulse(inputs[i], 1790);
+			detector->BeginPulse(inputs[i], 1810);
+		}
+		else if (patterns[i] == ThreeMinusOne)
+		{
+			detector->BeginPulse(inputs[i], 900);
+			detector->BeginPulse(inputs[i], 900);
+			detector->BeginPulse(inputs[i], 1800);
+		}
+	}
+
+	// The right exhaust cam is always present.
+	detector->BeginPulse(RightCamInput, 1800);
+	detector->BeginPulse(RightCamInput, 1800);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulate revolutions until detection completes, then apply the results.
+///////////////////////////////////////////////////////////////////////////////
+bool RunPatternDetection(PatternDetector *detector, int camPattern, int intakeCamPattern, unsigned marks)
+{
+	for (int i = 0; (i < 1000) && !detector->IsComplete(); i++)
+	{
+		SimulatePatternRevolution(detector, camPattern, intakeCamPattern, marks);
+	}
+
+	if (!CompareUnsigned(detector->IsComplete(), 1, "Complete"))
+	{
+		return false;
+	}
+
+	detector->Apply();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Put the global crank state back to the configured marks.
+///////////////////////////////////////////////////////////////////////////////
+void RestoreCrankConfiguration()
+{
+	float angles[] = CRANK_MARK_ANGLES;
+	float widths[] = CRANK_MARK_WIDTHS;
+	Crank.Configure(CRANK_MARK_COUNT, angles, widths);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Exhaust and intake cams on their default inputs, single crank mark.
+///////////////////////////////////////////////////////////////////////////////
+bool TestPatternDefault()
+{
+	PatternDetector *detector = GetPatternDetectorForTesting();
+	bool result = RunPatternDetection(detector, TwoPulse, ThreeMinusOne, 1);
+	RestoreCrankConfiguration();
+	if (!result)
+	{
+		return false;
+	}
+
+	if (!CompareUnsigned(detector->GetDetectedPattern(LeftCamInput), TwoPulse, "LeftCam") ||
+		!CompareUnsigned(detector->GetDetectedPattern(LeftIntakeCamInput), ThreeMinusOne, "LeftInt") ||
+		!CompareUnsigned(detector->GetDetectedPattern(RightCamInput), TwoPulse, "RightCam") ||
+		!CompareUnsigned(detector->GetDetectedPattern(RightIntakeCamInput), NoSignal, "RightInt") ||
+		!CompareUnsigned(detector->GetCrankMarkCount(), 1, "Marks"))
+	{
+		return false;
+	}
+
+	// No signal on the right intake input, so it keeps its default decoder.
+	if (!CompareUnsigned(detector->GetPattern(RightIntakeCamInput), ThreeMinusOne, "RightDec"))
+	{
+		return false;
+	}
+
+	if (strcmp(detector->GetSummary(), "Cal ExIn C1 Ex--") != 0)
+	{
+		TestFailed(detector->GetSummary());
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Exhaust and intake sensors wired to each other's inputs.
+///////////////////////////////////////////////////////////////////////////////
+bool TestPatternSwapped()
+{
+	PatternDetector *detector = GetPatternDetectorForTesting();
+	bool result = RunPatternDetection(detector, ThreeMinusOne, TwoPulse, 1);
+	RestoreCrankConfiguration();
+	if (!result)
+	{
+		return false;
+	}
+
+	if (!CompareUnsigned(detector->GetPattern(LeftCamInput), ThreeMinusOne, "LeftCam") ||
+		!CompareUnsigned(detector->GetPattern(LeftIntakeCamInput), TwoPulse, "LeftInt"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Two crank marks of different widths, 180 degrees apart.
+///////////////////////////////////////////////////////////////////////////////
+bool TestPatternCrank2()
+{
+	PatternDetector *detector = GetPatternDetectorForTesting();
+	if (!RunPatternDetection(detector, TwoPulse, NoSignal, 2))
+	{
+		RestoreCrankConfiguration();
+		return false;
+	}
+
+	unsigned markCount = Crank.MarkCount;
+	float angle = Crank.MarkAngles[1];
+	float width = Crank.MarkWidths[0];
+	RestoreCrankConfiguration();
+
+	if (!CompareUnsigned(detector->GetCrankMarkCount(), 2, "Detected") ||
+		!CompareUnsigned(markCount, 2, "Configured") ||
+		!WithinOnePercent(angle, 180.0f, "Angle") ||
+		!WithinOnePercent(width, 20.0f, "Width"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestPatternDetector()
+{
+	InvokeTest(PatternDefault);
+	InvokeTest(PatternSwapped);
+	InvokeTest(PatternCrank2);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Identifies the trigger pattern on each sensor input at startup.
+//
+// The first edges on each input are recorded (from the interrupt handlers)
+// and then classified. Cam inputs can carry the exhaust two-pulse pattern or
+// the intake three-minus-one pattern, and the interrupt handlers send each
+// input's edges to the matching decoder. The crank input is classified by
+// the number of marks on the pulley, and CrankState is configured to match.
+///////////////////////////////////////////////////////////////////////////////
+
+// The sensor inputs. The names reflect the default role of each pin.
+enum PatternInputs
+{
+	LeftCamInput = 0,
+	RightCamInput,
+	LeftIntakeCamInput,
+	RightIntakeCamInput,
+	CrankInput,
+
+	PatternInputCount,
+};
+
+enum TriggerPatterns
+{
+	NoSignal = 0,
+	UnknownPattern,
+	TwoPulse,
+	ThreeMinusOne,
+	CrankMarks,
+};
+
+class IPatternDetector
+{
+public:
+	static IPatternDetector* GetInstance();
+
+	virtual void Initialize() = 0;
+
+	// To be invoked by the interrupt handlers.
+	virtual void BeginPulse(int input, unsigned interval) = 0;
+	virtual void EndPulse(int input, unsigned duration) = 0;
+
+	// Indicates that enough crank revolutions have been recorded.
+	virtual int IsComplete() = 0;
+
+	// Classify the recorded edges and configure the decoders to match.
+	virtual void Apply() = 0;
+	virtual int IsApplied() = 0;
+
+	// Skip detection and use the patterns from Configuration.h.
+	virtual void UseDefaults() = 0;
+
+	// Pattern currently used to decode the given input.
+	virtual int GetPattern(int input) = 0;
+
+	// Pattern found on the given input by the last call to Apply.
+	virtual int GetDetectedPattern(int input) = 0;
+
+	// Number of crank marks detected, or zero if not known.
+	virtual unsigned GetCrankMarkCount() = 0;
+
+	// 16-character description of the detected patterns, for the LCD.
+	virtual char* GetSummary() = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestPatternDetector();
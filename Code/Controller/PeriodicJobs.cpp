@@ -12,6 +12,7 @@ extern LiquidCrystal lcd;
 #include "Utilities.h"
 #include "SelfTest.h"
 #include "Terminal.h"
+#include "LatencyHistogram.h"
 
 static unsigned iterationCounter;
 
@@ -51,6 +52,9 @@ public:
 		IterationsPerSecond = iterationCounter * 10;
 		iterationCounter = 0;
 
+		LeftLatency.Summarize();
+		RightLatency.Summarize();
+
 		// Updating a line on the LCD takes roughly 5 milliseconds of background processing
 		lcd.setCursor(0, 0);
 		lcd.print(DisplayLine1);
@@ -0,0 +1,331 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include <string.h>
+#include "Globals.h"
+#include "ExhaustCamState.h"
+#include "CrankState.h"
+#include "PlausibilityMonitor.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+PlausibilityMonitor Plausibility;
+
+static const char *FaultNames[PlausibilityMonitor::FaultCount] =
+{
+	"Left Cam RPM",
+	"Right Cam RPM",
+	"Left Angle Rate",
+	"Right Angle Rate",
+	"Crank Mark Sync",
+};
+
+PlausibilityMonitor::PlausibilityMonitor()
+{
+	Debounce = PLAUSIBILITY_DEBOUNCE;
+	MaxRpmDifference = PLAUSIBLE_RPM_DIFFERENCE;
+	MaxAngleRate = PLAUSIBLE_ANGLE_RATE;
+	Reset();
+}
+
+void PlausibilityMonitor::Reset()
+{
+	ActiveFaults = 0;
+	StoredFaults = 0;
+	FaultEvents = 0;
+	FailedChecks = 0;
+	lastMarkErrors = 0;
+
+	for (unsigned i = 0; i < FaultCount; i++)
+	{
+		counts[i] = 0;
+	}
+
+	for (int bank = 0; bank < 2; bank++)
+	{
+		lastSampleTime[bank] = 0;
+		lastAngle[bank] = 0;
+	}
+}
+
+unsigned PlausibilityMonitor::Update(const CrankSnapshot &crank, const ExhaustCamSnapshot &left, const ExhaustCamSnapshot &right)
+{
+	unsigned faults = 0;
+
+	if (left.SampleTime != lastSampleTime[0])
+	{
+		faults |= CheckBank(0, crank, left);
+
+		// The crank decoder recovers from a mark error by itself, so the
+		// errors are weighed against the steady rate of left cam samples.
+		faults |= Check(CrankMarkFault, crank.MarkErrors != lastMarkErrors);
+		lastMarkErrors = crank.MarkErrors;
+	}
+
+	if (right.SampleTime != lastSampleTime[1])
+	{
+		faults |= CheckBank(1, crank, right);
+	}
+
+	return faults;
+}
+
+const char *PlausibilityMonitor::GetFaultName(unsigned faults)
+{
+	for (unsigned i = 0; i < FaultCount; i++)
+	{
+		if (faults & (1 << i))
+		{
+			return FaultNames[i];
+		}
+	}
+
+	return "None";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The cams report engine RPM from their own pulse trains, so each should
+// agree with the crank. A wrong crank mark or a noisy cam edge makes the
+// angle jump further than the phaser can move between samples.
+///////////////////////////////////////////////////////////////////////////////
+unsigned PlausibilityMonitor::CheckBank(int bank, const CrankSnapshot &crank, const ExhaustCamSnapshot &cam)
+{
+	float difference = (float)cam.Rpm - (float)crank.Rpm;
+	if (difference < 0)
+	{
+		difference = -difference;
+	}
+
+	bool rpmFailed = (crank.Rpm > 0) && (difference > (crank.Rpm * MaxRpmDifference));
+	unsigned faults = Check(bank == 0 ? LeftRpmFault : RightRpmFault, rpmFailed);
+
+	// The first sample has nothing to compare with.
+	bool rateFailed = false;
+	if (lastSampleTime[bank] != 0)
+	{
+		// Unsigned subtraction handles timer wraparound.
+		float time = ((float)(cam.SampleTime - lastSampleTime[bank])) / ((float)TicksPerSecond);
+		float change = cam.Angle - lastAngle[bank];
+		if (change < 0)
+		{
+			change = -change;
+		}
+
+		rateFailed = change > (MaxAngleRate * time);
+	}
+
+	faults |= Check(bank == 0 ? LeftAngleRateFault : RightAngleRateFault, rateFailed);
+
+	lastSampleTime[bank] = cam.SampleTime;
+	lastAngle[bank] = cam.Angle;
+	return faults;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Count one check, and return the fault if this check set it. The count is
+// capped so that a long run of failures does not take as long to clear.
+///////////////////////////////////////////////////////////////////////////////
+unsigned PlausibilityMonitor::Check(unsigned fault, bool failed)
+{
+	unsigned index = 0;
+	while ((1u << index) != fault)
+	{
+		index++;
+	}
+
+	if (failed)
+	{
+		FailedChecks++;
+		if (counts[index] < (Debounce * 2))
+		{
+			counts[index]++;
+		}
+	}
+	else if (counts[index] > 0)
+	{
+		counts[index]--;
+	}
+
+	if (!(ActiveFaults & fault) && (counts[index] >= Debounce))
+	{
+		ActiveFaults |= fault;
+		StoredFaults |= fault;
+		FaultEvents++;
+		return fault;
+	}
+
+	if ((ActiveFaults & fault) && (counts[index] == 0))
+	{
+		ActiveFaults &= ~fault;
+	}
+
+	return 0;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Snapshots for a steady engine at 3000 RPM, with a new cam sample every
+// 20ms.
+///////////////////////////////////////////////////////////////////////////////
+static void InitializeSnapshots(CrankSnapshot *crank, ExhaustCamSnapshot *left, ExhaustCamSnapshot *right)
+{
+	memset(crank, 0, sizeof(*crank));
+	memset(left, 0, sizeof(*left));
+	memset(right, 0, sizeof(*right));
+	crank->Rpm = 3000;
+	left->Rpm = 3000;
+	right->Rpm = 3000;
+}
+
+static void NextSample(ExhaustCamSnapshot *left, ExhaustCamSnapshot *right)
+{
+	left->SampleTime += 20000;
+	right->SampleTime += 20000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A single bad RPM sample is ignored, a run of them sets the fault, and the
+// fault clears after the RPMs agree again.
+///////////////////////////////////////////////////////////////////////////////
+bool TestPlausibleRpm()
+{
+	PlausibilityMonitor test;
+	test.Debounce = 5;
+	CrankSnapshot crank;
+	ExhaustCamSnapshot left, right;
+	InitializeSnapshots(&crank, &left, &right);
+
+	unsigned faults = 0;
+	for (int i = 0; i < 10; i++)
+	{
+		NextSample(&left, &right);
+		left.Rpm = (i == 5) ? 4000 : 3000;
+		faults |= test.Update(crank, left, right);
+	}
+
+	if (!CompareUnsigned(faults, 0, "Glitch"))
+	{
+		return false;
+	}
+
+	left.Rpm = 4000;
+	for (int i = 0; i < 5; i++)
+	{
+		NextSample(&left, &right);
+		faults |= test.Update(crank, left, right);
+	}
+
+	if (!CompareUnsigned(faults, PlausibilityMonitor::LeftRpmFault, "Set") ||
+		!CompareUnsigned(test.ActiveFaults, PlausibilityMonitor::LeftRpmFault, "Active"))
+	{
+		return false;
+	}
+
+	left.Rpm = 3000;
+	for (int i = 0; i < 5; i++)
+	{
+		NextSample(&left, &right);
+		test.Update(crank, left, right);
+	}
+
+	return
+		CompareUnsigned(test.ActiveFaults, 0, "Cleared") &&
+		CompareUnsigned(test.StoredFaults, PlausibilityMonitor::LeftRpmFault, "Stored") &&
+		CompareUnsigned(test.FaultEvents, 1, "Events");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A steady phaser movement passes, while an angle that jumps back and forth
+// between two marks sets the fault.
+///////////////////////////////////////////////////////////////////////////////
+bool TestPlausibleAngle()
+{
+	PlausibilityMonitor test;
+	test.Debounce = 5;
+	test.MaxAngleRate = 500.0f;
+	CrankSnapshot crank;
+	ExhaustCamSnapshot left, right;
+	InitializeSnapshots(&crank, &left, &right);
+
+	// 2 degrees per 20ms sample is 100 degrees per second.
+	unsigned faults = 0;
+	for (int i = 0; i < 20; i++)
+	{
+		NextSample(&left, &right);
+		right.Angle = i * 2.0f;
+		faults |= test.Update(crank, left, right);
+	}
+
+	if (!CompareUnsigned(faults, 0, "Moving"))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < 10; i++)
+	{
+		NextSample(&left, &right);
+		right.Angle = (i & 1) ? 90.0f : 0;
+		faults |= test.Update(crank, left, right);
+	}
+
+	return
+		CompareUnsigned(faults, PlausibilityMonitor::RightAngleRateFault, "Jumping") &&
+		CompareStrings("Right Angle Rate", (char*)PlausibilityMonitor::GetFaultName(faults));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Occasional mark errors are tolerated, frequent ones are not.
+///////////////////////////////////////////////////////////////////////////////
+bool TestPlausibleMark()
+{
+	PlausibilityMonitor test;
+	test.Debounce = 5;
+	CrankSnapshot crank;
+	ExhaustCamSnapshot left, right;
+	InitializeSnapshots(&crank, &left, &right);
+
+	unsigned faults = 0;
+	for (int i = 0; i < 50; i++)
+	{
+		NextSample(&left, &right);
+		if ((i % 10) == 0)
+		{
+			crank.MarkErrors++;
+		}
+
+		faults |= test.Update(crank, left, right);
+	}
+
+	if (!CompareUnsigned(faults, 0, "Occasional"))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < 10; i++)
+	{
+		NextSample(&left, &right);
+		crank.MarkErrors++;
+		faults |= test.Update(crank, left, right);
+	}
+
+	return CompareUnsigned(faults, PlausibilityMonitor::CrankMarkFault, "Frequent");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestPlausibilityMonitor()
+{
+	InvokeTest(PlausibleRpm);
+	InvokeTest(PlausibleAngle);
+	InvokeTest(PlausibleMark);
+}
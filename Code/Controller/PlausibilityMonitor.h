@@ -0,0 +1,68 @@
+#pragma once
+
+struct CrankSnapshot;
+struct ExhaustCamSnapshot;
+
+///////////////////////////////////////////////////////////////////////////////
+// Checks the crank and exhaust cam decoders against each other and against
+// physical limits, and turns repeated failures into fault codes.
+//
+// Each check runs once per new cam sample. A failed check adds one to its
+// count and a passed check takes one away, so a fault is only set after a
+// run of failures, and a single bad sample does not force recalibration.
+// The fault clears again once the count drains to zero.
+///////////////////////////////////////////////////////////////////////////////
+class PlausibilityMonitor
+{
+public:
+	// Fault codes, one bit each, so that sets of them fit in one value.
+	static const unsigned LeftRpmFault = 1;
+	static const unsigned RightRpmFault = 2;
+	static const unsigned LeftAngleRateFault = 4;
+	static const unsigned RightAngleRateFault = 8;
+	static const unsigned CrankMarkFault = 16;
+	static const unsigned FaultCount = 5;
+
+	// Faults that are set now, and every fault that has been set since the
+	// last Reset.
+	unsigned ActiveFaults;
+	unsigned StoredFaults;
+
+	// Number of times a fault was set, and number of failed checks.
+	unsigned FaultEvents;
+	unsigned FailedChecks;
+
+	// Check counts needed to set a fault.
+	unsigned Debounce;
+
+	// Largest cam RPM difference from the crank RPM, as a fraction of the
+	// crank RPM, and the fastest believable cam movement, degrees/second.
+	float MaxRpmDifference;
+	float MaxAngleRate;
+
+	PlausibilityMonitor();
+	void Reset();
+
+	// Run the checks for any new samples in these snapshots. Returns the
+	// faults that were set by this update.
+	unsigned Update(const CrankSnapshot &crank, const ExhaustCamSnapshot &left, const ExhaustCamSnapshot &right);
+
+	// Name of the lowest fault in the set, for Mode::Fail and the terminal.
+	static const char *GetFaultName(unsigned faults);
+
+private:
+	unsigned counts[FaultCount];
+	unsigned lastSampleTime[2];
+	float lastAngle[2];
+	unsigned lastMarkErrors;
+
+	unsigned CheckBank(int bank, const CrankSnapshot &crank, const ExhaustCamSnapshot &cam);
+	unsigned Check(unsigned fault, bool failed);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestPlausibilityMonitor();
+
+extern PlausibilityMonitor Plausibility;
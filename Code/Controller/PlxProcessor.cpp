@@ -14,11 +14,12 @@ extern LiquidCrystal lcd;
 #include "Configuration.h"
 #include "Feedback.h"
 #include "Mode.h"
+#include "OilPressureState.h"
 
 extern Mode mode;
 
 const unsigned PlxFluidTempAddress = 2;
-//const unsigned PlxFluidPressureAddress = 3;
+const unsigned PlxFluidPressureAddress = 10;
 const unsigned PlxRpmAddress = 6;
 const unsigned PlxTimingAddress = 11;
 const unsigned PlxDutyAddress = 20;
@@ -98,6 +99,7 @@ void PlxProcessor::ByteReceived(byte b)
 	if ((b & 0x40) != 0)
 	{
 		state = 0;
+		OilPressure.PacketEnded();
 		FillOutputBuffer();
 		SendOutput();
 		ReceivedSensorCount = SensorCount;
@@ -144,6 +146,11 @@ void PlxProcessor::ByteReceived(byte b)
 
 		}
 
+		if ((sensorAddress == PlxFluidPressureAddress) && (sensorInstance == 0))
+		{
+			OilPressure.Received(sensorValue);
+		}
+
 		if ((sensorAddress == PlxRpmAddress) && (sensorInstance == PlxCrankRpmInstance))
 		{
 			ReceivedCrankRpm = sensorValue;
@@ -161,6 +168,7 @@ void PlxProcessor::ByteReceived(byte b)
 
 		if ((sensorAddress != PlxRpmAddress) &&
 			(sensorAddress != PlxFluidTempAddress) &&
+			(sensorAddress != PlxFluidPressureAddress) &&
 			(sensorAddress != 4))
 		{
 			ReceivedFluidPressureAddress = sensorAddress;
@@ -205,20 +213,20 @@ byte* PlxProcessor::FillOutputBuffer()
 
 	if (mode.GetMode() == Mode::Calibrating)
 	{
-		AddSensorBytes(PlxTimingAddress, 0, LeftExhaustCam.Baseline + 64);
-		AddSensorBytes(PlxTimingAddress, 1, RightExhaustCam.Baseline + 64);
+		AddSensorBytes(PlxTimingAddress, 0, LeftExhaustCam.View.Baseline + 64);
+		AddSensorBytes(PlxTimingAddress, 1, RightExhaustCam.View.Baseline + 64);
 	}
 	else
 	{
-		AddSensorBytes(PlxTimingAddress, 0, LeftExhaustCam.Angle + 64);
-		AddSensorBytes(PlxTimingAddress, 1, RightExhaustCam.Angle + 64);
+		AddSensorBytes(PlxTimingAddress, 0, LeftExhaustCam.View.Angle + 64);
+		AddSensorBytes(PlxTimingAddress, 1, RightExhaustCam.View.Angle + 64);
 	}
 
 //	AddSensorBytes(PlxDutyAddress, PlxLeftDutyInstance, LeftFeedback.Output * 10.23);
 //	AddSensorBytes(PlxDutyAddress, PlxRightDutyInstance, RightFeedback.Output * 10.23);
 
-	AddSensorBytes(PlxTimingAddress, PlxLeftDutyInstance, LeftFeedback.Output + 64);
-	AddSensorBytes(PlxTimingAddress, PlxRightDutyInstance, RightFeedback.Output + 64);
+	AddSensorBytes(PlxTimingAddress, PlxLeftDutyInstance, LeftFeedback.View.Output + 64);
+	AddSensorBytes(PlxTimingAddress, PlxRightDutyInstance, RightFeedback.View.Output + 64);
 
 #endif // !SIMULATOR
 
@@ -379,10 +387,42 @@ bool TestSendReceive()
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Decode a fluid pressure reading. 410 counts is just over 80 PSI.
+///////////////////////////////////////////////////////////////////////////////
+bool TestPlxPressure()
+{
+	unsigned expectedPressure = 410;
+
+	byte packet[] =
+	{
+		0x80, // Start of packet
+		0x00, // Pressure Address MSB
+		0x0A, // Pressure Address LSB
+		0x00, // Pressure Instance
+		expectedPressure >> 6, // Pressure Data MSB
+		expectedPressure & 0x3F, // Pressure Data LSB
+		0x40, // End of packet
+	};
+
+	PlxProcessor test;
+	for (int i = 0; i < sizeof(packet); i++)
+	{
+		test.ByteReceived(packet[i]);
+	}
+
+	bool result = CompareUnsigned(OilPressure.DisplayPsi, 80, "Pressure") && OilPressure.Available;
+
+	// Don't leave a fake reading behind.
+	OilPressure = OilPressureState();
+	return result;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Self-test the PLX code
 ///////////////////////////////////////////////////////////////////////////////
 void SelfTestPlxProcessor()
 {
 //	InvokeTest(SendReceive);
+	InvokeTest(PlxPressure);
 }
\ No newline at end of file
@@ -0,0 +1,319 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include <math.h>
+#include "stdafx.h"
+#include "Globals.h"
+#include "RelayAutotuner.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+RelayAutotuner LeftAutotuner;
+RelayAutotuner RightAutotuner;
+RelayAutotuner LeftIntakeAutotuner;
+RelayAutotuner RightIntakeAutotuner;
+
+static const float Pi = 3.14159265f;
+
+RelayAutotuner::RelayAutotuner()
+{
+	CurrentState = Idle;
+	Cycles = 0;
+	Rpm = 0;
+	Target = 0;
+	Amplitude = 0;
+	UltimatePeriod = 0;
+	UltimateGain = 0;
+	bias = 0;
+	gainScale = 1.0f;
+	relayHigh = false;
+	counting = false;
+	lastTime = 0;
+	cycleStart = 0;
+	samples = 0;
+	maxAngle = 0;
+	minAngle = 0;
+	amplitudeSum = 0;
+	periodSum = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The operating point is taken from the first sample after starting.
+///////////////////////////////////////////////////////////////////////////////
+void RelayAutotuner::Start()
+{
+	CurrentState = Starting;
+}
+
+void RelayAutotuner::Cancel()
+{
+	if (IsActive())
+	{
+		CurrentState = Idle;
+	}
+}
+
+float RelayAutotuner::Update(unsigned sampleTime, unsigned rpm, float angle, float target, float output, float gainScale)
+{
+	if (CurrentState == Starting)
+	{
+		Rpm = rpm;
+		Target = target;
+		bias = output;
+		this->gainScale = gainScale;
+		relayHigh = (target - angle) > 0;
+		counting = false;
+		lastTime = sampleTime;
+		samples = 0;
+		Cycles = 0;
+		amplitudeSum = 0;
+		periodSum = 0;
+		CurrentState = Relaying;
+		return relayHigh ? bias + AUTOTUNE_RELAY_AMPLITUDE : bias - AUTOTUNE_RELAY_AMPLITUDE;
+	}
+
+	if (CurrentState != Relaying)
+	{
+		return bias;
+	}
+
+	// The fixed-rate control mode can pass the same sample more than once.
+	if (sampleTime != lastTime)
+	{
+		lastTime = sampleTime;
+		samples++;
+
+		int rpmChange = (int)rpm - (int)Rpm;
+		if ((rpmChange > AUTOTUNE_RPM_TOLERANCE) ||
+			(rpmChange < -AUTOTUNE_RPM_TOLERANCE) ||
+			(fabsf(angle - Target) > AUTOTUNE_MAX_EXCURSION) ||
+			(samples > MaxSamples))
+		{
+			CurrentState = Failed;
+			return bias;
+		}
+
+		if (angle > maxAngle)
+		{
+			maxAngle = angle;
+		}
+
+		if (angle < minAngle)
+		{
+			minAngle = angle;
+		}
+
+		float error = Target - angle;
+		if (relayHigh && (error < -AUTOTUNE_HYSTERESIS))
+		{
+			relayHigh = false;
+		}
+		else if (!relayHigh && (error > AUTOTUNE_HYSTERESIS))
+		{
+			// Each switch to the high output ends one cycle and starts the next.
+			relayHigh = true;
+			if (counting)
+			{
+				Cycles++;
+				if (Cycles > SettleCycles)
+				{
+					amplitudeSum += (maxAngle - minAngle) / 2;
+					periodSum += ((float)(sampleTime - cycleStart)) / ((float)TicksPerSecond);
+				}
+
+				if (Cycles == SettleCycles + MeasureCycles)
+				{
+					Finish();
+					return bias;
+				}
+			}
+
+			counting = true;
+			cycleStart = sampleTime;
+			maxAngle = angle;
+			minAngle = angle;
+		}
+	}
+
+	return relayHigh ? bias + AUTOTUNE_RELAY_AMPLITUDE : bias - AUTOTUNE_RELAY_AMPLITUDE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Describing function of a relay with hysteresis: the ultimate gain is the
+// inverse of the relay's effective gain at the measured amplitude.
+///////////////////////////////////////////////////////////////////////////////
+void RelayAutotuner::Finish()
+{
+	Amplitude = amplitudeSum / MeasureCycles;
+	UltimatePeriod = periodSum / MeasureCycles;
+
+	if (Amplitude <= AUTOTUNE_HYSTERESIS)
+	{
+		CurrentState = Failed;
+		return;
+	}
+
+	float effective = sqrtf((Amplitude * Amplitude) - (AUTOTUNE_HYSTERESIS * AUTOTUNE_HYSTERESIS));
+	UltimateGain = (4 * AUTOTUNE_RELAY_AMPLITUDE) / (Pi * effective);
+	CurrentState = Complete;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Ziegler-Nichols is the most aggressive and will overshoot. Tyreus-Luyben
+// is more conservative and integrates more slowly. The no-overshoot rule
+// keeps Ziegler-Nichols' integral and derivative times with much less gain.
+///////////////////////////////////////////////////////////////////////////////
+bool RelayAutotuner::GetGains(Rule rule, float *proportional, float *integral, float *derivative)
+{
+	if (CurrentState != Complete)
+	{
+		return false;
+	}
+
+	float gain;
+	float integralTime;
+	float derivativeTime;
+	switch (rule)
+	{
+	default:
+	case ZieglerNichols:
+		gain = 0.6f * UltimateGain;
+		integralTime = 0.5f * UltimatePeriod;
+		derivativeTime = 0.125f * UltimatePeriod;
+		break;
+
+	case TyreusLuyben:
+		gain = UltimateGain / 2.2f;
+		integralTime = 2.2f * UltimatePeriod;
+		derivativeTime = UltimatePeriod / 6.3f;
+		break;
+
+	case NoOvershoot:
+		gain = 0.2f * UltimateGain;
+		integralTime = 0.5f * UltimatePeriod;
+		derivativeTime = UltimatePeriod / 3;
+		break;
+	}
+
+	// The experiment measured the loop with the gain scale in effect, and
+	// the feedback loop will apply it again.
+	*proportional = gain / gainScale;
+	*integral = (gain / integralTime) / gainScale;
+	*derivative = (gain * derivativeTime) / gainScale;
+	return true;
+}
+
+const char *RelayAutotuner::GetRuleName(Rule rule)
+{
+	switch (rule)
+	{
+	case ZieglerNichols:
+		return "ZN";
+
+	case TyreusLuyben:
+		return "TL";
+
+	case NoOvershoot:
+		return "NO";
+
+	default:
+		return "??";
+	}
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulate a cam that moves at SOLENOID_REFERENCE_SLOPE degrees per second
+// per unit of output, sampled every 10ms, with each output taking effect
+// one sample later. The RPM changes after the given number of samples.
+///////////////////////////////////////////////////////////////////////////////
+static void SimulateRelay(RelayAutotuner *test, int rpmChangeSample)
+{
+	test->Start();
+
+	unsigned sampleTime = 1000;
+	float angle = 10.0f;
+	float applied = 0;
+	for (int i = 0; (i < 5000) && test->IsActive(); i++)
+	{
+		unsigned rpm = (i < rpmChangeSample) ? 3000 : 3500;
+		float output = test->Update(sampleTime, rpm, angle, 10.0f, 0.0f, 1.0f);
+		angle += applied * SOLENOID_REFERENCE_SLOPE * 0.01f;
+		applied = output;
+		sampleTime += TicksPerSecond / 100;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The cam ramps at a constant rate between the peaks, so the period is
+// four times the amplitude divided by that rate.
+///////////////////////////////////////////////////////////////////////////////
+bool TestAutotuneRelay()
+{
+	RelayAutotuner test;
+	SimulateRelay(&test, 100000);
+
+	if (!CompareUnsigned(test.CurrentState, RelayAutotuner::Complete, "State"))
+	{
+		return false;
+	}
+
+	float rate = AUTOTUNE_RELAY_AMPLITUDE * SOLENOID_REFERENCE_SLOPE;
+	if (!WithinOnePercent(test.UltimatePeriod, (4 * test.Amplitude) / rate, "Period"))
+	{
+		return false;
+	}
+
+	float proportional, integral, derivative;
+	if (!test.GetGains(RelayAutotuner::ZieglerNichols, &proportional, &integral, &derivative))
+	{
+		TestFailed("Gains");
+		return false;
+	}
+
+	return
+		WithinOnePercent(proportional, 0.6f * test.UltimateGain, "P") &&
+		WithinOnePercent(integral, proportional / (0.5f * test.UltimatePeriod), "I") &&
+		WithinOnePercent(derivative, proportional * 0.125f * test.UltimatePeriod, "D");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A change in RPM, or a cam that strays too far, ends the experiment and
+// hands back the steady output.
+///////////////////////////////////////////////////////////////////////////////
+bool TestAutotuneAbort()
+{
+	RelayAutotuner test;
+	SimulateRelay(&test, 20);
+	if (!CompareUnsigned(test.CurrentState, RelayAutotuner::Failed, "Rpm"))
+	{
+		return false;
+	}
+
+	test.Start();
+	test.Update(1000, 3000, 10.0f, 10.0f, 0.5f, 1.0f);
+	float output = test.Update(2000, 3000, 10.0f + AUTOTUNE_MAX_EXCURSION + 1, 10.0f, 0.5f, 1.0f);
+	if (!CompareUnsigned(test.CurrentState, RelayAutotuner::Failed, "Excursion"))
+	{
+		return false;
+	}
+
+	return WithinOnePercent(output, 0.5f, "Output");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestRelayAutotuner()
+{
+	InvokeTest(AutotuneRelay);
+	InvokeTest(AutotuneAbort);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds feedback gains for one cam by a relay experiment, while the engine
+// holds a steady RPM.
+//
+// The output is switched between the steady output plus and minus
+// AUTOTUNE_RELAY_AMPLITUDE whenever the cam crosses the target angle (with
+// AUTOTUNE_HYSTERESIS degrees of hysteresis), which makes the cam oscillate
+// around the target in a limit cycle. The amplitude and period of that
+// cycle give the ultimate gain and period of the loop, and a tuning rule
+// turns those into proposed gains.
+//
+// The experiment fails, and hands the cam back to the feedback loop, if the
+// RPM moves away from where it started, or if the cam strays more than
+// AUTOTUNE_MAX_EXCURSION degrees from the target.
+///////////////////////////////////////////////////////////////////////////////
+class RelayAutotuner
+{
+public:
+	// Cycles to let the oscillation settle, then cycles to measure.
+	static const int SettleCycles = 2;
+	static const int MeasureCycles = 4;
+	static const unsigned MaxSamples = 2000;
+
+	enum State
+	{
+		Idle = 0,
+		Starting,
+		Relaying,
+		Complete,
+		Failed,
+	};
+
+	enum Rule
+	{
+		ZieglerNichols = 0,
+		TyreusLuyben,
+		NoOvershoot,
+		RuleCount,
+	};
+
+	State CurrentState;
+	unsigned Cycles;
+
+	// Operating point at the start of the experiment.
+	unsigned Rpm;
+	float Target;
+
+	// Results: the peak amplitude of the oscillation in degrees, its period
+	// in seconds, and the ultimate gain in output units per degree.
+	float Amplitude;
+	float UltimatePeriod;
+	float UltimateGain;
+
+	RelayAutotuner();
+
+	void Start();
+	void Cancel();
+	bool IsActive() { return (CurrentState == Starting) || (CurrentState == Relaying); }
+
+	// Invoke with each new cam angle sample while active. The output is the
+	// feedback loop's, which is taken as the steady output on the first
+	// call. Returns the output to apply in its place.
+	float Update(unsigned sampleTime, unsigned rpm, float angle, float target, float output, float gainScale);
+
+	// Gains under the given rule, for the schedule (that is, before the
+	// feedback loop's GainScale is applied). Returns false if incomplete.
+	bool GetGains(Rule rule, float *proportional, float *integral, float *derivative);
+
+	static const char *GetRuleName(Rule rule);
+
+private:
+	float bias;
+	float gainScale;
+	bool relayHigh;
+	bool counting;
+	unsigned lastTime;
+	unsigned cycleStart;
+	unsigned samples;
+	float maxAngle;
+	float minAngle;
+	float amplitudeSum;
+	float periodSum;
+
+	void Finish();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestRelayAutotuner();
+
+extern RelayAutotuner LeftAutotuner;
+extern RelayAutotuner RightAutotuner;
+extern RelayAutotuner LeftIntakeAutotuner;
+extern RelayAutotuner RightIntakeAutotuner;
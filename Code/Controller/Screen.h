@@ -293,14 +293,16 @@ private:
 	Screen *_syncScreen;
 	Screen *_warmingScreen;
 	Screen *_runningScreen;
+	Screen *_limpScreen;
 
 public:
-	MainScreen(Mode *mode, Screen *syncScreen, Screen *warmingScreen, Screen *runningScreen)
+	MainScreen(Mode *mode, Screen *syncScreen, Screen *warmingScreen, Screen *runningScreen, Screen *limpScreen)
 	{
 		_mode = mode;
 		_syncScreen = syncScreen;
 		_warmingScreen = warmingScreen;
 		_runningScreen = runningScreen;
+		_limpScreen = limpScreen;
 	}
 
 	void Update()
@@ -326,6 +328,10 @@ public:
 		case Mode::Running:
 			this->_runningScreen->Update();
 			return;
+
+		case Mode::Limp:
+			this->_limpScreen->Update();
+			return;
 		}
 	}
 };
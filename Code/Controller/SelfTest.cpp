@@ -11,11 +11,31 @@ extern LiquidCrystal lcd;
 #include "Utilities.h"
 #include "Mode.h"
 #include "ExhaustCamState.h"
+#include "IntakeCamState.h"
+#include "CrankState.h"
+#include "PatternDetector.h"
+#include "AngleScheduler.h"
+#include "ControlTimer.h"
+#include "LatencyHistogram.h"
+#include "TrivialTimer.h"
+#include "SolenoidOutput.h"
+#include "SolenoidMap.h"
+#include "SolenoidCharacterizer.h"
+#include "SupplyVoltage.h"
+#include "TargetTrajectory.h"
+#include "RelayAutotuner.h"
+#include "OscillationDetector.h"
+#include "BankTargets.h"
+#include "ValveEvents.h"
+#include "PlausibilityMonitor.h"
+#include "OilPressureState.h"
 #include "PlxProcessor.h"
 #include "Feedback.h"
 #include "PeriodicJobs.h"
 #include "RollingAverage.h"
+#include "Snapshot.h"
 #include "CurveTable.h"
+#include "GainSchedule.h"
 
 int anyFailed;
 const int assertDelay = 50;
@@ -40,12 +60,31 @@ void SelfTest()
 	RunSuite(Utilities);
 	RunSuite(Mode);
 	RunSuite(RollingAverage);
-	//RunSuite(IntakeCamTiming);
+	RunSuite(Snapshot);
+	RunSuite(CrankState);
+	RunSuite(PatternDetector);
+	RunSuite(AngleScheduler);
+	RunSuite(ControlTimer);
+	RunSuite(LatencyHistogram);
+	RunSuite(TrivialTimer);
+	RunSuite(SolenoidOutput);
+	RunSuite(SolenoidMap);
+	RunSuite(SolenoidCharacterizer);
+	RunSuite(SupplyVoltage);
+	RunSuite(TargetTrajectory);
+	RunSuite(RelayAutotuner);
+	RunSuite(OscillationDetector);
+	RunSuite(BankTargets);
+	RunSuite(ValveEvents);
+	RunSuite(PlausibilityMonitor);
+	RunSuite(OilPressureState);
+	RunSuite(IntakeCamTiming);
 	RunSuite(ExhaustCamTiming);
 	RunSuite(PlxProcessor);
 	RunSuite(Feedback);
 	RunSuite(PeriodicJobs);
 	RunSuite(CurveTable);
+	RunSuite(GainSchedule);
 	
 #if ARDUINO
 	lcd.clear();
@@ -0,0 +1,81 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include "Snapshot.h"
+#include "SelfTest.h"
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+struct SnapshotTestData
+{
+	unsigned First;
+	unsigned Second;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Published data can be read back, and each write advances the sequence.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSnapshotRead()
+{
+	Snapshot<SnapshotTestData> test;
+	SnapshotTestData data;
+	data.First = 1;
+	data.Second = 2;
+	test.Publish(data);
+
+	SnapshotTestData copy;
+	copy.First = 0;
+	copy.Second = 0;
+	test.Read(&copy);
+
+	return
+		CompareUnsigned(copy.First, 1, "First") &&
+		CompareUnsigned(copy.Second, 2, "Second") &&
+		CompareUnsigned(test.GetSequence(), 2, "Sequence");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A read that overlaps a write fails, and the next one gets the new data.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSnapshotTorn()
+{
+	Snapshot<SnapshotTestData> test;
+	SnapshotTestData copy;
+
+	test.BeginWrite();
+	test.GetData()->First = 3;
+	if (test.TryRead(&copy))
+	{
+		TestFailed("Read during write");
+		return false;
+	}
+
+	test.GetData()->Second = 4;
+	test.EndWrite();
+	if (!test.TryRead(&copy))
+	{
+		TestFailed("Read after write");
+		return false;
+	}
+
+	return
+		CompareUnsigned(copy.First, 3, "First") &&
+		CompareUnsigned(copy.Second, 4, "Second");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSnapshot()
+{
+	InvokeTest(SnapshotRead);
+	InvokeTest(SnapshotTorn);
+}
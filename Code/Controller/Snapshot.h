@@ -0,0 +1,89 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Keeps the compiler from moving memory accesses across this point. The
+// SAM3X has a single core, so this is all the ordering a seqlock needs.
+// The unit tests are single-threaded and need none.
+///////////////////////////////////////////////////////////////////////////////
+#ifdef ARDUINO
+#define SnapshotBarrier() __asm__ __volatile__("" ::: "memory")
+#else
+#define SnapshotBarrier()
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// A copy of some state that one interrupt handler publishes and the main
+// loop reads, without disabling interrupts.
+//
+// The sequence count is odd while a write is in progress. A reader copies
+// the data, and if the count was odd or changed during the copy, an
+// interrupt handler was writing, so the reader tries again. Only one
+// writer is allowed: either a single interrupt handler, or handlers at the
+// same priority, which cannot preempt each other.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class Snapshot
+{
+public:
+	Snapshot()
+	{
+		sequence = 0;
+	}
+
+	void Publish(const T &value)
+	{
+		BeginWrite();
+		data = value;
+		EndWrite();
+	}
+
+	// For writers that fill in the data a piece at a time.
+	void BeginWrite()
+	{
+		sequence++;
+		SnapshotBarrier();
+	}
+
+	void EndWrite()
+	{
+		SnapshotBarrier();
+		sequence++;
+	}
+
+	T *GetData()
+	{
+		return &data;
+	}
+
+	// Returns false if a write was in progress or happened during the copy.
+	bool TryRead(T *value) const
+	{
+		unsigned before = sequence;
+		SnapshotBarrier();
+		*value = data;
+		SnapshotBarrier();
+		return ((before & 1) == 0) && (before == sequence);
+	}
+
+	void Read(T *value) const
+	{
+		while (!TryRead(value))
+		{
+		}
+	}
+
+	// Advances by two with each write.
+	unsigned GetSequence() const
+	{
+		return sequence;
+	}
+
+private:
+	volatile unsigned sequence;
+	T data;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSnapshot();
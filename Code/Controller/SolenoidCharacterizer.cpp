@@ -0,0 +1,226 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "SolenoidMap.h"
+#include "SolenoidCharacterizer.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+SolenoidCharacterizer LeftCharacterizer(&LeftSolenoidMap, CHARACTERIZE_EXHAUST_ANGLE);
+SolenoidCharacterizer RightCharacterizer(&RightSolenoidMap, CHARACTERIZE_EXHAUST_ANGLE);
+SolenoidCharacterizer LeftIntakeCharacterizer(&LeftIntakeSolenoidMap, CHARACTERIZE_INTAKE_ANGLE);
+SolenoidCharacterizer RightIntakeCharacterizer(&RightIntakeSolenoidMap, CHARACTERIZE_INTAKE_ANGLE);
+
+///////////////////////////////////////////////////////////////////////////////
+// Gains for bringing the cam back to the center angle between measurements.
+// The integral absorbs the difference between the map's null duty and the
+// solenoid's real one, and is kept from one step to the next.
+///////////////////////////////////////////////////////////////////////////////
+static const float CenterProportionalGain = 1.0f;
+static const float CenterIntegralGain = 2.5f;
+static const float CenterTolerance = 1.0f;
+
+SolenoidCharacterizer::SolenoidCharacterizer(SolenoidMap *map, float centerAngle)
+{
+	this->map = map;
+	CenterAngle = centerAngle;
+	MaxTravel = 5.0f;
+	FirstDuty = 30.0f;
+	DutyStep = 1.0f;
+	CurrentState = Idle;
+	Step = 0;
+	duty = 0;
+	centerIntegral = 0;
+	lastTime = 0;
+	samples = 0;
+	startTime = 0;
+	startAngle = 0;
+}
+
+void SolenoidCharacterizer::Start()
+{
+	CurrentState = Centering;
+	Step = 0;
+	centerIntegral = 0;
+	lastTime = 0;
+	samples = 0;
+}
+
+void SolenoidCharacterizer::Cancel()
+{
+	if (IsActive())
+	{
+		CurrentState = Idle;
+	}
+}
+
+float SolenoidCharacterizer::Update(unsigned sampleTime, float angle)
+{
+	// The fixed-rate control mode can pass the same sample more than once.
+	if (sampleTime == lastTime)
+	{
+		return duty;
+	}
+
+	if (CurrentState == Centering)
+	{
+		duty = Center(sampleTime, angle);
+		if (samples < SettleSamples)
+		{
+			return duty;
+		}
+
+		Duties[Step] = FirstDuty + (Step * DutyStep);
+		duty = Duties[Step];
+		CurrentState = Measuring;
+		samples = 0;
+		return duty;
+	}
+
+	if (CurrentState != Measuring)
+	{
+		return duty;
+	}
+
+	// The test duty only takes effect at the next solenoid update, so the
+	// first sample after the step is not part of the measurement.
+	samples++;
+	lastTime = sampleTime;
+	if (samples == 1)
+	{
+		startTime = sampleTime;
+		startAngle = angle;
+		return duty;
+	}
+
+	float travel = angle - startAngle;
+	if ((samples < WindowSamples) && (travel < MaxTravel) && (travel > -MaxTravel))
+	{
+		return duty;
+	}
+
+	float time = ((float)(sampleTime - startTime)) / ((float)TicksPerSecond);
+	Rates[Step] = travel / time;
+	Step++;
+	samples = 0;
+
+	if (Step == StepCount)
+	{
+		Finish();
+		return map->GetDuty(0.0f);
+	}
+
+	CurrentState = Centering;
+	return Center(sampleTime, angle);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PI control toward the center angle. Counts consecutive samples within
+// tolerance of it.
+///////////////////////////////////////////////////////////////////////////////
+float SolenoidCharacterizer::Center(unsigned sampleTime, float angle)
+{
+	float error = CenterAngle - angle;
+	if (lastTime != 0)
+	{
+		float time = ((float)(sampleTime - lastTime)) / ((float)TicksPerSecond);
+		centerIntegral += error * time * CenterIntegralGain;
+	}
+
+	lastTime = sampleTime;
+
+	if ((error < CenterTolerance) && (error > -CenterTolerance))
+	{
+		samples++;
+	}
+	else
+	{
+		samples = 0;
+	}
+
+	return map->GetDuty((error * CenterProportionalGain) + centerIntegral);
+}
+
+void SolenoidCharacterizer::Finish()
+{
+	CurrentState = map->Build(Duties, Rates, StepCount) ? Complete : Failed;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Characterise a simulated solenoid whose null point is 3% away from the
+// default, with a 2% dead band.
+///////////////////////////////////////////////////////////////////////////////
+static float SimulatedRate(float duty)
+{
+	if (duty < 46.0f)
+	{
+		return (duty - 46.0f) * SOLENOID_REFERENCE_SLOPE;
+	}
+
+	if (duty > 48.0f)
+	{
+		return (duty - 48.0f) * SOLENOID_REFERENCE_SLOPE * 1.5f;
+	}
+
+	return 0;
+}
+
+bool TestCharacterize()
+{
+	SolenoidMap map;
+	SolenoidCharacterizer test(&map, 20.0f);
+	test.Start();
+
+	// A sample every 10ms. Each duty takes effect one sample later.
+	unsigned sampleTime = 1000;
+	float angle = 15.0f;
+	float applied = map.GetDuty(0.0f);
+	for (int i = 0; (i < 10000) && test.IsActive(); i++)
+	{
+		float duty = test.Update(sampleTime, angle);
+		angle += SimulatedRate(applied) * 0.01f;
+		applied = duty;
+		sampleTime += TicksPerSecond / 100;
+	}
+
+	if (!CompareUnsigned(test.CurrentState, SolenoidCharacterizer::Complete, "State"))
+	{
+		return false;
+	}
+
+	if (!WithinOnePercent(map.NullDuty, 47.0f, "Null") ||
+		!WithinOnePercent(map.SlopeAbove, SOLENOID_REFERENCE_SLOPE * 1.5f, "Above"))
+	{
+		return false;
+	}
+
+	// The same flow request now moves the cam by the same amount on either
+	// side of the dead band.
+	float retard = SimulatedRate(map.GetDuty(-3.0f));
+	float advance = SimulatedRate(map.GetDuty(3.0f));
+	if (!WithinOnePercent(-retard, advance, "Symmetric"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSolenoidCharacterizer()
+{
+	InvokeTest(Characterize);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+class SolenoidMap;
+
+///////////////////////////////////////////////////////////////////////////////
+// Characterises one solenoid while the engine is running, and builds its
+// SolenoidMap from the results.
+//
+// For each test duty cycle, from FirstDuty upwards, the cam is first brought
+// to CenterAngle, and then the test duty is held while the cam angle rate is
+// measured. The measurement ends after WindowSamples angle samples, or
+// sooner if the cam moves MaxTravel degrees, so the cam never reaches its
+// mechanical stops during a measurement.
+///////////////////////////////////////////////////////////////////////////////
+class SolenoidCharacterizer
+{
+public:
+	static const int StepCount = 31;
+	static const int WindowSamples = 8;
+	static const int SettleSamples = 5;
+
+	enum State
+	{
+		Idle = 0,
+		Centering,
+		Measuring,
+		Complete,
+		Failed,
+	};
+
+	// Degrees, as passed to Update.
+	float CenterAngle;
+	float MaxTravel;
+
+	// Percent.
+	float FirstDuty;
+	float DutyStep;
+
+	State CurrentState;
+	unsigned Step;
+
+	float Duties[StepCount];
+	float Rates[StepCount];
+
+	SolenoidCharacterizer(SolenoidMap *map, float centerAngle);
+
+	void Start();
+	void Cancel();
+	bool IsActive() { return (CurrentState == Centering) || (CurrentState == Measuring); }
+
+	// Invoke with each new cam angle sample while active. Returns the duty
+	// cycle, in percent, to apply in place of the feedback loop's.
+	float Update(unsigned sampleTime, float angle);
+
+private:
+	SolenoidMap *map;
+
+	float duty;
+	float centerIntegral;
+	unsigned lastTime;
+	unsigned samples;
+	unsigned startTime;
+	float startAngle;
+
+	float Center(unsigned sampleTime, float angle);
+	void Finish();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSolenoidCharacterizer();
+
+extern SolenoidCharacterizer LeftCharacterizer;
+extern SolenoidCharacterizer RightCharacterizer;
+extern SolenoidCharacterizer LeftIntakeCharacterizer;
+extern SolenoidCharacterizer RightIntakeCharacterizer;
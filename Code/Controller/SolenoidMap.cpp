@@ -0,0 +1,335 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "SolenoidMap.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+SolenoidMap LeftSolenoidMap;
+SolenoidMap RightSolenoidMap;
+SolenoidMap LeftIntakeSolenoidMap;
+SolenoidMap RightIntakeSolenoidMap;
+
+///////////////////////////////////////////////////////////////////////////////
+// Rates smaller than this, in units of flow, are treated as no movement.
+///////////////////////////////////////////////////////////////////////////////
+static const float DeadBandFlow = 0.25f;
+
+///////////////////////////////////////////////////////////////////////////////
+// Linear interpolation, for the dead band edges and the lookup.
+///////////////////////////////////////////////////////////////////////////////
+static float Interpolate(float x, float x0, float x1, float y0, float y1)
+{
+	if (x1 == x0)
+	{
+		return y0;
+	}
+
+	return y0 + ((y1 - y0) * (x - x0) / (x1 - x0));
+}
+
+SolenoidMap::SolenoidMap()
+{
+	Reset();
+}
+
+void SolenoidMap::Reset()
+{
+	// See the notes about duty cycles in Feedback.cpp.
+	NullDuty = 44.0f;
+	DeadBand = 0;
+	SlopeBelow = SOLENOID_REFERENCE_SLOPE;
+	SlopeAbove = SOLENOID_REFERENCE_SLOPE;
+	PointCount = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The rates are converted to flows and forced to be non-decreasing, since
+// measurement noise should not be allowed to make the inverse ambiguous.
+// The dead band becomes a steep step in the table, from its lower edge to
+// its upper edge, so that small flow requests are not swallowed by it.
+///////////////////////////////////////////////////////////////////////////////
+bool SolenoidMap::Build(const float *duties, const float *rates, int count)
+{
+	if ((count < 2) || (count > MaxPoints - 3))
+	{
+		return false;
+	}
+
+	float flow[MaxPoints];
+	for (int i = 0; i < count; i++)
+	{
+		flow[i] = rates[i] / SOLENOID_REFERENCE_SLOPE;
+		if ((i > 0) && (flow[i] < flow[i - 1]))
+		{
+			flow[i] = flow[i - 1];
+		}
+	}
+
+	// Last point below the dead band, and first point above it.
+	int below = -1;
+	int above = count;
+	for (int i = 0; i < count; i++)
+	{
+		if (flow[i] <= -DeadBandFlow)
+		{
+			below = i;
+		}
+	}
+
+	for (int i = count - 1; i >= 0; i--)
+	{
+		if (flow[i] >= DeadBandFlow)
+		{
+			above = i;
+		}
+	}
+
+	if ((below < 0) || (above >= count) || (below >= above))
+	{
+		return false;
+	}
+
+	float lowerEdge = Interpolate(-DeadBandFlow, flow[below], flow[below + 1], duties[below], duties[below + 1]);
+	float upperEdge = Interpolate(DeadBandFlow, flow[above - 1], flow[above], duties[above - 1], duties[above]);
+
+	NullDuty = (lowerEdge + upperEdge) / 2;
+	DeadBand = upperEdge - lowerEdge;
+	SlopeBelow = below > 0 ? (rates[below] - rates[0]) / (duties[below] - duties[0]) : 0;
+	SlopeAbove = above < count - 1 ? (rates[count - 1] - rates[above]) / (duties[count - 1] - duties[above]) : 0;
+
+	PointCount = 0;
+	for (int i = 0; i <= below; i++)
+	{
+		if ((PointCount == 0) || (flow[i] > Flow[PointCount - 1]))
+		{
+			Flow[PointCount] = flow[i];
+			Duty[PointCount] = duties[i];
+			PointCount++;
+		}
+	}
+
+	// Replace the last point if it sits exactly on the lower edge.
+	if ((PointCount > 0) && (Flow[PointCount - 1] >= -DeadBandFlow))
+	{
+		PointCount--;
+	}
+
+	Flow[PointCount] = -DeadBandFlow;
+	Duty[PointCount++] = lowerEdge;
+	Flow[PointCount] = 0;
+	Duty[PointCount++] = NullDuty;
+	Flow[PointCount] = DeadBandFlow;
+	Duty[PointCount++] = upperEdge;
+
+	for (int i = above; i < count; i++)
+	{
+		if (flow[i] > Flow[PointCount - 1])
+		{
+			Flow[PointCount] = flow[i];
+			Duty[PointCount] = duties[i];
+			PointCount++;
+		}
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Flows beyond the ends of the table get the duty cycle at that end.
+///////////////////////////////////////////////////////////////////////////////
+float SolenoidMap::GetDuty(float flow)
+{
+	if (PointCount == 0)
+	{
+		return NullDuty + flow;
+	}
+
+	if (flow <= Flow[0])
+	{
+		return Duty[0];
+	}
+
+	for (int i = 1; i < PointCount; i++)
+	{
+		if (flow < Flow[i])
+		{
+			return Interpolate(flow, Flow[i - 1], Flow[i], Duty[i - 1], Duty[i]);
+		}
+	}
+
+	return Duty[PointCount - 1];
+}
+
+void SolenoidMap::GetFlowLimits(float maximumDuty, float *minimumFlow, float *maximumFlow)
+{
+	if (PointCount == 0)
+	{
+		*minimumFlow = -NullDuty;
+		*maximumFlow = maximumDuty - NullDuty;
+		return;
+	}
+
+	*minimumFlow = Flow[0];
+	*maximumFlow = Flow[PointCount - 1];
+
+	if (maximumDuty <= Duty[0])
+	{
+		*maximumFlow = Flow[0];
+		return;
+	}
+
+	for (int i = 1; i < PointCount; i++)
+	{
+		if (maximumDuty < Duty[i])
+		{
+			*maximumFlow = Interpolate(maximumDuty, Duty[i - 1], Duty[i], Flow[i - 1], Flow[i]);
+			return;
+		}
+	}
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Without characterisation, duty is the null duty plus the flow.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSolenoidMapDef()
+{
+	SolenoidMap test;
+	if (!WithinOnePercent(test.GetDuty(0.0f), 44.0f, "Null") ||
+		!WithinOnePercent(test.GetDuty(5.0f), 49.0f, "Flow"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A solenoid with a dead band from 46% to 48%, twice as strong above the
+// dead band as below it.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSolenoidMapFit()
+{
+	float duties[11];
+	float rates[11];
+	for (int i = 0; i < 11; i++)
+	{
+		duties[i] = 42.0f + i;
+		rates[i] = 0;
+		if (duties[i] < 46.0f)
+		{
+			rates[i] = (duties[i] - 46.0f) * SOLENOID_REFERENCE_SLOPE;
+		}
+
+		if (duties[i] > 48.0f)
+		{
+			rates[i] = (duties[i] - 48.0f) * SOLENOID_REFERENCE_SLOPE * 2;
+		}
+	}
+
+	SolenoidMap test;
+	if (!test.Build(duties, rates, 11))
+	{
+		TestFailed("Build");
+		return false;
+	}
+
+	if (!WithinOnePercent(test.NullDuty, 47.0f, "Null") ||
+		!WithinOnePercent(test.SlopeAbove, SOLENOID_REFERENCE_SLOPE * 2, "Above") ||
+		!WithinOnePercent(test.SlopeBelow, SOLENOID_REFERENCE_SLOPE, "Below"))
+	{
+		return false;
+	}
+
+	// The dead band edges are where the rate reaches DeadBandFlow, so it
+	// comes out a little wider than the model's.
+	if (!WithinOnePercent(test.DeadBand, 2.375f, "DeadBand"))
+	{
+		return false;
+	}
+
+	// One unit of flow is one percent beyond the edge below the null point,
+	// and half a percent above it.
+	if (!WithinOnePercent(test.GetDuty(-2.0f), 44.0f, "Retard") ||
+		!WithinOnePercent(test.GetDuty(2.0f), 49.0f, "Advance"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rates that never cross zero cannot locate the null point.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSolenoidMapBad()
+{
+	float duties[] = { 40.0f, 45.0f, 50.0f };
+	float rates[] = { 10.0f, 20.0f, 30.0f };
+
+	SolenoidMap test;
+	if (test.Build(duties, rates, 3))
+	{
+		TestFailed("Built");
+		return false;
+	}
+
+	return WithinOnePercent(test.GetDuty(0.0f), 44.0f, "Unchanged");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Flow limits come from the duty cycle range, and from the table ends.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSolenoidLimits()
+{
+	SolenoidMap test;
+	float minimum;
+	float maximum;
+	test.GetFlowLimits(100.0f, &minimum, &maximum);
+	if (!WithinOnePercent(-minimum, 44.0f, "Default Min") ||
+		!WithinOnePercent(maximum, 56.0f, "Default Max"))
+	{
+		return false;
+	}
+
+	float duties[] = { 40.0f, 44.0f, 48.0f, 52.0f };
+	float rates[] = { -80.0f, 0.0f, 0.0f, 80.0f };
+	if (!test.Build(duties, rates, 4))
+	{
+		TestFailed("Build");
+		return false;
+	}
+
+	test.GetFlowLimits(100.0f, &minimum, &maximum);
+	if (!WithinOnePercent(-minimum, 80.0f / SOLENOID_REFERENCE_SLOPE, "Table Min") ||
+		!WithinOnePercent(maximum, 80.0f / SOLENOID_REFERENCE_SLOPE, "Table Max"))
+	{
+		return false;
+	}
+
+	// Low supply voltage: the compensated duty cycle would pass 100% at 50%.
+	test.GetFlowLimits(50.0f, &minimum, &maximum);
+	return WithinOnePercent(maximum, 40.0f / SOLENOID_REFERENCE_SLOPE, "Low Supply");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSolenoidMap()
+{
+	InvokeTest(SolenoidMapDef);
+	InvokeTest(SolenoidMapFit);
+	InvokeTest(SolenoidMapBad);
+	InvokeTest(SolenoidLimits);
+}
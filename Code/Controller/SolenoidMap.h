@@ -0,0 +1,57 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Maps a requested oil flow to a solenoid duty cycle.
+//
+// Flow is in the units of the feedback loop output: one unit of flow should
+// move the cam at SOLENOID_REFERENCE_SLOPE degrees per second, whichever
+// bank it is on and however worn the solenoid is. Duty is in percent.
+//
+// Until the map is built from a characterisation run (see
+// SolenoidCharacterizer.h), the duty cycle is simply the null duty plus
+// the flow, which is how the controller has always worked.
+///////////////////////////////////////////////////////////////////////////////
+class SolenoidMap
+{
+public:
+	static const int MaxPoints = 40;
+
+	// Duty cycle that holds the cam still, and the width of the range of
+	// duty cycles around it that do not move the cam.
+	float NullDuty;
+	float DeadBand;
+
+	// Cam degrees per second for each percent of duty, below and above the
+	// dead band.
+	float SlopeBelow;
+	float SlopeAbove;
+
+	// The inverse lookup table, in order of increasing flow.
+	int PointCount;
+	float Flow[MaxPoints];
+	float Duty[MaxPoints];
+
+	SolenoidMap();
+	void Reset();
+
+	// Build the table from cam angle rates (degrees per second) measured at
+	// the given duty cycles, in order of increasing duty. Returns false, and
+	// leaves the map unchanged, if the rates do not span the null point.
+	bool Build(const float *duties, const float *rates, int count);
+
+	float GetDuty(float flow);
+
+	// The range of flow that duty cycles from zero to the given maximum can
+	// deliver. Requests beyond the ends of the table get no more flow either.
+	void GetFlowLimits(float maximumDuty, float *minimumFlow, float *maximumFlow);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSolenoidMap();
+
+extern SolenoidMap LeftSolenoidMap;
+extern SolenoidMap RightSolenoidMap;
+extern SolenoidMap LeftIntakeSolenoidMap;
+extern SolenoidMap RightIntakeSolenoidMap;
@@ -0,0 +1,246 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "SolenoidOutput.h"
+#include "CurveTable.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+// With the Due's 84MHz clock and 16-bit period counter, pwm_lib uses the
+// divide-by-8 prescaler for periods between 3.12 and 6.24 milliseconds.
+// Staying in that range lets period changes take effect at a period
+// boundary rather than restarting the channel.
+const unsigned MinimumPwmFrequency = 161;
+const unsigned MaximumPwmFrequency = 320;
+
+// Frequencies are rounded to this step, so that small RPM changes do not
+// cause a period write on every update.
+const unsigned PwmFrequencyStep = 10;
+
+static CurveTable *pwmFrequencyTable = CurveTable::CreatePwmFrequencyTable();
+
+unsigned GetSolenoidPeriod(unsigned rpm, unsigned oilTemperature)
+{
+	unsigned frequency = COLD_PWM_FREQUENCY_HZ;
+	if (oilTemperature >= MINIMUM_TEMPERATURE_C)
+	{
+		frequency = (unsigned)pwmFrequencyTable->GetValue((float)rpm);
+		frequency -= frequency % PwmFrequencyStep;
+	}
+
+	if (frequency < MinimumPwmFrequency)
+	{
+		frequency = MinimumPwmFrequency;
+	}
+
+	if (frequency > MaximumPwmFrequency)
+	{
+		frequency = MaximumPwmFrequency;
+	}
+
+	// Hundredths of a microsecond.
+	return 100000000 / frequency;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Stands in for a pwm_lib channel.
+///////////////////////////////////////////////////////////////////////////////
+class TestPwm
+{
+public:
+	unsigned Duty;
+	unsigned Period;
+	unsigned Writes;
+
+	TestPwm()
+	{
+		Duty = 0;
+		Period = 0;
+		Writes = 0;
+	}
+
+	bool start(unsigned period, unsigned duty)
+	{
+		Period = period;
+		Duty = duty;
+		return true;
+	}
+
+	bool set_duty(unsigned duty)
+	{
+		Duty = duty;
+		Writes++;
+		return true;
+	}
+
+	bool set_period_and_duty(unsigned period, unsigned duty)
+	{
+		Period = period;
+		return set_duty(duty);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Spool valve with static friction. The spool only moves once the duty cycle
+// gets more than half the dead band away from its position.
+///////////////////////////////////////////////////////////////////////////////
+class TestSpool
+{
+public:
+	float Position;
+	float DeadBand;
+
+	TestSpool(float position, float deadBand)
+	{
+		Position = position;
+		DeadBand = deadBand;
+	}
+
+	void Drive(float duty)
+	{
+		if (duty > Position + (DeadBand / 2))
+		{
+			Position = duty - (DeadBand / 2);
+		}
+		else if (duty < Position - (DeadBand / 2))
+		{
+			Position = duty + (DeadBand / 2);
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Pending duty cycles only reach the channel when applied, and only when
+// they change.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSolenoidWrites()
+{
+	SolenoidOutput<TestPwm> test;
+	test.Start(1000);
+
+	test.Pending = 0.4f;
+	if (!CompareUnsigned(test.Driver.Writes, 0, "Before apply"))
+	{
+		return false;
+	}
+
+	test.Apply();
+	test.Apply();
+	if (!CompareUnsigned(test.Driver.Duty, 400, "Duty") ||
+		!CompareUnsigned(test.Driver.Writes, 1, "Unchanged"))
+	{
+		return false;
+	}
+
+	test.PendingPeriod = 2000;
+	test.Apply();
+	if (!CompareUnsigned(test.Driver.Period, 2000, "Period") ||
+		!CompareUnsigned(test.Driver.Duty, 800, "Scaled duty"))
+	{
+		return false;
+	}
+
+	test.Disable();
+	test.Disable();
+	if (!CompareUnsigned(test.Driver.Duty, 0, "Disabled") ||
+		!CompareUnsigned(test.Driver.Writes, 3, "Still disabled"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cold oil gets the cold frequency, and the table is limited to one
+// prescaler range.
+///////////////////////////////////////////////////////////////////////////////
+bool TestPwmSchedule()
+{
+	if (!CompareUnsigned(GetSolenoidPeriod(3000, 20), 100000000 / COLD_PWM_FREQUENCY_HZ, "Cold") ||
+		!CompareUnsigned(GetSolenoidPeriod(3000, 90), 100000000 / 250, "Cruise") ||
+		!CompareUnsigned(GetSolenoidPeriod(3200, 90), 100000000 / 250, "Rounded") ||
+		!CompareUnsigned(GetSolenoidPeriod(9000, 90), 100000000 / MaximumPwmFrequency, "Redline"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A small duty change that static friction would otherwise swallow moves
+// the spool when dither is applied.
+///////////////////////////////////////////////////////////////////////////////
+float AverageSpoolPosition(SolenoidOutput<TestPwm> *output, TestSpool *spool)
+{
+	float total = 0;
+	for (int period = 0; period < 10; period++)
+	{
+		output->Dither();
+		spool->Drive(output->Driver.Duty / 1000000.0f);
+		total += spool->Position;
+	}
+
+	return total / 10;
+}
+
+float MeasureSpoolShift(float ditherAmplitude)
+{
+	SolenoidOutput<TestPwm> output;
+	output.DitherAmplitude = ditherAmplitude;
+	output.DitherHalfPeriod = 1;
+	output.Start(1000000);
+
+	TestSpool spool(0.5f, 0.04f);
+	output.Pending = 0.5f;
+	output.Apply();
+	float before = AverageSpoolPosition(&output, &spool);
+
+	// Step by a quarter of the dead band.
+	output.Pending = 0.51f;
+	output.Apply();
+	float after = AverageSpoolPosition(&output, &spool);
+
+	return after - before;
+}
+
+bool TestDitherDeadBand()
+{
+	float stuck = MeasureSpoolShift(0);
+	float dithered = MeasureSpoolShift(0.03f);
+
+	if (stuck != 0)
+	{
+		sprintf(FailureMessage, "Spool moved without dither: %f", stuck);
+		return false;
+	}
+
+	if (!WithinOnePercent(dithered * 100, 1.0f, "Dithered"))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSolenoidOutput()
+{
+	InvokeTest(SolenoidWrites);
+	InvokeTest(PwmSchedule);
+	InvokeTest(DitherDeadBand);
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#ifdef ARDUINO
+#include "InterruptPriorities.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Double-buffered solenoid output.
+//
+// The control computation stores a pending duty cycle and PWM period, and
+// Apply() copies them to the PWM channel at a fixed point in the engine
+// cycle. Once a channel is running, pwm_lib writes the SAM3X PWM_CDTYUPD and
+// PWM_CPRDUPD shadow registers, which the hardware latches at the next period
+// boundary, so a new duty or period never truncates or stretches the pulse
+// that is in progress. (pwm_lib restarts the channel if a new period needs a
+// different clock prescaler, which is why GetSolenoidPeriod stays within one
+// prescaler range.)
+//
+// Dither() superimposes a square wave on the duty cycle, to keep the spool
+// valve moving so that static friction does not create a dead band. It is
+// meant to be invoked at the end of every PWM period.
+//
+// The channel is only written when the duty actually changes, so holding a
+// solenoid at zero does not cost a peripheral write on every update.
+//
+// Apply() and Disable() run from the angle scheduler (TC5) or PendSV, and
+// Dither() from the PWM interrupt, which can preempt PendSV. The PWM
+// interrupt is held off while Apply() changes the duty and writes it, so a
+// dither step never writes a duty from the previous ratio over a new one.
+//
+// TPwm is any type with set_duty and set_period_and_duty, such as pwm_lib's
+// pwm<pin>. Durations are in pwm_lib units, hundredths of a microsecond.
+///////////////////////////////////////////////////////////////////////////////
+template <class TPwm>
+class SolenoidOutput
+{
+public:
+	TPwm Driver;
+
+	// Duty cycle (0 to 1) and period to be applied by the next Apply().
+	volatile float Pending;
+	volatile unsigned PendingPeriod;
+
+	// Dither amplitude (0 to 1, zero disables dither), and the number of PWM
+	// periods in each half of the dither cycle.
+	float DitherAmplitude;
+	unsigned DitherHalfPeriod;
+
+	// Duty cycle and period most recently written to the PWM channel.
+	unsigned Written;
+	unsigned Period;
+
+	SolenoidOutput()
+	{
+		Pending = 0;
+		PendingPeriod = 0;
+		DitherAmplitude = 0;
+		DitherHalfPeriod = 1;
+		Written = 0;
+		Period = 0;
+		ratio = 0;
+		ditherCount = 0;
+		ditherHigh = false;
+	}
+
+	void Start(unsigned period)
+	{
+		Pending = 0;
+		PendingPeriod = period;
+		Written = 0;
+		Period = period;
+		ratio = 0;
+		Driver.start(period, 0);
+	}
+
+	// Write the pending duty cycle and period, if they differ from the
+	// current ones.
+	void Apply()
+	{
+		unsigned previous = HoldDither();
+		ratio = Pending;
+		bool written = Write(PendingPeriod);
+		ReleaseDither(previous);
+
+		if (!written)
+		{
+			SolenoidWritesSkipped++;
+			return;
+		}
+
+		SolenoidWrites++;
+	}
+
+	// Step the dither waveform. Does nothing while the solenoid is off.
+	void Dither()
+	{
+		if ((DitherAmplitude == 0) || (ratio == 0))
+		{
+			return;
+		}
+
+		ditherCount++;
+		if (ditherCount < DitherHalfPeriod)
+		{
+			return;
+		}
+
+		ditherCount = 0;
+		ditherHigh = !ditherHigh;
+		Write(Period);
+	}
+
+	// Disabling the solenoid should not wait for the next scheduled Apply().
+	void Disable()
+	{
+		Pending = 0;
+		Apply();
+	}
+
+private:
+	// Duty cycle applied by the last Apply(), before dither.
+	float ratio;
+
+	unsigned ditherCount;
+	bool ditherHigh;
+
+	// Raise BASEPRI to the PWM priority, which holds off the PWM interrupt
+	// and anything less urgent, but not the edge handlers or TC5. Returns
+	// the previous level for ReleaseDither, so that this nests.
+	static unsigned HoldDither()
+	{
+#ifdef ARDUINO
+		unsigned previous = __get_BASEPRI();
+		unsigned level = PwmPriority << (8 - __NVIC_PRIO_BITS);
+		if ((previous == 0) || (previous > level))
+		{
+			__set_BASEPRI(level);
+		}
+
+		return previous;
+#else
+		return 0;
+#endif
+	}
+
+	static void ReleaseDither(unsigned previous)
+	{
+#ifdef ARDUINO
+		__set_BASEPRI(previous);
+#else
+		(void)previous;
+#endif
+	}
+
+	bool Write(unsigned period)
+	{
+		float dithered = ratio;
+		if (ratio > 0)
+		{
+			dithered += ditherHigh ? DitherAmplitude : -DitherAmplitude;
+		}
+
+		if (dithered < 0)
+		{
+			dithered = 0;
+		}
+
+		if (dithered > 1)
+		{
+			dithered = 1;
+		}
+
+		unsigned duty = (unsigned)(period * dithered);
+		if (period != Period)
+		{
+			Driver.set_period_and_duty(period, duty);
+			Period = period;
+			Written = duty;
+			return true;
+		}
+
+		if (duty == Written)
+		{
+			return false;
+		}
+
+		Driver.set_duty(duty);
+		Written = duty;
+		return true;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PWM period for the given RPM and oil temperature (centigrade), in pwm_lib
+// units. See the PWM_FREQUENCY settings in Configuration.h.
+///////////////////////////////////////////////////////////////////////////////
+unsigned GetSolenoidPeriod(unsigned rpm, unsigned oilTemperature);
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSolenoidOutput();
@@ -0,0 +1,131 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "RollingAverage.h"
+#include "SupplyVoltage.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+SupplyVoltage Supply;
+
+///////////////////////////////////////////////////////////////////////////////
+// The main loop samples several thousand times per second, so this still
+// follows a voltage dip during cranking within a few tens of milliseconds,
+// while averaging out alternator ripple and PWM noise.
+///////////////////////////////////////////////////////////////////////////////
+static const float SampleWeight = 0.01f;
+
+// Outside this range the reading is more likely a wiring fault than a real
+// supply voltage, so no compensation is applied.
+static const float MinimumPlausibleVolts = 6.0f;
+static const float MaximumPlausibleVolts = 18.0f;
+
+// 3.3V reference, 10-bit ADC.
+static const float VoltsPerCount = 3.3f / 1023.0f;
+
+SupplyVoltage::SupplyVoltage()
+{
+	Volts = 0;
+	Millivolts = 0;
+	sampled = false;
+}
+
+void SupplyVoltage::Sample(unsigned raw)
+{
+	float volts = raw * VoltsPerCount * SUPPLY_VOLTAGE_DIVIDER;
+	if (!sampled)
+	{
+		Volts = volts;
+		sampled = true;
+	}
+	else
+	{
+		UpdateRollingAverage(&Volts, volts, SampleWeight);
+	}
+
+	Millivolts = (unsigned)(Volts * 1000);
+}
+
+float SupplyVoltage::Compensate(float duty)
+{
+	if ((Volts < MinimumPlausibleVolts) || (Volts > MaximumPlausibleVolts))
+	{
+		return duty;
+	}
+
+	return duty * (SUPPLY_REFERENCE_VOLTAGE / Volts);
+}
+
+float SupplyVoltage::GetMaximumDuty()
+{
+	if ((Volts < MinimumPlausibleVolts) || (Volts > MaximumPlausibleVolts))
+	{
+		return 100.0f;
+	}
+
+	return 100.0f * (Volts / SUPPLY_REFERENCE_VOLTAGE);
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Low voltage raises the duty cycle, and implausible readings are ignored.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSupplyScale()
+{
+	SupplyVoltage test;
+	if (!WithinOnePercent(test.Compensate(40.0f), 40.0f, "Unsampled"))
+	{
+		return false;
+	}
+
+	// Half the reference voltage.
+	unsigned raw = (unsigned)((SUPPLY_REFERENCE_VOLTAGE / 2) / (VoltsPerCount * SUPPLY_VOLTAGE_DIVIDER));
+	test.Sample(raw);
+	if (!WithinOnePercent(test.Volts, SUPPLY_REFERENCE_VOLTAGE / 2, "Volts") ||
+		!WithinOnePercent(test.Compensate(40.0f), 80.0f, "Half") ||
+		!WithinOnePercent(test.GetMaximumDuty(), 50.0f, "Max Duty"))
+	{
+		return false;
+	}
+
+	// A disconnected input reads zero.
+	SupplyVoltage open;
+	open.Sample(0);
+	return WithinOnePercent(open.Compensate(40.0f), 40.0f, "Open");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A step in voltage is followed gradually.
+///////////////////////////////////////////////////////////////////////////////
+bool TestSupplyFilter()
+{
+	SupplyVoltage test;
+	test.Sample(600);
+	for (int i = 0; i < 100; i++)
+	{
+		test.Sample(800);
+	}
+
+	// After one time constant, 63% of the way there.
+	float expected = (600 + (200 * 0.634f)) * VoltsPerCount * SUPPLY_VOLTAGE_DIVIDER;
+	return WithinOnePercent(test.Volts, expected, "Filtered");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSupplyVoltage()
+{
+	InvokeTest(SupplyScale);
+	InvokeTest(SupplyFilter);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Supply voltage, measured through a divider on analog input 10, and
+// compensation of solenoid duty cycles for it.
+//
+// Solenoid current, and so the force on the spool, is roughly proportional
+// to supply voltage times duty cycle. Scaling the duty cycle by the ratio of
+// SUPPLY_REFERENCE_VOLTAGE to the measured voltage keeps the force for a
+// given feedback output the same at cranking voltage, idle and charging.
+///////////////////////////////////////////////////////////////////////////////
+class SupplyVoltage
+{
+public:
+	// Filtered supply voltage.
+	float Volts;
+
+	// The same, for display.
+	unsigned Millivolts;
+
+	SupplyVoltage();
+
+	// The raw value is a 10-bit analogRead result.
+	void Sample(unsigned raw);
+
+	// Scale a duty cycle (in any units) from the reference voltage to the
+	// measured voltage. Readings outside the plausible range are ignored.
+	float Compensate(float duty);
+
+	// The largest duty cycle, in percent, that still compensates to 100%.
+	float GetMaximumDuty();
+
+private:
+	bool sampled;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestSupplyVoltage();
+
+extern SupplyVoltage Supply;
@@ -0,0 +1,253 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include <math.h>
+#include "stdafx.h"
+#include "Globals.h"
+#include "TargetTrajectory.h"
+#include "Feedback.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+TargetTrajectory ExhaustTrajectory;
+TargetTrajectory IntakeTrajectory;
+
+// Time steps longer than this (say, after the crank signal drops out) are
+// treated as this long, so the trajectory does not leap toward the target.
+static const float MaxTimeStep = 0.1f;
+
+TargetTrajectory::TargetTrajectory()
+{
+	MaxRate = TARGET_RATE_LIMIT;
+	MaxAcceleration = TARGET_RATE_LIMIT / TARGET_RISE_TIME;
+	Reset(0);
+}
+
+void TargetTrajectory::Reset(float position)
+{
+	Position = position;
+	Velocity = 0;
+	Acceleration = 0;
+	lastTime = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The rest of the flow is left to the feedback loop, to correct for load
+// and for errors in the map.
+///////////////////////////////////////////////////////////////////////////////
+void TargetTrajectory::SetFlowLimit(float flow)
+{
+	MaxRate = flow * SOLENOID_REFERENCE_SLOPE * TARGET_RATE_FRACTION;
+	MaxAcceleration = MaxRate / TARGET_RISE_TIME;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The velocity is limited to what can still be brought to rest at the
+// target within the acceleration limit.
+///////////////////////////////////////////////////////////////////////////////
+float TargetTrajectory::Update(float target, unsigned now)
+{
+	if (lastTime == 0)
+	{
+		lastTime = now;
+		return Position;
+	}
+
+	float time = ((float)(now - lastTime)) / ((float)TicksPerSecond);
+	lastTime = now;
+	if (time > MaxTimeStep)
+	{
+		time = MaxTimeStep;
+	}
+
+	float error = target - Position;
+	float desired = sqrtf(2 * MaxAcceleration * fabsf(error));
+	if (desired > MaxRate)
+	{
+		desired = MaxRate;
+	}
+
+	if (error < 0)
+	{
+		desired = -desired;
+	}
+
+	float change = desired - Velocity;
+	float maxChange = MaxAcceleration * time;
+	if (change > maxChange)
+	{
+		change = maxChange;
+	}
+
+	if (change < -maxChange)
+	{
+		change = -maxChange;
+	}
+
+	Velocity += change;
+	Position += Velocity * time;
+	Acceleration = change / time;
+
+	// Arrived, or would have passed the target during this step.
+	if ((target - Position) * error <= 0)
+	{
+		Position = target;
+		Velocity = 0;
+		Acceleration = 0;
+	}
+
+	return Position;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The output takes effect some time after the sample it was computed from,
+// so the feedforward is the velocity projected that far ahead.
+///////////////////////////////////////////////////////////////////////////////
+float TargetTrajectory::GetFeedforward()
+{
+	return (Velocity + (Acceleration * TARGET_FEEDFORWARD_LEAD)) / SOLENOID_REFERENCE_SLOPE;
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// A step is followed within the rate limit, and without overshoot.
+///////////////////////////////////////////////////////////////////////////////
+bool TestTrajectoryStep()
+{
+	TargetTrajectory test;
+	test.MaxRate = 50.0f;
+	test.MaxAcceleration = 500.0f;
+
+	unsigned now = 1000;
+	test.Update(0, now);
+
+	float maxVelocity = 0;
+	float maxPosition = 0;
+	unsigned arrival = 0;
+	for (int i = 0; i < 100; i++)
+	{
+		now += TicksPerSecond / 100;
+		float position = test.Update(10.0f, now);
+		if (test.Velocity > maxVelocity)
+		{
+			maxVelocity = test.Velocity;
+		}
+
+		if (position > maxPosition)
+		{
+			maxPosition = position;
+		}
+
+		if ((arrival == 0) && (position == 10.0f))
+		{
+			arrival = i + 1;
+		}
+	}
+
+	if (!WithinOnePercent(maxVelocity, 50.0f, "Rate") ||
+		!WithinOnePercent(maxPosition, 10.0f, "Overshoot"))
+	{
+		return false;
+	}
+
+	// About 300ms: 100ms at full rate, and 100ms each to speed up and to
+	// slow down.
+	if ((arrival < 25) || (arrival > 31))
+	{
+		TestFailed("Arrival");
+		return false;
+	}
+
+	return CompareUnsigned((unsigned)test.Velocity, 0, "Stopped");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulate a cam that moves at SOLENOID_REFERENCE_SLOPE degrees per second
+// per unit of feedback output, sampled every 10ms, with each output taking
+// effect half way to the next sample. Returns the overshoot of a 5 degree target step,
+// and the number of samples until the cam stays within 0.25 degrees.
+///////////////////////////////////////////////////////////////////////////////
+static float SimulateStep(bool shaped, unsigned *settled)
+{
+	Feedback feedback;
+	feedback.Engage(2500);
+
+	TargetTrajectory trajectory;
+	trajectory.MaxRate = 50.0f;
+	trajectory.MaxAcceleration = 500.0f;
+
+	unsigned sampleTime = 1000;
+	float angle = 0;
+	float applied = 0;
+	float maxAngle = 0;
+	*settled = 0;
+	for (int i = 0; i < 200; i++)
+	{
+		float target = 5.0f;
+		if (shaped)
+		{
+			target = trajectory.Update(5.0f, sampleTime);
+			feedback.Feedforward = trajectory.GetFeedforward();
+		}
+
+		feedback.Update(sampleTime, 2500, angle, target);
+		angle += ((applied + feedback.Output) / 2) * SOLENOID_REFERENCE_SLOPE * 0.01f;
+		applied = feedback.Output;
+		sampleTime += TicksPerSecond / 100;
+
+		if (angle > maxAngle)
+		{
+			maxAngle = angle;
+		}
+
+		if (fabsf(angle - 5.0f) > 0.25f)
+		{
+			*settled = i + 1;
+		}
+	}
+
+	return maxAngle - 5.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The shaped target with feedforward settles sooner and overshoots less
+// than the raw step.
+///////////////////////////////////////////////////////////////////////////////
+bool TestTrajectoryTrack()
+{
+	unsigned rawSettled;
+	unsigned shapedSettled;
+	float rawOvershoot = SimulateStep(false, &rawSettled);
+	float shapedOvershoot = SimulateStep(true, &shapedSettled);
+
+	if (shapedOvershoot >= rawOvershoot)
+	{
+		TestFailed("Overshoot");
+		return false;
+	}
+
+	if (shapedSettled >= rawSettled)
+	{
+		TestFailed("Settling");
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestTargetTrajectory()
+{
+	InvokeTest(TrajectoryStep);
+	InvokeTest(TrajectoryTrack);
+}
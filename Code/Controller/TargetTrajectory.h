@@ -0,0 +1,54 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Shapes the target cam angle from the target table into a trajectory that
+// the phasers can actually follow.
+//
+// The table target can jump, for example from 0 to 1 degree when the RPM
+// crosses MINIMUM_EXAVCS_RPM. The trajectory moves toward it no faster than
+// MaxRate, and speeds up and slows down no faster than MaxAcceleration, so
+// it arrives without overshooting. Its velocity is fed forward into the
+// feedback loops, which then only have to correct for the difference.
+///////////////////////////////////////////////////////////////////////////////
+class TargetTrajectory
+{
+public:
+	// Shaped target, degrees.
+	float Position;
+
+	// Rate of change of the shaped target, degrees per second.
+	float Velocity;
+
+	// Rate of change of the velocity, degrees per second per second.
+	float Acceleration;
+
+	// Limits, in degrees per second and degrees per second per second.
+	float MaxRate;
+	float MaxAcceleration;
+
+	TargetTrajectory();
+
+	// Start the trajectory from the given angle, at rest.
+	void Reset(float position);
+
+	// Limit the rate to a fraction of the given flow (see SolenoidMap.h),
+	// and the acceleration to reach that rate in TARGET_RISE_TIME.
+	void SetFlowLimit(float flow);
+
+	// Move toward the target and return the new Position.
+	float Update(float target, unsigned now);
+
+	// Velocity as a feedback loop output, see SolenoidMap.h.
+	float GetFeedforward();
+
+private:
+	unsigned lastTime;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestTargetTrajectory();
+
+extern TargetTrajectory ExhaustTrajectory;
+extern TargetTrajectory IntakeTrajectory;
@@ -10,8 +10,19 @@
 #include "IntervalRecorder.h"
 #include "Terminal.h"
 #include "ExhaustCamState.h"
+#include "IntakeCamState.h"
 #include "CrankState.h"
 #include "Feedback.h"
+#include "LatencyHistogram.h"
+#include "SolenoidMap.h"
+#include "SolenoidCharacterizer.h"
+#include "RelayAutotuner.h"
+#include "OscillationDetector.h"
+#include "ValveEvents.h"
+#include "PlausibilityMonitor.h"
+#include "SupplyVoltage.h"
+#include "OilPressureState.h"
+#include "Configuration.h"
 
 extern Mode mode;
 
@@ -23,6 +34,10 @@ enum TerminalMode
 	ShowIntervals,
 	ShowMenu,
 	SetParameter,
+	Characterize,
+	Autotune,
+	SelectRule,
+	AcceptGains,
 };
 
 enum Parameter
@@ -75,6 +90,7 @@ private:
 	LogMethodPtr logMethod;
 	Parameter parameter;
 	int logSkipCount;
+	RelayAutotuner::Rule tuningRule;
 
 	static const int MaxLogLineLength = 1000;
 	char logData[MaxLogLineLength];
@@ -86,6 +102,7 @@ public:
 		terminalMode = TerminalMode::ShowMenu;
 		logMethod = NULL;
 		logSkipCount = 0;
+		tuningRule = RelayAutotuner::ZieglerNichols;
 
 		// This is a little bit hacky...
 		//ITerminal::GetInstance();
@@ -135,6 +152,30 @@ public:
 					logSkipCount = 0;
 					break;
 
+				case TerminalMode::Characterize:
+					StartCharacterization();
+					logMethod = item->GetLogMethod();
+					logSkipCount = 0;
+					break;
+
+				case TerminalMode::Autotune:
+					StartAutotune();
+					logMethod = item->GetLogMethod();
+					logSkipCount = 0;
+					break;
+
+				case TerminalMode::SelectRule:
+					tuningRule = (RelayAutotuner::Rule)((tuningRule + 1) % RelayAutotuner::RuleCount);
+					logMethod = item->GetLogMethod();
+					logSkipCount = 0;
+					break;
+
+				case TerminalMode::AcceptGains:
+					AcceptAutotune();
+					logMethod = item->GetLogMethod();
+					logSkipCount = 0;
+					break;
+
 				default:
 				case TerminalMode::ShowMenu:
 					logMethod = NULL;
@@ -154,6 +195,10 @@ public:
 			break;
 
 		case TerminalMode::LogCsv:
+		case TerminalMode::Characterize:
+		case TerminalMode::Autotune:
+		case TerminalMode::SelectRule:
+		case TerminalMode::AcceptGains:
 			WriteLog();
 			break;
 
@@ -205,15 +250,17 @@ public:
 		snprintf(
 			logData,
 			MaxLogLineLength,
-			"Default,%d,%d,%d,%d,%2.2f,%2.4f,%2.2f,%2.4f\r\n",
+			"Default,%d,%d,%d,%d,%2.2f,%2.2f,%2.2f,%2.4f,%2.2f,%2.4f\r\n",
 			millis(),
 			mode.GetMode(),
 			ErrorCount,
 			OilTemperature,
-			LeftExhaustCam.Angle,
-			LeftFeedback.Output,
-			RightExhaustCam.Angle,
-			RightFeedback.Output);
+			Supply.Volts,
+			OilPressure.Psi,
+			LeftExhaustCam.View.Angle,
+			LeftFeedback.View.Output,
+			RightExhaustCam.View.Angle,
+			RightFeedback.View.Output);
 	}
 
 	void WriteLogVerbose()
@@ -228,25 +275,25 @@ public:
 			InitializationErrorCount,
 
 			// L1
-			LeftExhaustCam.Rpm,
-			LeftExhaustCam.AverageInterval,
+			LeftExhaustCam.View.Rpm,
+			LeftExhaustCam.View.AverageInterval,
 
 			// L2 
-			LeftExhaustCam.PulseDuration,
-			LeftExhaustCam.CalibrationCountdown,
+			LeftExhaustCam.View.PulseDuration,
+			LeftExhaustCam.View.CalibrationCountdown,
 
 			// R1
-			RightExhaustCam.Rpm,
-			RightExhaustCam.AverageInterval,
+			RightExhaustCam.View.Rpm,
+			RightExhaustCam.View.AverageInterval,
 
 			// R2
-			RightExhaustCam.PulseDuration,
-			RightExhaustCam.CalibrationCountdown,
+			RightExhaustCam.View.PulseDuration,
+			RightExhaustCam.View.CalibrationCountdown,
 
 			// C
-			Crank.Rpm,
-			Crank.AverageInterval,
-			Crank.PulseDuration);
+			Crank.View.Rpm,
+			Crank.View.AverageInterval,
+			Crank.View.PulseDuration);
 	}
 
 	void WriteLogBaseline()
@@ -255,12 +302,12 @@ public:
 			logData,
 			MaxLogLineLength,
 			"LB,%04d,%2.2f,%2.2f,RB,%04d,%2.2f,%2.2f\r\n",
-			LeftExhaustCam.Rpm,
-			LeftExhaustCam.Baseline,
-			LeftExhaustCam.Angle,
-			RightExhaustCam.Rpm,
-			RightExhaustCam.Baseline,
-			RightExhaustCam.Angle);
+			LeftExhaustCam.View.Rpm,
+			LeftExhaustCam.View.Baseline,
+			LeftExhaustCam.View.Angle,
+			RightExhaustCam.View.Rpm,
+			RightExhaustCam.View.Baseline,
+			RightExhaustCam.View.Angle);
 	}
 
 	void WriteLogLeft()
@@ -271,10 +318,10 @@ public:
 			"Left,%d,%d,%04d,%2.2f,%2.2f,%2.4f\r\n",
 			mode.GetMode(),
 			ErrorCount,
-			LeftExhaustCam.Rpm,
-			LeftExhaustCam.Baseline,
-			LeftExhaustCam.Angle,
-			LeftFeedback.Output);
+			LeftExhaustCam.View.Rpm,
+			LeftExhaustCam.View.Baseline,
+			LeftExhaustCam.View.Angle,
+			LeftFeedback.View.Output);
 	}
 
 	void WriteLogRight()
@@ -285,10 +332,253 @@ public:
 			"Right,%d,%d,%04d,%2.2f,%2.2f,%2.4f\r\n",
 			mode.GetMode(),
 			ErrorCount,
-			RightExhaustCam.Rpm,
-			RightExhaustCam.Baseline,
-			RightExhaustCam.Angle,
-			RightFeedback.Output);
+			RightExhaustCam.View.Rpm,
+			RightExhaustCam.View.Baseline,
+			RightExhaustCam.View.Angle,
+			RightFeedback.View.Output);
+	}
+
+	void WriteLogIntake()
+	{
+		snprintf(
+			logData,
+			MaxLogLineLength,
+			"Intake,%d,%d,%04d,%2.2f,%2.2f,%2.4f,%04d,%2.2f,%2.2f,%2.4f,%d\r\n",
+			mode.GetMode(),
+			ErrorCount,
+			LeftIntakeCam.View.Rpm,
+			LeftIntakeCam.View.Baseline,
+			LeftIntakeCam.View.Angle,
+			LeftIntakeFeedback.View.Output,
+			RightIntakeCam.View.Rpm,
+			RightIntakeCam.View.Baseline,
+			RightIntakeCam.View.Angle,
+			RightIntakeFeedback.View.Output,
+			IsrMaxDuration);
+	}
+
+	void WriteLogLatency()
+	{
+		int length = snprintf(logData, MaxLogLineLength, "Latency,%d", millis());
+
+		LatencyHistogram *banks[] = { &LeftLatency, &RightLatency };
+		const char *names[] = { "L", "R" };
+		for (int bank = 0; bank < 2; bank++)
+		{
+			length += snprintf(&logData[length], MaxLogLineLength - length, ",%s", names[bank]);
+			for (int i = 0; i < LatencyHistogram::BucketCount; i++)
+			{
+				length += snprintf(&logData[length], MaxLogLineLength - length, ",%d", banks[bank]->Counts[i]);
+			}
+
+			length += snprintf(&logData[length], MaxLogLineLength - length, ",%d", banks[bank]->Max);
+		}
+
+		snprintf(&logData[length], MaxLogLineLength - length, "\r\n");
+	}
+
+	void StartCharacterization()
+	{
+		LeftCharacterizer.Start();
+		RightCharacterizer.Start();
+#ifdef UseIntakeCams
+		LeftIntakeCharacterizer.Start();
+		RightIntakeCharacterizer.Start();
+#endif
+	}
+
+	int WriteCharacterization(int length, const char *name, SolenoidCharacterizer *characterizer, SolenoidMap *map)
+	{
+		return snprintf(&logData[length], MaxLogLineLength - length,
+			",%s,%d,%d,%2.2f,%2.2f,%2.2f,%2.2f",
+			name,
+			characterizer->CurrentState,
+			characterizer->Step,
+			map->NullDuty,
+			map->DeadBand,
+			map->SlopeBelow,
+			map->SlopeAbove);
+	}
+
+	void WriteLogCharacterization()
+	{
+		int length = snprintf(logData, MaxLogLineLength, "Characterize,%d", millis());
+		length += WriteCharacterization(length, "L", &LeftCharacterizer, &LeftSolenoidMap);
+		length += WriteCharacterization(length, "R", &RightCharacterizer, &RightSolenoidMap);
+#ifdef UseIntakeCams
+		length += WriteCharacterization(length, "LI", &LeftIntakeCharacterizer, &LeftIntakeSolenoidMap);
+		length += WriteCharacterization(length, "RI", &RightIntakeCharacterizer, &RightIntakeSolenoidMap);
+#endif
+		snprintf(&logData[length], MaxLogLineLength - length, "\r\n");
+	}
+
+	void StartAutotune()
+	{
+		LeftAutotuner.Start();
+		RightAutotuner.Start();
+#ifdef UseIntakeCams
+		LeftIntakeAutotuner.Start();
+		RightIntakeAutotuner.Start();
+#endif
+	}
+
+	int WriteAutotune(int length, const char *name, RelayAutotuner *autotuner)
+	{
+		float proportional = 0;
+		float integral = 0;
+		float derivative = 0;
+		autotuner->GetGains(tuningRule, &proportional, &integral, &derivative);
+
+		return snprintf(&logData[length], MaxLogLineLength - length,
+			",%s,%d,%d,%04d,%2.3f,%2.3f,%2.3f,%2.3f,%2.4f",
+			name,
+			autotuner->CurrentState,
+			autotuner->Cycles,
+			autotuner->Rpm,
+			autotuner->UltimateGain,
+			autotuner->UltimatePeriod,
+			proportional,
+			integral,
+			derivative);
+	}
+
+	void WriteLogAutotune()
+	{
+		int length = snprintf(logData, MaxLogLineLength, "Autotune,%d,%s", millis(), RelayAutotuner::GetRuleName(tuningRule));
+		length += WriteAutotune(length, "L", &LeftAutotuner);
+		length += WriteAutotune(length, "R", &RightAutotuner);
+#ifdef UseIntakeCams
+		length += WriteAutotune(length, "LI", &LeftIntakeAutotuner);
+		length += WriteAutotune(length, "RI", &RightIntakeAutotuner);
+#endif
+		snprintf(&logData[length], MaxLogLineLength - length, "\r\n");
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Both banks share a gain schedule, so the gains stored are the average
+	// of those proposed for the banks whose experiments completed.
+	///////////////////////////////////////////////////////////////////////////
+	void StoreAutotune(Feedback *feedback, RelayAutotuner *left, RelayAutotuner *right)
+	{
+		RelayAutotuner *autotuners[] = { left, right };
+		float proportional = 0;
+		float integral = 0;
+		float derivative = 0;
+		unsigned rpm = 0;
+		int count = 0;
+		for (int bank = 0; bank < 2; bank++)
+		{
+			float p, i, d;
+			if (autotuners[bank]->GetGains(tuningRule, &p, &i, &d))
+			{
+				proportional += p;
+				integral += i;
+				derivative += d;
+				rpm += autotuners[bank]->Rpm;
+				count++;
+			}
+		}
+
+		if (count == 0)
+		{
+			return;
+		}
+
+		feedback->StoreGains(rpm / count, proportional / count, integral / count, derivative / count);
+	}
+
+	void AcceptAutotune()
+	{
+		// Any backoff was for the old gains.
+		LeftOscillation.Reset();
+		RightOscillation.Reset();
+
+		StoreAutotune(&LeftFeedback, &LeftAutotuner, &RightAutotuner);
+#ifdef UseIntakeCams
+		StoreAutotune(&LeftIntakeFeedback, &LeftIntakeAutotuner, &RightIntakeAutotuner);
+#endif
+	}
+
+	void WriteLogGains()
+	{
+		snprintf(
+			logData,
+			MaxLogLineLength,
+			"Gains,%d,%04d,%d,L,%2.3f,%2.3f,%2.4f,%2.2f,R,%2.3f,%2.3f,%2.4f,%2.2f\r\n",
+			millis(),
+			Crank.View.Rpm,
+			OilTemperature,
+			LeftFeedback.View.ProportionalGain,
+			LeftFeedback.View.IntegralGain,
+			LeftFeedback.View.DerivativeGain,
+			LeftFeedback.View.GainScale,
+			RightFeedback.View.ProportionalGain,
+			RightFeedback.View.IntegralGain,
+			RightFeedback.View.DerivativeGain,
+			RightFeedback.View.GainScale);
+	}
+
+	void WriteLogOscillation()
+	{
+		snprintf(
+			logData,
+			MaxLogLineLength,
+			"Oscillation,%d,%04d,L,%d,%d,%d,%2.2f,%2.2f,%2.2f,R,%d,%d,%d,%2.2f,%2.2f,%2.2f\r\n",
+			millis(),
+			Crank.View.Rpm,
+			LeftOscillation.Oscillating,
+			LeftOscillation.Cycles,
+			LeftOscillation.Detections,
+			LeftOscillation.Amplitude,
+			LeftOscillation.Frequency,
+			LeftOscillation.GainScale,
+			RightOscillation.Oscillating,
+			RightOscillation.Cycles,
+			RightOscillation.Detections,
+			RightOscillation.Amplitude,
+			RightOscillation.Frequency,
+			RightOscillation.GainScale);
+	}
+
+	void WriteLogValves()
+	{
+		snprintf(
+			logData,
+			MaxLogLineLength,
+			"Valves,%d,%04d,L,%2.1f,%2.1f,%2.1f,%2.1f,%2.1f,%d,%2.1f,%2.1f,R,%2.1f,%2.1f,%2.1f,%2.1f,%2.1f,%d,%2.1f,%2.1f\r\n",
+			millis(),
+			Crank.View.Rpm,
+			LeftValves.IntakeOpen,
+			LeftValves.IntakeClose,
+			LeftValves.ExhaustOpen,
+			LeftValves.ExhaustClose,
+			LeftValves.Overlap,
+			LeftValves.Limited,
+			LeftValves.ExhaustLimit,
+			LeftValves.IntakeLimit,
+			RightValves.IntakeOpen,
+			RightValves.IntakeClose,
+			RightValves.ExhaustOpen,
+			RightValves.ExhaustClose,
+			RightValves.Overlap,
+			RightValves.Limited,
+			RightValves.ExhaustLimit,
+			RightValves.IntakeLimit);
+	}
+
+	void WriteLogFaults()
+	{
+		snprintf(
+			logData,
+			MaxLogLineLength,
+			"Faults,%d,%04d,%02X,%02X,%d,%d,%s\r\n",
+			millis(),
+			Crank.View.Rpm,
+			Plausibility.ActiveFaults,
+			Plausibility.StoredFaults,
+			Plausibility.FaultEvents,
+			Plausibility.FailedChecks,
+			PlausibilityMonitor::GetFaultName(Plausibility.ActiveFaults));
 	}
 
 	void WriteLogCrank()
@@ -299,16 +589,16 @@ public:
 			"Crank,%d,%d,%04d,%d,%d,%d,%d\r\n",
 			millis(),
 			mode.GetMode(),
-			Crank.Rpm,
-			Crank.AverageInterval,
-			Crank.PulseDuration,
+			Crank.View.Rpm,
+			Crank.View.AverageInterval,
+			Crank.View.PulseDuration,
 			Crank.AnalogValue,
 			0); // Crank.AnalogHigh);
 	}
 
 	Terminal()
 	{
-		menuItems = new TerminalMenuItem*[12]
+		menuItems = new TerminalMenuItem*[22]
 		{
 			new TerminalMenuItem("Show Menu", 'M', TerminalMode::ShowMenu, NULL, Parameter::None),
 			new TerminalMenuItem("Show Sequence", 'S', TerminalMode::ShowIntervals, NULL, Parameter::None),
@@ -318,6 +608,16 @@ public:
 			new TerminalMenuItem("Left Log", 'L', TerminalMode::LogCsv, &Terminal::WriteLogLeft, Parameter::None),
 			new TerminalMenuItem("Right Log", 'R', TerminalMode::LogCsv, &Terminal::WriteLogRight, Parameter::None),
 			new TerminalMenuItem("Crank Log", 'C', TerminalMode::LogCsv, &Terminal::WriteLogCrank, Parameter::None),
+			new TerminalMenuItem("Intake Log", 'N', TerminalMode::LogCsv, &Terminal::WriteLogIntake, Parameter::None),
+			new TerminalMenuItem("Latency Log", 'T', TerminalMode::LogCsv, &Terminal::WriteLogLatency, Parameter::None),
+			new TerminalMenuItem("Gain Log", 'G', TerminalMode::LogCsv, &Terminal::WriteLogGains, Parameter::None),
+			new TerminalMenuItem("Oscillation Log", 'O', TerminalMode::LogCsv, &Terminal::WriteLogOscillation, Parameter::None),
+			new TerminalMenuItem("Valve Event Log", 'V', TerminalMode::LogCsv, &Terminal::WriteLogValves, Parameter::None),
+			new TerminalMenuItem("Fault Log", 'F', TerminalMode::LogCsv, &Terminal::WriteLogFaults, Parameter::None),
+			new TerminalMenuItem("Characterize Solenoids", 'Z', TerminalMode::Characterize, &Terminal::WriteLogCharacterization, Parameter::None),
+			new TerminalMenuItem("Autotune Gains", 'A', TerminalMode::Autotune, &Terminal::WriteLogAutotune, Parameter::None),
+			new TerminalMenuItem("Next Tuning Rule", 'K', TerminalMode::SelectRule, &Terminal::WriteLogAutotune, Parameter::None),
+			new TerminalMenuItem("Accept Tuned Gains", 'Y', TerminalMode::AcceptGains, &Terminal::WriteLogGains, Parameter::None),
 			new TerminalMenuItem("Adjust Proportional Gain", 'P', TerminalMode::SetParameter, NULL, Parameter::ProportionalGain),
 			new TerminalMenuItem("Adjust Integral Gain", 'I', TerminalMode::SetParameter, NULL, Parameter::IntegralGain),
 			new TerminalMenuItem("Adjust Derivative Gain", 'D', TerminalMode::SetParameter, NULL, Parameter::DerivativeGain),
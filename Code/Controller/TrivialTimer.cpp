@@ -1,44 +1,197 @@
 // TrivialTimer.cpp - Timer based on calls to micros()
 
+#ifdef ARDUINO
 #include <Arduino.h>
+#endif
+
+#include "stdafx.h"
 #include "TrivialTimer.h"
+#include "SelfTest.h"
 
 TrivialTimer::TrivialTimer()
 {
+	startTime = 0;
+	timeout = 0;
+	timeoutIsr = NULL;
+	running = false;
 }
 
 void TrivialTimer::attachInterrupt(void (*isr)(unsigned))
 {	
+	timeoutIsr = isr;
 }
 
 void TrivialTimer::detachInterrupt(void)
 {
+	timeoutIsr = NULL;
 }
 
-void TrivialTimer::start()
+void TrivialTimer::start(unsigned now)
 {
-	startTime = micros();
+	startTime = now;
+	running = true;
 }
 
 void TrivialTimer::stop(void)
 {
+	running = false;
 }
 
 void TrivialTimer::configure(unsigned timeout)
 {
+	this->timeout = timeout;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The start time can be ahead of the given time. An edge handler can restart
+// the timer after the caller read the clock, and micros() reads up to a tick
+// low in the SysTick hook, which the core calls before it counts the tick.
+// Either way the timer was started after "now", so it has not timed out.
+///////////////////////////////////////////////////////////////////////////////
+void TrivialTimer::poll(unsigned now)
+{
+	if (!running || (timeoutIsr == NULL) || (timeout == 0))
+	{
+		return;
+	}
+
+	int elapsed = (int)(now - startTime);
+	if ((elapsed > 0) && ((unsigned)elapsed > timeout))
+	{
+		timeoutIsr(0);
+	}
+}
+
+unsigned TrivialTimer::getTimeout(unsigned interval, unsigned intervals, unsigned maximum)
+{
+	// Checked by division, so that a long interval cannot overflow.
+	if ((interval == 0) || (interval > (maximum / intervals)))
+	{
+		return maximum;
+	}
+
+	return interval * intervals;
+}
+
+#ifdef ARDUINO
+void TrivialTimer::start()
+{
+	start(micros());
+}
+
+void TrivialTimer::poll()
+{
+	poll(micros());
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Unsigned subtraction handles timer wraparound.
+///////////////////////////////////////////////////////////////////////////////
 unsigned TrivialTimer::getElapsed(void) const 
 {
-	unsigned currentTime = micros();
-	if (currentTime > startTime)
+	return micros() - startTime;
+}
+#endif
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+static unsigned testTimeouts;
+
+static void CountTimeout(unsigned status)
+{
+	testTimeouts++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The handler runs once the timeout has passed, and not before.
+///////////////////////////////////////////////////////////////////////////////
+bool TestTimerTimeout()
+{
+	TrivialTimer test;
+	test.configure(1000);
+	test.attachInterrupt(CountTimeout);
+	testTimeouts = 0;
+
+	test.start(5000);
+	test.poll(5500);
+	test.poll(6000);
+	if (!CompareUnsigned(testTimeouts, 0, "Early"))
+	{
+		return false;
+	}
+
+	test.poll(6001);
+	if (!CompareUnsigned(testTimeouts, 1, "Late"))
+	{
+		return false;
+	}
+
+	// Stopped, and across the wraparound of the clock.
+	test.stop();
+	test.poll(9000);
+	test.start(0xFFFFFF00);
+	test.poll(0x00000100);
+	if (!CompareUnsigned(testTimeouts, 1, "Wrapped"))
+	{
+		return false;
+	}
+
+	test.poll(0x00000400);
+	return CompareUnsigned(testTimeouts, 2, "Wrapped.2");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A timer started after the clock was read has not timed out, however far
+// ahead the start time is.
+///////////////////////////////////////////////////////////////////////////////
+bool TestTimerRestart()
+{
+	TrivialTimer test;
+	test.configure(1000);
+	test.attachInterrupt(CountTimeout);
+	testTimeouts = 0;
+
+	test.start(5000);
+	test.poll(4999);
+	test.poll(4000);
+	return CompareUnsigned(testTimeouts, 0, "Restarted");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A few intervals normally, the maximum for slow or unknown signals.
+///////////////////////////////////////////////////////////////////////////////
+bool TestTimerLimits()
+{
+	if (!CompareUnsigned(TrivialTimer::getTimeout(20000, 4, 500000), 80000, "Intervals"))
+	{
+		return false;
+	}
+
+	if (!CompareUnsigned(TrivialTimer::getTimeout(200000, 4, 500000), 500000, "Slow"))
 	{
-		return currentTime - startTime;
+		return false;
 	}
-	else
+
+	if (!CompareUnsigned(TrivialTimer::getTimeout(0x80000000, 4, 500000), 500000, "Overflow"))
 	{
-		unsigned a = 0xFFFFFFFF - startTime;
-		unsigned b = currentTime;
-		return a + b;
+		return false;
 	}
+
+	return CompareUnsigned(TrivialTimer::getTimeout(0, 4, 500000), 500000, "Unknown");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestTrivialTimer()
+{
+	InvokeTest(TimerTimeout);
+	InvokeTest(TimerRestart);
+	InvokeTest(TimerLimits);
 }
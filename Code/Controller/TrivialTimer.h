@@ -1,9 +1,19 @@
+#pragma once
+
 // Timer based on calls to micros()
 
+//
+// There is no timer interrupt behind this, so timeouts only happen when
+// poll() is called. See SuperviseSignals in InterruptHandlers.cpp.
+
 class TrivialTimer
 {
 protected:
-	unsigned startTime;
+	// Written by the edge handlers, which can preempt poll().
+	volatile unsigned startTime;
+	unsigned timeout;
+	void (*timeoutIsr)(unsigned);
+	volatile bool running;
 
 public:
 
@@ -14,4 +24,23 @@ public:
 	void start();
 	void stop(void);	
 	unsigned getElapsed(void) const;
+
+	// Invokes the attached handler if the timer was started more than the
+	// configured timeout ago. To be called regularly from a timebase.
+	void poll();
+
+	// As above, with the clock read by the caller. The time must be read
+	// before the call, so that a restart during the call is seen as one.
+	void start(unsigned now);
+	void poll(unsigned now);
+
+	// Timeout for a signal expected every interval: that many intervals, but
+	// no more than the maximum, which also applies while the interval is not
+	// known (zero).
+	static unsigned getTimeout(unsigned interval, unsigned intervals, unsigned maximum);
 };
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestTrivialTimer();
@@ -0,0 +1,153 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "stdafx.h"
+#include "Globals.h"
+#include "ValveEvents.h"
+#include "Configuration.h"
+#include "SelfTest.h"
+
+ValveEvents LeftValves(CamProfile::CreateBc272Profile(), MAX_VALVE_OVERLAP);
+ValveEvents RightValves(CamProfile::CreateBc272Profile(), MAX_VALVE_OVERLAP);
+
+CamProfile::CamProfile(float intakeOpen, float intakeClose, float exhaustOpen, float exhaustClose)
+{
+	IntakeOpen = intakeOpen;
+	IntakeClose = intakeClose;
+	ExhaustOpen = exhaustOpen;
+	ExhaustClose = exhaustClose;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BC 272 dual AVCS cams at 0.050" lift. With 15 degrees of exhaust retard
+// and 30 degrees of intake advance this gives the 11 degrees of overlap
+// that made the engine run rough (see CurveTable.cpp).
+///////////////////////////////////////////////////////////////////////////////
+CamProfile * CamProfile::CreateBc272Profile()
+{
+	return new CamProfile(-19.0f, 61.0f, 57.0f, -15.0f);
+}
+
+ValveEvents::ValveEvents(CamProfile *profile, float maxOverlap)
+{
+	this->profile = profile;
+	MaxOverlap = maxOverlap;
+	baseOverlap = profile->IntakeOpen + profile->ExhaustClose;
+	ExhaustLimit = 0;
+	IntakeLimit = 0;
+	Limited = 0;
+	Update(0, 0);
+}
+
+void ValveEvents::Update(float exhaustAngle, float intakeAngle)
+{
+	IntakeOpen = profile->IntakeOpen + intakeAngle;
+	IntakeClose = profile->IntakeClose - intakeAngle;
+	ExhaustOpen = profile->ExhaustOpen - exhaustAngle;
+	ExhaustClose = profile->ExhaustClose + exhaustAngle;
+	Overlap = IntakeOpen + ExhaustClose;
+}
+
+void ValveEvents::Limit(float *exhaustTarget, float exhaustAngle, float *intakeTarget, float intakeAngle)
+{
+	float intake = (*intakeTarget > intakeAngle) ? *intakeTarget : intakeAngle;
+	float maxRetard = MaxOverlap - baseOverlap - intake;
+	if (maxRetard < 0)
+	{
+		maxRetard = 0;
+	}
+
+	ExhaustLimit = 0;
+	if (*exhaustTarget > maxRetard)
+	{
+		ExhaustLimit = *exhaustTarget - maxRetard;
+		*exhaustTarget = maxRetard;
+	}
+
+	float exhaust = (*exhaustTarget > exhaustAngle) ? *exhaustTarget : exhaustAngle;
+	float maxAdvance = MaxOverlap - baseOverlap - exhaust;
+	if (maxAdvance < 0)
+	{
+		maxAdvance = 0;
+	}
+
+	IntakeLimit = 0;
+	if (*intakeTarget > maxAdvance)
+	{
+		IntakeLimit = *intakeTarget - maxAdvance;
+		*intakeTarget = maxAdvance;
+	}
+
+	Limited = (ExhaustLimit > 0) || (IntakeLimit > 0);
+}
+
+// ############################################################################
+// ############################################################################
+//
+// Test cases
+//
+// ############################################################################
+// ############################################################################
+
+///////////////////////////////////////////////////////////////////////////////
+// Events match Docs/ValveEvents.txt with both cams at the far end of their
+// range.
+///////////////////////////////////////////////////////////////////////////////
+bool TestValveEvents()
+{
+	ValveEvents test(CamProfile::CreateBc272Profile(), 100.0f);
+	test.Update(15.0f, 20.0f);
+
+	return
+		WithinOnePercent(test.IntakeOpen, 1.0f, "IVO") &&
+		WithinOnePercent(test.IntakeClose, 41.0f, "IVC") &&
+		WithinOnePercent(test.ExhaustOpen, 42.0f, "EVO") &&
+		CompareUnsigned((unsigned)test.ExhaustClose, 0, "EVC") &&
+		WithinOnePercent(test.Overlap, 1.0f, "Overlap");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The rough-running case is limited, exhaust first.
+///////////////////////////////////////////////////////////////////////////////
+bool TestValveLimit()
+{
+	ValveEvents test(CamProfile::CreateBc272Profile(), 5.0f);
+
+	float exhaust = 15.0f;
+	float intake = 30.0f;
+	test.Limit(&exhaust, 0, &intake, 0);
+	if (!WithinOnePercent(exhaust, 9.0f, "Exhaust") ||
+		!WithinOnePercent(intake, 30.0f, "Intake") ||
+		!WithinOnePercent(test.ExhaustLimit, 6.0f, "Amount") ||
+		!CompareUnsigned(test.Limited, 1, "Limited"))
+	{
+		return false;
+	}
+
+	// With the exhaust already retarded, the intake gives way too.
+	exhaust = 15.0f;
+	intake = 30.0f;
+	test.Limit(&exhaust, 15.0f, &intake, 0);
+	if (!WithinOnePercent(intake, 24.0f, "Intake Limited"))
+	{
+		return false;
+	}
+
+	// Within the limit, nothing changes.
+	exhaust = 1.0f;
+	intake = 30.0f;
+	test.Limit(&exhaust, 1.0f, &intake, 30.0f);
+	return
+		WithinOnePercent(exhaust, 1.0f, "Free") &&
+		CompareUnsigned(test.Limited, 0, "Not Limited");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestValveEvents()
+{
+	InvokeTest(ValveEvents);
+	InvokeTest(ValveLimit);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Valve timing for one engine's cams, at one lift point, with both cams in
+// their base positions: intake fully retarded, exhaust fully advanced.
+//
+// Angles are crank degrees: intake opening before TDC, intake closing
+// after BDC, exhaust opening before BDC, and exhaust closing after TDC.
+// Negative values mean the other side of the dead center, so at 0.050"
+// lift a negative overlap is the gap between exhaust closing and intake
+// opening. See Docs/ValveEvents.txt.
+///////////////////////////////////////////////////////////////////////////////
+class CamProfile
+{
+public:
+	float IntakeOpen;
+	float IntakeClose;
+	float ExhaustOpen;
+	float ExhaustClose;
+
+	CamProfile(float intakeOpen, float intakeClose, float exhaustOpen, float exhaustClose);
+
+	static CamProfile * CreateBc272Profile();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Valve events and overlap for one bank, from the live cam angles, and the
+// limit on valve overlap.
+//
+// Intake advance opens and closes the intake valve earlier, exhaust retard
+// opens and closes the exhaust valve later, so overlap grows with both.
+// Since the events move one-for-one with the cam angles, the limits reduce
+// to a few constants worked out from the profile at start-up.
+///////////////////////////////////////////////////////////////////////////////
+class ValveEvents
+{
+public:
+	// Events for the current cam angles, in the units of CamProfile.
+	float IntakeOpen;
+	float IntakeClose;
+	float ExhaustOpen;
+	float ExhaustClose;
+	float Overlap;
+
+	float MaxOverlap;
+
+	// Degrees taken off each target by the overlap limit, and whether
+	// either was limited on the last update.
+	float ExhaustLimit;
+	float IntakeLimit;
+	int Limited;
+
+	ValveEvents(CamProfile *profile, float maxOverlap);
+
+	// Exhaust angle is degrees of retard, intake angle is degrees of advance.
+	void Update(float exhaustAngle, float intakeAngle);
+
+	// Keep the targets within MaxOverlap, checked against the further of
+	// each cam's target and actual angle. The exhaust gives way first.
+	void Limit(float *exhaustTarget, float exhaustAngle, float *intakeTarget, float intakeAngle);
+
+private:
+	CamProfile *profile;
+
+	// Overlap with both cams in their base positions.
+	float baseOverlap;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit test suite entry point
+///////////////////////////////////////////////////////////////////////////////
+void SelfTestValveEvents();
+
+extern ValveEvents LeftValves;
+extern ValveEvents RightValves;